@@ -10,6 +10,9 @@
 #import "SpaceInvadersMachine.h"
 #include <sys/time.h>
 
+uint8_t machineIn(state8080* state, uint8_t port);
+void machineOut(state8080* state, uint8_t port, uint8_t value);
+
 @implementation SpaceInvadersMachine
 
 // Code courtesy of Kent Miller and emulator101.com
@@ -37,6 +40,9 @@
 -(id) init {
     state = calloc(sizeof(state8080), 1);
     state->memory = malloc(16 * 0x1000);
+    state->inPort = machineIn;
+    state->outPort = machineOut;
+    state->userData = (__bridge void *) self;
     
     [self ReadFile:@"invaders.h" IntoMemoryAt:0x0000];
     [self ReadFile:@"invaders.g" IntoMemoryAt:0x0800];
@@ -95,10 +101,10 @@
     
     if((state->intEnable) && (now > nextInterrupt)) {
         if(numInterrupt == 1) {
-            generateInterrupt(state, 1);
+            requestInterrupt(state, 1);
             numInterrupt = 2;
         } else {
-            generateInterrupt(state, 2);
+            requestInterrupt(state, 2);
             numInterrupt = 1;
         }
         nextInterrupt = now + 8000.0;
@@ -106,22 +112,9 @@
     
     double sinceLast = now - previousTimer;
     int cyclesToCatchUp = 2 * sinceLast;
-    int cycles = 0;
     
-    while(cyclesToCatchUp > cycles) {
-        unsigned char *op;
-        op = &state->memory[state->pc];
-        if(*op == 0xdb) {
-            state->a = [self InSpaceInvaders:op[1]];
-            state->pc += 2;
-            cycles +=3;
-        } else if(*op == 0xd3) {
-            [self OutSpaceInvaders:op[1] value: state->a];
-            state->pc += 2;
-            cycles += 3;
-        } else {
-            cycles += emulateOp(state);
-        }
+    if(cyclesToCatchUp > 0) {
+        runCycles(state, cyclesToCatchUp);
         previousTimer = now;
     }
 }
@@ -135,3 +128,14 @@
 }
 
 @end
+
+// Port hooks for the core, userData is the machine
+uint8_t machineIn(state8080* state, uint8_t port) {
+    SpaceInvadersMachine *machine = (__bridge SpaceInvadersMachine *) state->userData;
+    return [machine InSpaceInvaders:port];
+}
+
+void machineOut(state8080* state, uint8_t port, uint8_t value) {
+    SpaceInvadersMachine *machine = (__bridge SpaceInvadersMachine *) state->userData;
+    [machine OutSpaceInvaders:port value:value];
+}
@@ -19,23 +19,36 @@ typedef struct conditionCodes {
   uint8_t pad:1;
 } conditionCodes;
 
+/* Macro for a register pair, usable as one 16 bit word or two bytes
+  The bytes are ordered so the first register is the high byte of the
+  word on both little and big endian hosts
+*/
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define REGISTER_PAIR(word, high, low) union { uint16_t word; struct { high; low; }; }
+#else
+#define REGISTER_PAIR(word, high, low) union { uint16_t word; struct { low; high; }; }
+#endif
+
 /* Struct emulating the state of the 8080 processor
   Features registers A-L, the stack pointer, program counter,
   the memory, condition codes, etc.
+  BC, DE and HL can be used as pairs through bc, de and hl
 */
 typedef struct state8080 {
-  uint8_t a;
-  uint8_t b;
-  uint8_t c;
-  uint8_t d;
-  uint8_t e;
-  uint8_t h;
-  uint8_t l;
+  REGISTER_PAIR(psw, uint8_t a, struct conditionCodes cc); // A and the flags
+  REGISTER_PAIR(bc, uint8_t b, uint8_t c);
+  REGISTER_PAIR(de, uint8_t d, uint8_t e);
+  REGISTER_PAIR(hl, uint8_t h, uint8_t l);
   uint16_t sp; // Stack Pointer
   uint16_t pc; // Program Counter
   uint8_t *memory;
-  struct conditionCodes cc;
   uint8_t intEnable;
+  uint8_t interruptPending; // Set by requestInterrupt, taken by runCycles
+  uint8_t interruptNumber; // RST number of the pending interrupt
+  uint8_t stopRequested; // Set by requestStop to end runCycles early
+  uint8_t (*inPort)(struct state8080* state, uint8_t port); // IN hook, NULL if unused
+  void (*outPort)(struct state8080* state, uint8_t port, uint8_t value); // OUT hook
+  void *userData; // For the hooks, the emulator doesn't touch it
 } state8080;
 
 /* Exception for unimplimented instructions
@@ -83,6 +96,29 @@ unsigned char cycles[] = {
     11, 10, 10, 4, 17, 11, 7, 11, 11, 5, 10, 4, 17, 17, 7, 11
 };
 
+/* Function to handle the IN op
+  Input: state8080 struct, port number
+  Output: uint8_t value read from the port
+  Leaves A unchanged if no inPort hook is set
+*/
+uint8_t readFromPort(state8080* state, uint8_t port) {
+  if(state->inPort == NULL) {
+    return state->a;
+  }
+  return state->inPort(state, port);
+}
+
+/* Function to handle the OUT op
+  Input: state8080 struct, port number, value to write
+  Output: void
+  Does nothing if no outPort hook is set
+*/
+void writeToPort(state8080* state, uint8_t port, uint8_t value) {
+  if(state->outPort != NULL) {
+    state->outPort(state, port, value);
+  }
+}
+
 /* Code implementation of the 8080 op codes
   Input: state8080 Struct
   Output: void
@@ -109,27 +145,18 @@ int emulateOp(state8080* state) {
 
     // Register Manipulation
     case 0x01:
-      state->c = opCode[1];
-      state->b = opCode[2];
-      state->pc +=2;
+      state->bc = (opCode[2] << 8) | opCode[1];
+      state->pc += 2;
       break; // LXI B,D1
 
     // TODO: Review STAX B in data book
     case 0x02:
-      state->memory[(state->b <<8) | state->c] = state->a;
+      state->memory[state->bc] = state->a;
       break; // STAX B
 
-    case 0x03: {
-      // Put BC into one value
-      uint16_t combined = (state->b << 8) | state->c;
-      // Increment by 1
-      combined += 1;
-      // Replace c with new value, masking top bits
-      state->c = combined & 0xff;
-      // Replace b with the shifted value
-      state->b = (combined >> 8) & 0xff;
+    case 0x03:
+      state->bc += 1;
       break; // INX B
-    }
 
     case 0x04: {
       uint16_t val = (uint16_t) state->b + 1;
@@ -162,34 +189,23 @@ int emulateOp(state8080* state) {
     }
 
     case 0x09: {
-      uint16_t hl = (state->h << 8) | state->l;
-      uint16_t bc = (state->b << 8) | state->c;
-      uint32_t total = hl + bc;
+      uint32_t total = state->hl + state->bc;
       if(total > 0xffff) {
         state->cc.cy = 1;
       } else {
         state->cc.cy = 0;
       }
-      state->h = (total >> 8) & 0xff;
-      state->l = total & 0xff;
+      state->hl = total & 0xffff;
       break; // DAD B
     }
 
     case 0x0a:
-      state->a = state->memory[(state->b << 8) | state->c];
+      state->a = state->memory[state->bc];
       break; // LDAX B
 
-    case 0x0b: {
-      // Put BC into one value
-      uint16_t combined = (state->b << 8) | state->c;
-      // Decrement by 1
-      combined -= 1;
-      // Replace c with new value, masking top bits
-      state->c = combined & 0xff;
-      // Replace b with the shifted value
-      state->b = (combined >> 8) & 0xff;
+    case 0x0b:
+      state->bc -= 1;
       break; // DCX B
-    }
 
     case 0x0c: {
       uint16_t val = (uint16_t) state->c + 1;
@@ -222,22 +238,17 @@ int emulateOp(state8080* state) {
     }
 
     case 0x11:
-      state->e = opCode[1];
-      state->d = opCode[2];
+      state->de = (opCode[2] << 8) | opCode[1];
       state->pc += 2;
       break; // LXI D,D16
 
     case 0x12:
-      state->memory[(state->d << 8 ) | state->e] = state->a;
+      state->memory[state->de] = state->a;
       break; // STAX D
 
-    case 0x13: {
-      uint16_t combined = (state->d << 8) | state->e;
-      combined += 1;
-      state->e = combined & 0xff;
-      state->d = (combined >> 8) & 0xff;
+    case 0x13:
+      state->de += 1;
       break; // INX D
-    }
 
     case 0x14: {
       uint16_t val = (uint16_t) state->d + 1;
@@ -270,30 +281,23 @@ int emulateOp(state8080* state) {
     }
 
     case 0x19: {
-      uint16_t hl = (state->h << 8) | state->l;
-      uint16_t de = (state->d << 8) | state->e;
-      uint32_t total = hl + de;
+      uint32_t total = state->hl + state->de;
       if(total > 0xffff) {
         state->cc.cy = 1;
       } else {
         state->cc.cy = 0;
       }
-      state->h = (total >> 8) & 0xff;
-      state->l = total & 0xff;
+      state->hl = total & 0xffff;
       break; // DAD D
     }
 
     case 0x1a:
-      state->a = state->memory[(state->d << 8 ) | state->e];
+      state->a = state->memory[state->de];
       break; // LDAX D
 
-    case 0x1b: {
-      uint16_t combined = (state->d << 8) | state->e;
-      combined -= 1;
-      state->e = combined & 0xff;
-      state->d = (combined >> 8) & 0xff;
+    case 0x1b:
+      state->de -= 1;
       break; // DCX D
-    }
 
     case 0x1c: {
       uint16_t val = (uint16_t) state->e + 1;
@@ -327,8 +331,7 @@ int emulateOp(state8080* state) {
     }
 
     case 0x21:
-      state->l = opCode[1];
-      state->h = opCode[2];
+      state->hl = (opCode[2] << 8) | opCode[1];
       state->pc += 2;
       break; // LXIH,D16
 
@@ -338,13 +341,9 @@ int emulateOp(state8080* state) {
       state->pc += 2;
       break; // SHLD adr
 
-    case 0x23: {
-      uint16_t combined = (state->h << 8) | state->l;
-      combined += 1;
-      state->l = combined & 0xff;
-      state->h = (combined >> 8) & 0xff;
+    case 0x23:
+      state->hl += 1;
       break; // INX H
-    }
 
     case 0x24: {
       uint16_t val = (uint16_t) state->h + 1;
@@ -372,15 +371,13 @@ int emulateOp(state8080* state) {
     case 0x27: unimplementedInstruction(state); break; // DAA
 
     case 0x29: {
-      uint16_t hl = (state->h << 8) | state->l;
-      uint32_t total = hl + hl;
+      uint32_t total = state->hl + state->hl;
       if(total > 0xffff) {
         state->cc.cy = 1;
       } else {
         state->cc.cy = 0;
       }
-      state->h = (total >> 8) & 0xff;
-      state->l = total & 0xff;
+      state->hl = total & 0xffff;
       break; // DAD H
     }
 
@@ -390,13 +387,9 @@ int emulateOp(state8080* state) {
       state->pc += 2;
       break; // LHLD adr
 
-    case 0x2b: {
-      uint16_t combined = (state->h << 8) | state->l;
-      combined -= 1;
-      state->l = combined & 0xff;
-      state->h = (combined >> 8) & 0xff;
+    case 0x2b:
+      state->hl -= 1;
       break; // DCX H
-    }
 
     case 0x2c: {
       uint16_t val = (uint16_t) state->l + 1;
@@ -440,20 +433,20 @@ int emulateOp(state8080* state) {
       break; // INX SP
 
     case 0x34: {
-      uint16_t val = state->memory[(state->h << 8) | state->l] + 1;
+      uint16_t val = state->memory[state->hl] + 1;
       state->cc.z = ((val & 0xff) == 0);
       state->cc.s = ((val & 0x80) != 0);
       state->cc.p = parity(val & 0xff);
-      state->memory[(state->h << 8) | state->l] += 1;
+      state->memory[state->hl] += 1;
       break; // INR M
     }
 
     case 0x35: {
-      uint16_t val = state->memory[(state->h << 8) | state->l] - 1;
+      uint16_t val = state->memory[state->hl] - 1;
       state->cc.z = ((val & 0xff) == 0);
       state->cc.s = ((val & 0x80) != 0);
       state->cc.p = parity(val & 0xff);
-      state->memory[(state->h << 8) | state->l] -= 1;
+      state->memory[state->hl] -= 1;
       break; // DCR M
     }
 
@@ -468,12 +461,11 @@ int emulateOp(state8080* state) {
       break; // STC
 
     case 0x39: {
-      uint32_t val = ((state->h << 8) | state->l) + state->sp;
+      uint32_t val = state->hl + state->sp;
       if(val > 0xffff){
         state->cc.cy = 1;
       }
-      state->h = (val >> 8) & 0xff;
-      state->l = val & 0xff;
+      state->hl = val & 0xffff;
       break; // DAD SP
     }
 
@@ -527,7 +519,7 @@ int emulateOp(state8080* state) {
     case 0x45: state->b = state->l; break; // MOV B,L
 
     case 0x46:
-      state->b = state->memory[(state->h << 8) | state->l];
+      state->b = state->memory[state->hl];
       break; // MOV B,M
 
     case 0x47: state->b = state->a; break; // MOV B,A
@@ -545,7 +537,7 @@ int emulateOp(state8080* state) {
     case 0x4d: state->c = state->l; break;
 
     case 0x4e:
-      state->c = state->memory[(state->h << 8) | state->l];
+      state->c = state->memory[state->hl];
       break; // MOV C,M
 
     case 0x4f: state->c = state->a; break;
@@ -563,7 +555,7 @@ int emulateOp(state8080* state) {
     case 0x55: state->d = state->l; break;
 
     case 0x56:
-      state->d = state->memory[(state->h << 8) | state->l];
+      state->d = state->memory[state->hl];
       break; // MOV D,M
 
     case 0x57: state->d = state->a; break;
@@ -581,7 +573,7 @@ int emulateOp(state8080* state) {
     case 0x5d: state->e = state->l; break;
 
     case 0x5e:
-      state->e = state->memory[(state->h << 8) | state->l];
+      state->e = state->memory[state->hl];
       break; // MOV E,M
 
     case 0x5f: state->e = state->a; break;
@@ -599,7 +591,7 @@ int emulateOp(state8080* state) {
     case 0x65: state->h = state->l; break;
 
     case 0x66:
-      state->h = state->memory[(state->h << 8) | state->l];
+      state->h = state->memory[state->hl];
       break; // MOV H,M
 
     case 0x67: state->h = state->a; break;
@@ -617,39 +609,39 @@ int emulateOp(state8080* state) {
     case 0x6d: state->l = state->l; break;
 
     case 0x6e:
-      state->l = state->memory[(state->h << 8) | state->l];
+      state->l = state->memory[state->hl];
       break; // MOV L,M
 
     case 0x6f: state->l = state->a; break;
 
     case 0x70:
-      state->memory[(state->h << 8) | state->l] = state->b;
+      state->memory[state->hl] = state->b;
       break; // MOV M,B
 
     case 0x71:
-      state->memory[(state->h << 8) | state->l] = state->c;
+      state->memory[state->hl] = state->c;
       break; // MOV M,C
 
     case 0x72:
-      state->memory[(state->h << 8) | state->l] = state->d;
+      state->memory[state->hl] = state->d;
       break; // MOV M,D
 
     case 0x73:
-      state->memory[(state->h << 8) | state->l] = state->e;
+      state->memory[state->hl] = state->e;
       break; // MOV M,E
 
     case 0x74:
-      state->memory[(state->h << 8) | state->l] = state->h;
+      state->memory[state->hl] = state->h;
       break; // MOV M,H
 
     case 0x75:
-      state->memory[(state->h << 8) | state->l] = state->l;
+      state->memory[state->hl] = state->l;
       break; // MOV M,L
 
     case 0x76: exit(0); break; // HLT
 
     case 0x77:
-      state->memory[(state->h << 8) | state->l] = state->a;
+      state->memory[state->hl] = state->a;
       break; // MOV M,A
 
     case 0x78: state->a = state->b; break;
@@ -665,7 +657,7 @@ int emulateOp(state8080* state) {
     case 0x7d: state->a = state->l; break;
 
     case 0x7e:
-      state->a = state->memory[(state->h << 8) | state->l];
+      state->a = state->memory[state->hl];
       break; // MOV A,M
 
     case 0x7f: state->a = state->a; break;
@@ -732,7 +724,7 @@ int emulateOp(state8080* state) {
     }
 
     case 0x86: {
-      uint16_t val = state->a + state->memory[(state->h << 8) | state->l];
+      uint16_t val = state->a + state->memory[state->hl];
       state->cc.z = ((val & 0xff) == 0);
       state->cc.s = ((val & 0x80) != 0);
       state->cc.cy = (val > 0xff);
@@ -811,7 +803,7 @@ int emulateOp(state8080* state) {
     }
 
     case 0x8e: {
-      uint16_t val = state->a + state->memory[(state->h << 8) | state->l] + state->cc.cy;
+      uint16_t val = state->a + state->memory[state->hl] + state->cc.cy;
       state->cc.z = ((val & 0xff) == 0);
       state->cc.s = ((val & 0x80) != 0);
       state->cc.cy = (val > 0xff);
@@ -891,7 +883,7 @@ int emulateOp(state8080* state) {
     }
 
     case 0x96: {
-      uint16_t val = state->a - state->memory[(state->h << 8) | state->l];
+      uint16_t val = state->a - state->memory[state->hl];
       state->cc.z = ((val & 0xff) == 0);
       state->cc.s = ((val & 0x80) != 0);
       state->cc.cy = (val > 0xff);
@@ -971,7 +963,7 @@ int emulateOp(state8080* state) {
     }
 
     case 0x9e: {
-      uint16_t val = state->a - state->memory[(state->h << 8) | state->l] - state->cc.cy;
+      uint16_t val = state->a - state->memory[state->hl] - state->cc.cy;
       state->cc.z = ((val & 0xff) == 0);
       state->cc.s = ((val & 0x80) != 0);
       state->cc.cy = (val > 0xff);
@@ -1052,7 +1044,7 @@ int emulateOp(state8080* state) {
     }
 
     case 0xa6: {
-      uint16_t val = state->a & state->memory[(state->h << 8) | state->l];
+      uint16_t val = state->a & state->memory[state->hl];
       state->cc.z = ((val & 0xff) == 0);
       state->cc.s = ((val & 0x80) != 0);
       state->cc.cy = (val > 0xff);
@@ -1132,7 +1124,7 @@ int emulateOp(state8080* state) {
     }
 
     case 0xae: {
-      uint16_t val = state->a ^ state->memory[(state->h << 8) | state->l];
+      uint16_t val = state->a ^ state->memory[state->hl];
       state->cc.z = ((val & 0xff) == 0);
       state->cc.s = ((val & 0x80) != 0);
       state->cc.cy = (val > 0xff);
@@ -1212,7 +1204,7 @@ int emulateOp(state8080* state) {
     }
 
     case 0xb6: {
-      uint16_t val = state->a | state->memory[(state->h << 8) | state->l];
+      uint16_t val = state->a | state->memory[state->hl];
       state->cc.z = ((val & 0xff) == 0);
       state->cc.s = ((val & 0x80) != 0);
       state->cc.cy = (val > 0xff);
@@ -1286,7 +1278,7 @@ int emulateOp(state8080* state) {
     }
 
     case 0xbe: {
-      uint16_t val = state->a - state->memory[(state->h << 8) | state->l];
+      uint16_t val = state->a - state->memory[state->hl];
       state->cc.z = ((val & 0xff) == 0);
       state->cc.s = ((val & 0x80) != 0);
       state->cc.cy = (val > 0xff);
@@ -1442,7 +1434,10 @@ int emulateOp(state8080* state) {
       }
       break; // JNC
 
-    case 0xd3: /*Skip for now */ break; // OUT D8
+    case 0xd3:
+      writeToPort(state, opCode[1], state->a);
+      state->pc += 1;
+      break; // OUT D8
 
     case 0xd4:
       if(state->cc.cy == 0) {
@@ -1494,7 +1489,10 @@ int emulateOp(state8080* state) {
       }
       break; // JC adr
 
-    case 0xdb: /*Skip for now */  break; // IN D8
+    case 0xdb:
+      state->a = readFromPort(state, opCode[1]);
+      state->pc += 1;
+      break; // IN D8
 
     case 0xdc:
       if(state->cc.cy == 1) {
@@ -1599,7 +1597,7 @@ int emulateOp(state8080* state) {
       break; // RPE
 
     case 0xe9:
-      state->pc = (state->h << 8) | state->l;
+      state->pc = state->hl;
       break; // PCHL
 
     case 0xea:
@@ -1611,12 +1609,9 @@ int emulateOp(state8080* state) {
       break; // JPE adr
 
     case 0xeb: {
-      uint8_t storage = state->h;
-      state->h = state->d;
-      state->d = storage;
-      storage = state->l;
-      state->l = state->e;
-      state->e = storage;
+      uint16_t storage = state->hl;
+      state->hl = state->de;
+      state->de = storage;
       break; // XCHG
     }
 
@@ -1657,14 +1652,15 @@ int emulateOp(state8080* state) {
       break; // RP
 
     case 0xf1: {
-      state->a = state->memory[state->sp + 1];
       uint8_t psw = state->memory[state->sp];
-      state->cc.z = psw & 0xfe;
-      state->cc.s = psw & 0xfd;
-      state->cc.p = psw & 0xfb;
-      state->cc.cy = psw & 0xf7;
-      state->cc.ac = psw & 0x2f;
-      state->cc.pad = psw & 0x1f;
+      state->a = state->memory[state->sp + 1];
+      state->cc.z = psw & 0x01;
+      state->cc.s = (psw >> 1) & 0x01;
+      state->cc.p = (psw >> 2) & 0x01;
+      state->cc.cy = (psw >> 3) & 0x01;
+      state->cc.ac = (psw >> 4) & 0x01;
+      state->cc.pad = (psw >> 5) & 0x01;
+      state->sp += 2;
       break; // POP PSW
     }
 
@@ -1722,7 +1718,7 @@ int emulateOp(state8080* state) {
       break; // RM
 
     case 0xf9:
-      state->sp = (state->h << 8) | state->l;
+      state->sp = state->hl;
       break;// SPHL
 
     case 0xfa:
@@ -1780,6 +1776,50 @@ void generateInterrupt(state8080* state, int number) {
   state->pc = 8 * number;
 }
 
+/* Function to raise an interrupt for runCycles to take
+  Input: state8080 struct, RST number
+  Output: void
+  The interrupt waits until interrupts are enabled
+*/
+void requestInterrupt(state8080* state, int number) {
+  state->interruptNumber = number;
+  state->interruptPending = 1;
+}
+
+/* Function to make runCycles return early
+  Input: state8080 struct
+  Output: void
+  Can be called from a port hook
+*/
+void requestStop(state8080* state) {
+  state->stopRequested = 1;
+}
+
+/* Function to run the emulator for a number of cycles
+  Input: state8080 struct, number of cycles to run for
+  Output: number of cycles actually run
+  Interrupts and stop requests are only checked after IN, OUT and EI,
+  the ops that can raise or allow them
+*/
+int runCycles(state8080* state, int budget) {
+  int cyclesRun = 0;
+  while(cyclesRun < budget && !state->stopRequested) {
+    uint8_t op;
+    if(state->interruptPending && state->intEnable) {
+      // The 8080 turns interrupts off when it takes one
+      state->interruptPending = 0;
+      state->intEnable = 0;
+      generateInterrupt(state, state->interruptNumber);
+    }
+    do {
+      op = state->memory[state->pc];
+      cyclesRun += emulateOp(state);
+    } while(cyclesRun < budget && op != 0xd3 && op != 0xdb && op != 0xfb);
+  }
+  state->stopRequested = 0;
+  return cyclesRun;
+}
+
 /* Code to read files into state memory
   Input: state8080 struct, filename, 32 bit memory location
   Output: Void
@@ -0,0 +1,529 @@
+/* Headless batch runner for the 8080 emulator
+  Jack R. McCluskey
+
+  Runs many independent Space Invaders machines on a fixed pool of
+  threads. Each machine has its own state, RAM and caches, carved out
+  of the arena of the worker that owns it, while the ROM files are
+  mapped once and shared by all of them.
+  With BATCH_STATIC the machines are split evenly between the workers,
+  and each worker runs its machines one frame at a time. With
+  BATCH_STEALING each worker keeps a deque of time slices, runs its
+  own from the bottom and steals from the top of the others' when it
+  runs out, so machines that cost more don't hold the rest back.
+  With placement on, each worker is pinned to a core, spread over the
+  NUMA nodes, and its arena is bound to that core's node. Thieves try
+  the workers on their own node before the rest. Linux only.
+  Usage: batchRunner machines threads frames [static] [numa]
+  Build with -pthread and any of the emulator's build options.
+  Define NO_BATCH_MAIN to use it as a library.
+  PROFILE_OPCODES counts aren't kept per thread, so don't profile a
+  batch with more than one thread.
+*/
+
+#define _GNU_SOURCE // For pthread_setaffinity_np and sched_getcpu
+#define NO_EMULATOR_MAIN
+#include"emulatorShell.c"
+#include"invadersMachine.c"
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#define BATCH_STATIC 0
+#define BATCH_STEALING 1
+#ifndef SLICE_FRAMES
+#define SLICE_FRAMES 2 // Frames a machine runs for each time it is scheduled
+#endif
+#define BATCH_MAX_CPUS 1024
+
+int cpuNodes[BATCH_MAX_CPUS]; // NUMA node of each host CPU, filled by findBatchCpus
+int numNodes = 1;
+
+/* Struct for a deque of time slices, each one a machine to run for
+  SLICE_FRAMES frames
+  slices is a ring with room for every machine, top and bottom only
+  grow. The owner pushes and pops at the bottom, thieves take the
+  oldest slice from the top.
+*/
+typedef struct sliceDeque {
+  pthread_mutex_t lock;
+  int *slices;
+  int size;
+  unsigned long top;
+  unsigned long bottom;
+} sliceDeque;
+
+struct batchRunner;
+
+/* Struct for one thread of the pool
+*/
+typedef struct batchWorker {
+  struct batchRunner *batch;
+  pthread_t thread;
+  int index; // Owns the machines index, index + numWorkers, ...
+  int cpu; // Core the thread is pinned to, -1 if it isn't
+  int node; // NUMA node of the core, 0 if not pinned
+  stateArena *arena; // Holds the states of the machines the worker owns
+  sliceDeque deque;
+  double busySeconds; // Time spent running machines
+  unsigned long slicesRun;
+  unsigned long slicesStolen;
+  unsigned long slicesLocal; // Slices run on the node holding the machine
+} batchWorker;
+
+/* Struct for a set of machines and the threads that run them
+  Every field after workers is guarded by lock
+*/
+typedef struct batchRunner {
+  invadersMachine *machines;
+  int numMachines;
+  batchWorker *workers;
+  int numWorkers;
+  int scheduler; // BATCH_STATIC or BATCH_STEALING
+  int placed; // Workers pinned and their machines placed on their nodes
+  double runSeconds; // Time spent in runBatch
+  int machinesLeft; // Machines with frames left, changed atomically
+  pthread_mutex_t lock;
+  pthread_cond_t start; // Signalled when a run begins or the batch stops
+  pthread_cond_t done; // Signalled when the last worker finishes a run
+  unsigned long runNumber; // Counts the runs, so workers see new ones
+  int framesToRun;
+  int workersBusy;
+  int stopping;
+} batchRunner;
+
+/* Helper function for the time
+  Input: void
+  Output: seconds on the monotonic clock
+*/
+double batchSeconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Function to list the CPUs workers can be pinned to
+  Input: array to fill with CPU numbers, its size
+  Output: number of CPUs listed
+  Reads the NUMA nodes from sysfs and fills in cpuNodes and numNodes.
+  CPUs are listed a node at a time in turn, so the first workers are
+  spread over every node. Only CPUs the process may run on are listed.
+  Hosts without NUMA nodes in sysfs count as one node.
+*/
+int findBatchCpus(int* cpus, int maxCpus) {
+  int nodeCpus[64][64];
+  int nodeSizes[64] = { 0 };
+  int node, cpu, first, last, numCpus = 0, round;
+  char path[64];
+#ifdef __linux__
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  sched_getaffinity(0, sizeof(allowed), &allowed);
+#endif
+  numNodes = 0;
+  for(node = 0; node < 64; node++) {
+    FILE *f;
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    f = fopen(path, "r");
+    if(f == NULL) {
+      continue;
+    }
+    numNodes = node + 1;
+    // The list looks like 0-3,8-11
+    while(fscanf(f, "%d", &first) == 1) {
+      last = first;
+      if(fscanf(f, "-%d", &last) != 1) {
+        last = first;
+      }
+      for(cpu = first; cpu <= last && cpu < BATCH_MAX_CPUS; cpu++) {
+        cpuNodes[cpu] = node;
+#ifdef __linux__
+        if(!CPU_ISSET(cpu, &allowed)) {
+          continue;
+        }
+#endif
+        if(nodeSizes[node] < 64) {
+          nodeCpus[node][nodeSizes[node]++] = cpu;
+        }
+      }
+      if(fgetc(f) != ',') {
+        break;
+      }
+    }
+    fclose(f);
+  }
+  if(numNodes == 0) {
+    numNodes = 1;
+    for(cpu = 0; cpu < sysconf(_SC_NPROCESSORS_ONLN) && cpu < 64; cpu++) {
+      nodeCpus[0][nodeSizes[0]++] = cpu;
+    }
+  }
+  for(round = 0; round < 64; round++) {
+    for(node = 0; node < numNodes; node++) {
+      if(round < nodeSizes[node] && numCpus < maxCpus) {
+        cpus[numCpus++] = nodeCpus[node][round];
+      }
+    }
+  }
+  return numCpus;
+}
+
+/* Helper function to find the NUMA node a host page is on
+  Input: address in the page, which has to have been written
+  Output: node number, -1 if the host can't tell
+*/
+int pageNode(void* address) {
+#if defined(__linux__) && defined(SYS_move_pages)
+  void *page = (void*) ((uintptr_t) address & ~(uintptr_t) (sysconf(_SC_PAGESIZE) - 1));
+  int status = -1;
+  if(syscall(SYS_move_pages, 0, 1, &page, NULL, &status, 0) == 0 && status >= 0) {
+    return status;
+  }
+#endif
+  return -1;
+}
+
+/* Helper function for the NUMA node the calling thread is running on
+  Input: void
+  Output: node number, 0 if the host can't tell
+*/
+int currentNode() {
+#ifdef __linux__
+  int cpu = sched_getcpu();
+  if(cpu >= 0 && cpu < BATCH_MAX_CPUS) {
+    return cpuNodes[cpu];
+  }
+#endif
+  return 0;
+}
+
+/* Functions to add and take slices from a deque
+  Input: sliceDeque struct, machine index for pushSlice
+  Output: machine index, or -1 if the deque is empty
+*/
+void pushSlice(sliceDeque* deque, int machine) {
+  pthread_mutex_lock(&deque->lock);
+  deque->slices[deque->bottom % deque->size] = machine;
+  deque->bottom++;
+  pthread_mutex_unlock(&deque->lock);
+}
+
+int popSlice(sliceDeque* deque) {
+  int machine = -1;
+  pthread_mutex_lock(&deque->lock);
+  if(deque->bottom != deque->top) {
+    deque->bottom--;
+    machine = deque->slices[deque->bottom % deque->size];
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return machine;
+}
+
+int stealSlice(sliceDeque* deque) {
+  int machine = -1;
+  pthread_mutex_lock(&deque->lock);
+  if(deque->bottom != deque->top) {
+    machine = deque->slices[deque->top % deque->size];
+    deque->top++;
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return machine;
+}
+
+/* Function to run one run of a batch on a worker with BATCH_STATIC
+  Input: batchWorker struct, number of frames
+  Output: void
+*/
+void runStaticFrames(batchWorker* worker, int frames) {
+  batchRunner *batch = worker->batch;
+  int frame, i;
+  for(frame = 0; frame < frames; frame++) {
+    int node = currentNode();
+    for(i = worker->index; i < batch->numMachines; i += batch->numWorkers) {
+      runInvadersFrame(&batch->machines[i]);
+      worker->slicesRun++;
+      worker->slicesLocal += batch->machines[i].node == node;
+    }
+  }
+}
+
+/* Function to run one run of a batch on a worker with BATCH_STEALING
+  Input: batchWorker struct
+  Output: void
+  Takes slices from its own deque first, then from the other workers
+  in turn, those on its own node first, until every machine has run
+  all of its frames. A machine with frames left goes back on the
+  bottom of the deque of the worker that ran it, so a stolen machine
+  stays with the thief.
+*/
+void runStolenSlices(batchWorker* worker) {
+  batchRunner *batch = worker->batch;
+  while(__atomic_load_n(&batch->machinesLeft, __ATOMIC_ACQUIRE) > 0) {
+    invadersMachine *machine;
+    double started;
+    int index = popSlice(&worker->deque);
+    int other, frame, remote;
+    for(remote = 0; index < 0 && remote < 2; remote++) {
+      for(other = 1; index < 0 && other < batch->numWorkers; other++) {
+        batchWorker *victim = &batch->workers[(worker->index + other) % batch->numWorkers];
+        if((victim->node != worker->node) == remote) {
+          index = stealSlice(&victim->deque);
+        }
+      }
+      if(index >= 0) {
+        worker->slicesStolen++;
+      }
+    }
+    if(index < 0) {
+      sched_yield(); // The last slices are still running elsewhere
+      continue;
+    }
+
+    machine = &batch->machines[index];
+    started = batchSeconds();
+    for(frame = 0; frame < SLICE_FRAMES && machine->framesLeft > 0; frame++) {
+      runInvadersFrame(machine);
+      machine->framesLeft--;
+    }
+    worker->busySeconds += batchSeconds() - started;
+    worker->slicesRun++;
+    worker->slicesLocal += machine->node == currentNode();
+    if(machine->framesLeft > 0) {
+      pushSlice(&worker->deque, index);
+    } else {
+      __atomic_sub_fetch(&batch->machinesLeft, 1, __ATOMIC_RELEASE);
+    }
+  }
+}
+
+/* Function run by each thread of the pool
+  Input: batchWorker struct
+  Output: NULL once the batch stops
+*/
+void* runBatchWorker(void* arg) {
+  batchWorker *worker = arg;
+  batchRunner *batch = worker->batch;
+  unsigned long runsSeen = 0;
+  int frames;
+  double started;
+
+  for(;;) {
+    pthread_mutex_lock(&batch->lock);
+    while(batch->runNumber == runsSeen && !batch->stopping) {
+      pthread_cond_wait(&batch->start, &batch->lock);
+    }
+    if(batch->stopping) {
+      pthread_mutex_unlock(&batch->lock);
+      return NULL;
+    }
+    runsSeen = batch->runNumber;
+    frames = batch->framesToRun;
+    pthread_mutex_unlock(&batch->lock);
+
+    if(batch->scheduler == BATCH_STEALING) {
+      runStolenSlices(worker);
+    } else {
+      started = batchSeconds();
+      runStaticFrames(worker, frames);
+      worker->busySeconds += batchSeconds() - started;
+    }
+
+    pthread_mutex_lock(&batch->lock);
+    if(--batch->workersBusy == 0) {
+      pthread_cond_signal(&batch->done);
+    }
+    pthread_mutex_unlock(&batch->lock);
+  }
+}
+
+/* Function to create a batch of machines and start its threads
+  Input: number of machines, number of threads, BATCH_STATIC or
+    BATCH_STEALING, 1 to pin the workers and place their machines
+  Output: new batchRunner struct, with every machine at reset
+  Without placement the workers still have an arena each, but the
+  host puts their pages and threads wherever it likes
+*/
+batchRunner* createBatch(int numMachines, int numWorkers, int scheduler, int placed) {
+  batchRunner *batch = calloc(1, sizeof(batchRunner));
+  int cpus[BATCH_MAX_CPUS];
+  int numCpus = findBatchCpus(cpus, BATCH_MAX_CPUS);
+  int i;
+  batch->numMachines = numMachines;
+  batch->numWorkers = numWorkers;
+  batch->scheduler = scheduler;
+  batch->placed = placed && numCpus > 0;
+  batch->machines = calloc(numMachines, sizeof(invadersMachine));
+  batch->workers = calloc(numWorkers, sizeof(batchWorker));
+  pthread_mutex_init(&batch->lock, NULL);
+  pthread_cond_init(&batch->start, NULL);
+  pthread_cond_init(&batch->done, NULL);
+
+  for(i = 0; i < numWorkers; i++) {
+    batchWorker *worker = &batch->workers[i];
+    worker->batch = batch;
+    worker->index = i;
+    worker->cpu = batch->placed ? cpus[i % numCpus] : -1;
+    worker->node = batch->placed ? cpuNodes[worker->cpu] : 0;
+    worker->arena = createStateArena((numMachines + numWorkers - 1) / numWorkers, ARENA_HUGE_PAGES);
+    if(batch->placed) {
+      bindStateArena(worker->arena, worker->node);
+    }
+  }
+  // ROM files are mapped here, before any thread can race to map them
+  for(i = 0; i < numMachines; i++) {
+    initializeInvaders(&batch->machines[i], batch->workers[i % numWorkers].arena);
+    batch->machines[i].node = pageNode(batch->machines[i].state);
+  }
+  for(i = 0; i < numWorkers; i++) {
+    batchWorker *worker = &batch->workers[i];
+    pthread_mutex_init(&worker->deque.lock, NULL);
+    worker->deque.slices = calloc(numMachines, sizeof(int));
+    worker->deque.size = numMachines;
+    if(pthread_create(&worker->thread, NULL, runBatchWorker, worker) != 0) {
+      printf("ERROR: Cannot start thread %d\n", i);
+      exit(1);
+    }
+#ifdef __linux__
+    if(worker->cpu >= 0) {
+      cpu_set_t cpuSet;
+      CPU_ZERO(&cpuSet);
+      CPU_SET(worker->cpu, &cpuSet);
+      pthread_setaffinity_np(worker->thread, sizeof(cpuSet), &cpuSet);
+    }
+#endif
+  }
+  return batch;
+}
+
+/* Function to run every machine of a batch
+  Input: batchRunner struct, number of frames
+  Output: void
+  Returns once every machine has run the frames. With BATCH_STEALING
+  the machines start out dealt to the workers as BATCH_STATIC would.
+*/
+void runBatch(batchRunner* batch, int frames) {
+  double started = batchSeconds();
+  int i;
+  pthread_mutex_lock(&batch->lock);
+  if(batch->scheduler == BATCH_STEALING) {
+    batch->machinesLeft = frames > 0 ? batch->numMachines : 0;
+    for(i = 0; i < batch->numMachines && frames > 0; i++) {
+      batch->machines[i].framesLeft = frames;
+      pushSlice(&batch->workers[i % batch->numWorkers].deque, i);
+    }
+  }
+  batch->framesToRun = frames;
+  batch->workersBusy = batch->numWorkers;
+  batch->runNumber++;
+  pthread_cond_broadcast(&batch->start);
+  while(batch->workersBusy > 0) {
+    pthread_cond_wait(&batch->done, &batch->lock);
+  }
+  pthread_mutex_unlock(&batch->lock);
+  batch->runSeconds += batchSeconds() - started;
+}
+
+/* Function to print how busy each worker was
+  Input: batchRunner struct
+  Output: void
+  Busy is the share of the time spent in runBatch that the worker
+  spent running machines, the rest it waited for the others. With
+  BATCH_STATIC every frame of a machine counts as a slice. Local
+  slices ran on the node holding the machine's state. Without
+  placement about one slice in numNodes would be, so the rest of the
+  local slices are cross-node runs that placement avoided.
+*/
+void printBatchStats(batchRunner* batch) {
+  unsigned long slices = 0, local = 0;
+  double unplaced;
+  int i;
+  printf("Worker  Cpu   Node  Busy     Slices    Stolen    Local\n");
+  for(i = 0; i < batch->numWorkers; i++) {
+    batchWorker *worker = &batch->workers[i];
+    printf("%-6d  %-4d  %-4d  %5.1f%%  %-8lu  %-8lu  %lu\n", i, worker->cpu, worker->node,
+      batch->runSeconds > 0 ? 100.0 * worker->busySeconds / batch->runSeconds : 0.0,
+      worker->slicesRun, worker->slicesStolen, worker->slicesLocal);
+    slices += worker->slicesRun;
+    local += worker->slicesLocal;
+  }
+  printf("%lu of %lu slices ran on the machine's node, %d node%s\n",
+    local, slices, numNodes, numNodes == 1 ? "" : "s");
+  unplaced = (double) slices / numNodes;
+  if(batch->placed && numNodes > 1) {
+    printf("About %.0f cross-node slices avoided by placement\n", local > unplaced ? local - unplaced : 0.0);
+  }
+}
+
+/* Function to stop the threads of a batch and free it
+  Input: batchRunner struct
+  Output: void
+*/
+void freeBatch(batchRunner* batch) {
+  int i;
+  pthread_mutex_lock(&batch->lock);
+  batch->stopping = 1;
+  pthread_cond_broadcast(&batch->start);
+  pthread_mutex_unlock(&batch->lock);
+  for(i = 0; i < batch->numWorkers; i++) {
+    pthread_join(batch->workers[i].thread, NULL);
+    pthread_mutex_destroy(&batch->workers[i].deque.lock);
+    free(batch->workers[i].deque.slices);
+    freeStateArena(batch->workers[i].arena);
+  }
+  pthread_mutex_destroy(&batch->lock);
+  pthread_cond_destroy(&batch->start);
+  pthread_cond_destroy(&batch->done);
+  free(batch->workers);
+  free(batch->machines);
+  free(batch);
+}
+
+#ifndef NO_BATCH_MAIN
+/* Main function for the batch runner
+  Runs the machines for the frames asked for and prints the speed
+*/
+int main(int argc, char const *argv[]) {
+  batchRunner *batch;
+  int numMachines, numWorkers, frames;
+  int scheduler = BATCH_STEALING;
+  int placed = 0;
+  double seconds;
+  int i;
+
+  for(i = 4; i < argc; i++) {
+    if(strcmp(argv[i], "static") == 0) {
+      scheduler = BATCH_STATIC;
+    } else if(strcmp(argv[i], "numa") == 0) {
+      placed = 1;
+    } else {
+      argc = 0;
+    }
+  }
+  if(argc < 4) {
+    printf("Usage: %s machines threads frames [static] [numa]\n", argv[0]);
+    return 1;
+  }
+  numMachines = atoi(argv[1]);
+  numWorkers = atoi(argv[2]);
+  frames = atoi(argv[3]);
+  if(numMachines < 1 || numWorkers < 1 || frames < 0) {
+    printf("ERROR: Machines and threads must be at least 1\n");
+    return 1;
+  }
+  if(numWorkers > numMachines) {
+    numWorkers = numMachines;
+  }
+
+  batch = createBatch(numMachines, numWorkers, scheduler, placed);
+  runBatch(batch, frames);
+  seconds = batch->runSeconds;
+
+  printf("%d machines, %d threads, %d frames in %.3f s\n", numMachines, numWorkers, frames, seconds);
+  if(seconds > 0) {
+    printf("%.0f frames per second, %.1fx real time per machine\n",
+      (double) numMachines * frames / seconds, frames / seconds / 60.0);
+  }
+  printBatchStats(batch);
+  freeBatch(batch);
+  return 0;
+}
+#endif
@@ -0,0 +1,314 @@
+/* Basic block translation cache for the 8080 emulator
+  Jack R. McCluskey
+
+  Guest code is split into basic blocks that end at a JMP, CALL, RET,
+  RST, PCHL or conditional jump. Each block is decoded once into an
+  array of micro-ops and kept in a cache keyed by its start address.
+  Blocks remember the blocks they exit to, so the next block is
+  normally found without a cache lookup.
+  Included by emulatorShell.c when built with BLOCK_CACHE.
+  With JIT_RECOMPILER, blocks that run often are also compiled to
+  native code by jitX86.c.
+  With AOT_BLOCKS, blocks recompiler.c found in the ROM run as C code.
+  With IDLE_LOOP_SKIP, blocks that spin in place waiting for an
+  interrupt are found when they are translated, see isIdleLoop.
+*/
+
+#define BLOCK_MAX_OPS 32
+#define BLOCK_POOL_SIZE 2048
+
+#ifdef AOT_BLOCKS
+// Block compiled by recompiler.c, returns AOT_ flags
+#define AOT_END_RUN 0x01 // It ran IN, OUT or EI
+#define AOT_STOPPED 0x02 // A store flushed it, it stopped before the op at pc
+typedef int (*aotFunction)(state8080* state);
+#endif
+
+/* Struct for one translated basic block
+  links holds up to two blocks this block has exited to, which covers
+  both sides of a conditional jump
+*/
+typedef struct codeBlock {
+  uint16_t start; // Guest address of the first op
+  uint16_t end; // Guest address after the last op
+  uint8_t numOps;
+  uint8_t prepared; // Handlers filled in, only used with THREADED_DISPATCH
+  uint8_t linkable; // Exit target is known when the block is built
+  int cycles; // Total of the cycles table for every op in the block
+  struct codeBlock *links[2];
+#ifdef JIT_RECOMPILER
+  int runs; // Times the block has been entered, until it is compiled
+  uint8_t jitOps; // Ops covered by the native code
+  int8_t jitFlagsOp; // First compiled op to leave Z, S and P in the host flags, -1 if none
+  uint8_t jitUsesPorts; // Native code runs IN or OUT
+  uint16_t jitEnd; // Guest address after the last compiled op
+  int (*jitCode)(struct state8080* state, int carry); // NULL if not compiled
+#endif
+#ifdef IDLE_LOOP_SKIP
+  uint8_t idleLoop; // Running the block again can't change anything
+#endif
+#ifdef AOT_BLOCKS
+  aotFunction aotCode; // Set when prepared, NULL if not compiled
+#endif
+  decodedOp ops[BLOCK_MAX_OPS];
+} codeBlock;
+
+/* Struct holding every translated block of one state8080
+  codeMap marks the guest bytes that belong to a block, so a write to
+  one of them can throw the translations away
+*/
+typedef struct blockCache {
+  codeBlock *blocks[0x10000]; // Keyed by start address
+  uint8_t codeMap[0x10000];
+  int numBlocks;
+  codeBlock pool[BLOCK_POOL_SIZE];
+#ifdef JIT_RECOMPILER
+  uint8_t *jitBuffer; // Executable memory for compiled blocks
+  size_t jitUsed;
+#endif
+} blockCache;
+
+/* Helper function for finding the ops that end a basic block
+  Input: op code
+  Output: 1 if the op can change the program counter, 0 otherwise
+*/
+int endsBlock(uint8_t opCode) {
+  switch(opCode) {
+    case 0xc2: case 0xca: case 0xd2: case 0xda: // Jcc
+    case 0xe2: case 0xea: case 0xf2: case 0xfa:
+    case 0xc4: case 0xcc: case 0xd4: case 0xdc: // Ccc
+    case 0xe4: case 0xec: case 0xf4: case 0xfc:
+    case 0xc0: case 0xc8: case 0xd0: case 0xd8: // Rcc
+    case 0xe0: case 0xe8: case 0xf0: case 0xf8:
+    case 0xc7: case 0xcf: case 0xd7: case 0xdf: // RST
+    case 0xe7: case 0xef: case 0xf7: case 0xff:
+    case 0xc3: // JMP
+    case 0xcd: // CALL
+    case 0xc9: // RET
+    case 0xe9: // PCHL
+      return 1;
+  }
+  return 0;
+}
+
+#ifdef IDLE_LOOP_SKIP
+#define REG_MASK(reg) (1 << (reg)) // 8080 register number, B = 0 to A = 7
+#define REG_PAIR_MASK(high) (REG_MASK(high) | REG_MASK((high) + 1))
+#define FLAGS_MASK (1 << 8)
+
+/* Helper function for the ops an idle loop may contain
+  Input: op code, masks to fill in with the registers and flags the op
+    reads and writes
+  Output: 1 if the op only moves data into registers and flags, 0 if
+    it may have other side effects or isn't checked for idle loops
+  Only loads, logic ops, compares and jumps are allowed, none of which
+  write memory, touch the stack or use the ports
+*/
+int idleLoopOp(uint8_t opCode, int* reads, int* writes) {
+  int dst = (opCode >> 3) & 0x07;
+  int src = opCode & 0x07;
+  int srcMask = (src == 6) ? REG_PAIR_MASK(4) : REG_MASK(src); // M reads HL
+  *reads = 0;
+  *writes = 0;
+  if(opCode == 0x00 || opCode == 0xc3) { // NOP, JMP
+    return 1;
+  }
+  if((opCode & 0xc7) == 0xc2) { // Jcc
+    *reads = FLAGS_MASK;
+    return 1;
+  }
+  if(opCode == 0x0a || opCode == 0x1a) { // LDAX B, LDAX D
+    *reads = REG_PAIR_MASK(opCode >> 3 & 0x02);
+    *writes = REG_MASK(7);
+    return 1;
+  }
+  if(opCode == 0x3a) { // LDA adr
+    *writes = REG_MASK(7);
+    return 1;
+  }
+  if((opCode & 0xc7) == 0x06 && dst != 6) { // MVI r
+    *writes = REG_MASK(dst);
+    return 1;
+  }
+  if(opCode >= 0x40 && opCode < 0x80 && dst != 6 && (src == 6 || dst == 7)) { // MOV r,M and MOV A,r
+    *reads = srcMask;
+    *writes = REG_MASK(dst);
+    return 1;
+  }
+  if(opCode >= 0xa0 && opCode < 0xc0) { // ANA, XRA, ORA, CMP
+    *reads = REG_MASK(7) | srcMask;
+    *writes = FLAGS_MASK | (opCode < 0xb8 ? REG_MASK(7) : 0);
+    return 1;
+  }
+  if(opCode == 0xe6 || opCode == 0xee || opCode == 0xf6 || opCode == 0xfe) { // ANI, XRI, ORI, CPI
+    *reads = REG_MASK(7);
+    *writes = FLAGS_MASK | (opCode != 0xfe ? REG_MASK(7) : 0);
+    return 1;
+  }
+  return 0;
+}
+
+/* Function to check if a block is an idle loop
+  Input: block to check
+  Output: 1 if the block ends in a jump and running it a second time
+    leaves every register, flag and memory byte as it is, 0 otherwise
+  Every op has to pass idleLoopOp, and may only read registers the
+  block never writes, or has already written earlier in the block.
+  The memory the block polls can then only change in an interrupt.
+*/
+int isIdleLoop(codeBlock* block) {
+  int reads[BLOCK_MAX_OPS], writes[BLOCK_MAX_OPS];
+  int written = 0;
+  int defined = 0;
+  uint8_t last = block->ops[block->numOps - 1].opCode;
+  int i;
+
+  if(last != 0xc3 && (last & 0xc7) != 0xc2) {
+    return 0;
+  }
+  for(i = 0; i < block->numOps; i++) {
+    if(!idleLoopOp(block->ops[i].opCode, &reads[i], &writes[i])) {
+      return 0;
+    }
+    written |= writes[i];
+  }
+  for(i = 0; i < block->numOps; i++) {
+    if(reads[i] & written & ~defined) {
+      return 0;
+    }
+    defined |= writes[i];
+  }
+  return 1;
+}
+#endif
+
+/* Function to create the block cache for a state
+  Input: void
+  Output: new, empty blockCache struct
+*/
+blockCache* createBlockCache() {
+  return calloc(1, sizeof(blockCache));
+}
+
+/* Function to throw away every translated block
+  Input: state8080 struct
+  Output: void
+  Called when the guest writes over code that has been translated
+  The links are cleared too, so the block that is running when this
+  is called can't chain back into a stale block
+*/
+void flushBlocks(state8080* state) {
+  blockCache *cache = state->blockCache;
+  int i;
+  for(i = 0; i < cache->numBlocks; i++) {
+    cache->pool[i].links[0] = NULL;
+    cache->pool[i].links[1] = NULL;
+  }
+  memset(cache->blocks, 0, sizeof(cache->blocks));
+  memset(cache->codeMap, 0, sizeof(cache->codeMap));
+  cache->numBlocks = 0;
+#ifdef JIT_RECOMPILER
+  cache->jitUsed = 0;
+#endif
+}
+
+/* Function to count the ops of a block before an address
+  Input: block, address of one of its ops or of its end
+  Output: number of ops
+  Finds where compiled code stopped when a store flushed its block
+*/
+int opsBefore(codeBlock* block, uint16_t address) {
+  uint16_t pc = block->start;
+  int ops = 0;
+  while(pc != address && ops < block->numOps) {
+    pc += block->ops[ops++].length;
+  }
+  return ops;
+}
+
+/* Function to translate the basic block starting at an address
+  Input: state8080 struct, guest address
+  Output: pointer to the new block
+  Decodes ops until one ends the block or the block is full
+*/
+codeBlock* translateBlock(state8080* state, uint16_t address) {
+  blockCache *cache = state->blockCache;
+  codeBlock *block;
+  uint16_t pc = address;
+
+  if(cache->numBlocks == BLOCK_POOL_SIZE) {
+    flushBlocks(state);
+  }
+  block = &cache->pool[cache->numBlocks++];
+  block->start = address;
+  block->numOps = 0;
+  block->prepared = 0;
+  block->linkable = 1;
+  block->cycles = 0;
+  block->links[0] = NULL;
+  block->links[1] = NULL;
+#ifdef JIT_RECOMPILER
+  block->runs = 0;
+  block->jitCode = NULL;
+#endif
+
+  for(;;) {
+    decodedOp *op = &block->ops[block->numOps++];
+    int i;
+    decodeOp(state, pc, op);
+    block->cycles += cycles[op->opCode];
+    for(i = 0; i < op->length; i++) {
+      cache->codeMap[(uint16_t) (pc + i)] = 1;
+    }
+    pc += op->length;
+    if(endsBlock(op->opCode)) {
+      // Returns, restarts and PCHL jump somewhere only known at run time
+      if(op->opCode == 0xc9 || op->opCode == 0xe9) {
+        block->linkable = 0;
+      }
+      break;
+    }
+    if(block->numOps == BLOCK_MAX_OPS) {
+      break;
+    }
+  }
+  block->end = pc;
+#ifdef IDLE_LOOP_SKIP
+  block->idleLoop = isIdleLoop(block);
+#endif
+  cache->blocks[address] = block;
+  return block;
+}
+
+/* Function to find the block to run after another one
+  Input: state8080 struct, block that just finished or NULL
+  Output: pointer to the block starting at the program counter
+  Follows the links of the previous block first, then the cache,
+  and translates a new block if there is none
+*/
+codeBlock* nextBlock(state8080* state, codeBlock* previous) {
+  codeBlock *next;
+  if(previous != NULL) {
+    if(previous->links[0] != NULL && previous->links[0]->start == state->pc) {
+      return previous->links[0];
+    }
+    if(previous->links[1] != NULL && previous->links[1]->start == state->pc) {
+      return previous->links[1];
+    }
+  }
+
+  next = state->blockCache->blocks[state->pc];
+  if(next == NULL) {
+    next = translateBlock(state, state->pc);
+  }
+
+  // Chain the blocks so the next exit this way skips the lookup
+  if(previous != NULL && previous->linkable) {
+    if(previous->links[0] == NULL) {
+      previous->links[0] = next;
+    } else {
+      previous->links[1] = next;
+    }
+  }
+  return next;
+}
@@ -6,6 +6,306 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+/* Decoder function for 8080 assembly code
+  Input: pointer to the op code, buffer for the text and its size
+  Output: Number of bytes the operation took
+  Writes the operation performed by the opcode into text
+  Shared by the disassembler and the recompiler
+*/
+int decodeAsm(unsigned char *code, char *text, size_t size) {
+  // Set default opSize
+  int opSize = 1;
+  // Switch off of the 0xff opcodes
+  switch (*code) {
+    // 0-15
+    case 0x00: snprintf(text, size, "NOP"); break;
+    case 0x01: snprintf(text, size, "LXI B,#$%02x%02x", code[2], code[1]); opSize = 3; break;
+    case 0x02: snprintf(text, size, "STAX B"); break;
+    case 0x03: snprintf(text, size, "INX B"); break;
+    case 0x04: snprintf(text, size, "INR B"); break;
+    case 0x05: snprintf(text, size, "DCR B"); break;
+    case 0x06: snprintf(text, size, "MVI B,#$%02x", code[1]); opSize = 2; break;
+    case 0x07: snprintf(text, size, "RLC"); break;
+    case 0x08: snprintf(text, size, "NOP"); break;
+    case 0x09: snprintf(text, size, "DAD B"); break;
+    case 0x0a: snprintf(text, size, "LDAX B"); break;
+    case 0x0b: snprintf(text, size, "DCX B"); break;
+    case 0x0c: snprintf(text, size, "INR C"); break;
+    case 0x0d: snprintf(text, size, "DCR C"); break;
+    case 0x0e: snprintf(text, size, "MVI C,#$%02x", code[1]); opSize = 2; break;
+    case 0x0f: snprintf(text, size, "RRC"); break;
+    // 16-31
+    case 0x10: snprintf(text, size, "NOP"); break;
+    case 0x11: snprintf(text, size, "LXI D,#$%02x%02x", code[2], code[1]); opSize = 3; break;
+    case 0x12: snprintf(text, size, "STAX D"); break;
+    case 0x13: snprintf(text, size, "INX D"); break;
+    case 0x14: snprintf(text, size, "INR D"); break;
+    case 0x15: snprintf(text, size, "DCR D"); break;
+    case 0x16: snprintf(text, size, "MVI D,#$%02x", code[1]); opSize = 2; break;
+    case 0x17: snprintf(text, size, "RAL"); break;
+    case 0x18: snprintf(text, size, "NOP"); break;
+    case 0x19: snprintf(text, size, "DAD D"); break;
+    case 0x1a: snprintf(text, size, "LDAX D"); break;
+    case 0x1b: snprintf(text, size, "DCX D"); break;
+    case 0x1c: snprintf(text, size, "INR E"); break;
+    case 0x1d: snprintf(text, size, "DCR E"); break;
+    case 0x1e: snprintf(text, size, "MVI E,#$%02x", code[1]); opSize = 2; break;
+    case 0x1f: snprintf(text, size, "RAR"); break;
+    // 32-47
+    case 0x20: snprintf(text, size, "RIM"); break;
+    case 0x21: snprintf(text, size, "LXI H,#$%02x%02x", code[2], code[1]); opSize = 3; break;
+    case 0x22: snprintf(text, size, "SHLD $%02x%02x", code[2], code[1]); opSize = 3; break;
+    case 0x23: snprintf(text, size, "INX H"); break;
+    case 0x24: snprintf(text, size, "INR H"); break;
+    case 0x25: snprintf(text, size, "DCR H"); break;
+    case 0x26: snprintf(text, size, "MVI H,#$%02x", code[1]); opSize = 2; break;
+    case 0x27: snprintf(text, size, "DAA"); break;
+    case 0x28: snprintf(text, size, "NOP"); break;
+    case 0x29: snprintf(text, size, "DAD H"); break;
+    case 0x2a: snprintf(text, size, "LHLD $%02x%02x", code[2], code[1]); opSize = 3; break;
+    case 0x2b: snprintf(text, size, "DCX H"); break;
+    case 0x2c: snprintf(text, size, "INR L"); break;
+    case 0x2d: snprintf(text, size, "DCR L"); break;
+    case 0x2e: snprintf(text, size, "MVI L,#$%02x", code[1]); opSize = 2; break;
+    case 0x2f: snprintf(text, size, "CMA"); break;
+    // 48-63
+    case 0x30: snprintf(text, size, "SIM"); break;
+    case 0x31: snprintf(text, size, "LXI SP,#$%02x#$%02x", code[2], code[1]); opSize = 3; break;
+    case 0x32: snprintf(text, size, "STA $%02x$%02x", code[2], code[1]); opSize = 3; break;
+    case 0x33: snprintf(text, size, "INX SP"); break;
+    case 0x34: snprintf(text, size, "INR M"); break;
+    case 0x35: snprintf(text, size, "DCR M"); break;
+    case 0x36: snprintf(text, size, "MVI M,#$%02x", code[1]); opSize = 2; break;
+    case 0x37: snprintf(text, size, "STC"); break;
+    case 0x38: snprintf(text, size, "NOP"); break;
+    case 0x39: snprintf(text, size, "DAD SP"); break;
+    case 0x3a: snprintf(text, size, "LDA $%02x%02x", code[2], code[1]); opSize = 3; break;
+    case 0x3b: snprintf(text, size, "DCX SP"); break;
+    case 0x3c: snprintf(text, size, "INR A"); break;
+    case 0x3d: snprintf(text, size, "DCR A"); break;
+    case 0x3e: snprintf(text, size, "MVI A,#$%02x", code[1]); opSize = 2; break;
+    case 0x3f: snprintf(text, size, "CMC"); break;
+    // 64-79
+    case 0x40: snprintf(text, size, "MOV B,B"); break;
+    case 0x41: snprintf(text, size, "MOV B,C"); break;
+    case 0x42: snprintf(text, size, "MOV B,D"); break;
+    case 0x43: snprintf(text, size, "MOV B,E"); break;
+    case 0x44: snprintf(text, size, "MOV B,H"); break;
+    case 0x45: snprintf(text, size, "MOV B,L"); break;
+    case 0x46: snprintf(text, size, "MOV B,M"); break;
+    case 0x47: snprintf(text, size, "MOV B,A"); break;
+    case 0x48: snprintf(text, size, "MOV C,B"); break;
+    case 0x49: snprintf(text, size, "MOV C,C"); break;
+    case 0x4a: snprintf(text, size, "MOV C,D"); break;
+    case 0x4b: snprintf(text, size, "MOV C,E"); break;
+    case 0x4c: snprintf(text, size, "MOV C,H"); break;
+    case 0x4d: snprintf(text, size, "MOV C,L"); break;
+    case 0x4e: snprintf(text, size, "MOV C,M"); break;
+    case 0x4f: snprintf(text, size, "MOV C,A"); break;
+    // 80-95
+    case 0x50: snprintf(text, size, "MOV D,B"); break;
+    case 0x51: snprintf(text, size, "MOV D,C"); break;
+    case 0x52: snprintf(text, size, "MOV D,D"); break;
+    case 0x53: snprintf(text, size, "MOV D,E"); break;
+    case 0x54: snprintf(text, size, "MOV D,H"); break;
+    case 0x55: snprintf(text, size, "MOV D,L"); break;
+    case 0x56: snprintf(text, size, "MOV D,M"); break;
+    case 0x57: snprintf(text, size, "MOV D,A"); break;
+    case 0x58: snprintf(text, size, "MOV E,B"); break;
+    case 0x59: snprintf(text, size, "MOV E,C"); break;
+    case 0x5a: snprintf(text, size, "MOV E,D"); break;
+    case 0x5b: snprintf(text, size, "MOV E,E"); break;
+    case 0x5c: snprintf(text, size, "MOV E,H"); break;
+    case 0x5d: snprintf(text, size, "MOV E,L"); break;
+    case 0x5e: snprintf(text, size, "MOV E,M"); break;
+    case 0x5f: snprintf(text, size, "MOV E,A"); break;
+    // 96 - 111
+    case 0x60: snprintf(text, size, "MOV H,B"); break;
+    case 0x61: snprintf(text, size, "MOV H,C"); break;
+    case 0x62: snprintf(text, size, "MOV H,D"); break;
+    case 0x63: snprintf(text, size, "MOV H,E"); break;
+    case 0x64: snprintf(text, size, "MOV H,H"); break;
+    case 0x65: snprintf(text, size, "MOV H,L"); break;
+    case 0x66: snprintf(text, size, "MOV H,M"); break;
+    case 0x67: snprintf(text, size, "MOV H,A"); break;
+    case 0x68: snprintf(text, size, "MOV L,B"); break;
+    case 0x69: snprintf(text, size, "MOV L,C"); break;
+    case 0x6a: snprintf(text, size, "MOV L,D"); break;
+    case 0x6b: snprintf(text, size, "MOV L,E"); break;
+    case 0x6c: snprintf(text, size, "MOV L,H"); break;
+    case 0x6d: snprintf(text, size, "MOV L,L"); break;
+    case 0x6e: snprintf(text, size, "MOV L,M"); break;
+    case 0x6f: snprintf(text, size, "MOV L,A"); break;
+    // 112-127
+    case 0x70: snprintf(text, size, "MOV M,B"); break;
+    case 0x71: snprintf(text, size, "MOV M,C"); break;
+    case 0x72: snprintf(text, size, "MOV M,D"); break;
+    case 0x73: snprintf(text, size, "MOV M,E"); break;
+    case 0x74: snprintf(text, size, "MOV M,H"); break;
+    case 0x75: snprintf(text, size, "MOV M,L"); break;
+    case 0x76: snprintf(text, size, "HLT"); break;
+    case 0x77: snprintf(text, size, "MOV M,A"); break;
+    case 0x78: snprintf(text, size, "MOV A,B"); break;
+    case 0x79: snprintf(text, size, "MOV A,C"); break;
+    case 0x7a: snprintf(text, size, "MOV A,D"); break;
+    case 0x7b: snprintf(text, size, "MOV A,E"); break;
+    case 0x7c: snprintf(text, size, "MOV A,H"); break;
+    case 0x7d: snprintf(text, size, "MOV A,L"); break;
+    case 0x7e: snprintf(text, size, "MOV A,M"); break;
+    case 0x7f: snprintf(text, size, "MOV A,A"); break;
+    // 128- 143
+    case 0x80: snprintf(text, size, "ADD B"); break;
+    case 0x81: snprintf(text, size, "ADD C"); break;
+    case 0x82: snprintf(text, size, "ADD D"); break;
+    case 0x83: snprintf(text, size, "ADD E"); break;
+    case 0x84: snprintf(text, size, "ADD H"); break;
+    case 0x85: snprintf(text, size, "ADD L"); break;
+    case 0x86: snprintf(text, size, "ADD M"); break;
+    case 0x87: snprintf(text, size, "ADD A"); break;
+    case 0x88: snprintf(text, size, "ADC B"); break;
+    case 0x89: snprintf(text, size, "ADC C"); break;
+    case 0x8a: snprintf(text, size, "ADC D"); break;
+    case 0x8b: snprintf(text, size, "ADC E"); break;
+    case 0x8c: snprintf(text, size, "ADC H"); break;
+    case 0x8d: snprintf(text, size, "ADC L"); break;
+    case 0x8e: snprintf(text, size, "ADC M"); break;
+    case 0x8f: snprintf(text, size, "ADC A"); break;
+    // 144-159
+    case 0x90: snprintf(text, size, "SUB B"); break;
+    case 0x91: snprintf(text, size, "SUB C"); break;
+    case 0x92: snprintf(text, size, "SUB D"); break;
+    case 0x93: snprintf(text, size, "SUB E"); break;
+    case 0x94: snprintf(text, size, "SUB H"); break;
+    case 0x95: snprintf(text, size, "SUB L"); break;
+    case 0x96: snprintf(text, size, "SUB M"); break;
+    case 0x97: snprintf(text, size, "SUB A"); break;
+    case 0x98: snprintf(text, size, "SBB B"); break;
+    case 0x99: snprintf(text, size, "SBB C"); break;
+    case 0x9a: snprintf(text, size, "SBB D"); break;
+    case 0x9b: snprintf(text, size, "SBB E"); break;
+    case 0x9c: snprintf(text, size, "SBB H"); break;
+    case 0x9d: snprintf(text, size, "SBB L"); break;
+    case 0x9e: snprintf(text, size, "SBB M"); break;
+    case 0x9f: snprintf(text, size, "SBB A"); break;
+    // 160-175
+    case 0xa0: snprintf(text, size, "ANA B"); break;
+    case 0xa1: snprintf(text, size, "ANA C"); break;
+    case 0xa2: snprintf(text, size, "ANA D"); break;
+    case 0xa3: snprintf(text, size, "ANA E"); break;
+    case 0xa4: snprintf(text, size, "ANA H"); break;
+    case 0xa5: snprintf(text, size, "ANA L"); break;
+    case 0xa6: snprintf(text, size, "ANA M"); break;
+    case 0xa7: snprintf(text, size, "ANA A"); break;
+    case 0xa8: snprintf(text, size, "XRA B"); break;
+    case 0xa9: snprintf(text, size, "XRA C"); break;
+    case 0xaa: snprintf(text, size, "XRA D"); break;
+    case 0xab: snprintf(text, size, "XRA E"); break;
+    case 0xac: snprintf(text, size, "XRA H"); break;
+    case 0xad: snprintf(text, size, "XRA L"); break;
+    case 0xae: snprintf(text, size, "XRA M"); break;
+    case 0xaf: snprintf(text, size, "XRA A"); break;
+    // 176-191
+    case 0xb0: snprintf(text, size, "ORA B"); break;
+    case 0xb1: snprintf(text, size, "ORA C"); break;
+    case 0xb2: snprintf(text, size, "ORA D"); break;
+    case 0xb3: snprintf(text, size, "ORA E"); break;
+    case 0xb4: snprintf(text, size, "ORA H"); break;
+    case 0xb5: snprintf(text, size, "ORA L"); break;
+    case 0xb6: snprintf(text, size, "ORA M"); break;
+    case 0xb7: snprintf(text, size, "ORA A"); break;
+    case 0xb8: snprintf(text, size, "CMP B"); break;
+    case 0xb9: snprintf(text, size, "CMP C"); break;
+    case 0xba: snprintf(text, size, "CMP D"); break;
+    case 0xbb: snprintf(text, size, "CMP E"); break;
+    case 0xbc: snprintf(text, size, "CMP H"); break;
+    case 0xbd: snprintf(text, size, "CMP L"); break;
+    case 0xbe: snprintf(text, size, "CMP M"); break;
+    case 0xbf: snprintf(text, size, "CMP A"); break;
+    // 192-207
+    case 0xc0: snprintf(text, size, "RNZ"); break;
+    case 0xc1: snprintf(text, size, "POP B"); break;
+    case 0xc2: snprintf(text, size, "JNZ #$%02x%02x", code[2], code[1]); opSize = 3; break;
+    case 0xc3: snprintf(text, size, "JMP #$%02x%02x", code[2], code[1]); opSize = 3; break;
+    case 0xc4: snprintf(text, size, "CNZ #$%02x%02x", code[2], code[1]); opSize = 3; break;
+    case 0xc5: snprintf(text, size, "PUSH B"); break;
+    case 0xc6: snprintf(text, size, "ADI #$%02x", code[1]); opSize = 2; break;
+    case 0xc7: snprintf(text, size, "RST 0"); break;
+    case 0xc8: snprintf(text, size, "RZ"); break;
+    case 0xc9: snprintf(text, size, "RET"); break;
+    case 0xca: snprintf(text, size, "JZ #$%02x%02x", code[2], code[1]); opSize = 3; break;
+    case 0xcb: snprintf(text, size, "NOP"); break;
+    case 0xcc: snprintf(text, size, "CZ #$%02x%02x", code[2], code[1]); opSize = 3; break;
+    case 0xcd: snprintf(text, size, "CALL #$%02x%02x", code[2], code[1]); opSize = 3; break;
+    case 0xce: snprintf(text, size, "ACI #$%02x", code[1]); opSize = 2; break;
+    case 0xcf: snprintf(text, size, "RST 1"); break;
+    // 208-223
+    case 0xd0: snprintf(text, size, "RNC"); break;
+    case 0xd1: snprintf(text, size, "POP D"); break;
+    case 0xd2: snprintf(text, size, "JNC #$%02x%02x", code[2], code[1]); opSize = 3; break;
+    case 0xd3: snprintf(text, size, "OUT #$%02x", code[1]); opSize = 2; break;
+    case 0xd4: snprintf(text, size, "CNC #$%02x%02x", code[1], code[2]); opSize = 3; break;
+    case 0xd5: snprintf(text, size, "PUSH D"); break;
+    case 0xd6: snprintf(text, size, "SUI #$%02x", code[1]); opSize = 2; break;
+    case 0xd7: snprintf(text, size, "RST 2"); break;
+    case 0xd8: snprintf(text, size, "RC 1"); break;
+    case 0xd9: snprintf(text, size, "NOP"); break;
+    case 0xda: snprintf(text, size, "JC #$%02x%02x", code[2], code[1]); opSize = 3; break;
+    case 0xdb: snprintf(text, size, "IN #$%02x", code[1]); opSize = 2; break;
+    case 0xdc: snprintf(text, size, "CC #$%02x%02x", code[2], code[1]); opSize = 3; break;
+    case 0xdd: snprintf(text, size, "NOP"); break;
+    case 0xde: snprintf(text, size, "SBI #$%02x", code[1]); opSize = 2; break;
+    case 0xdf: snprintf(text, size, "RST 3"); break;
+    // 224 - 239
+    case 0xe0: snprintf(text, size, "RPO"); break;
+    case 0xe1: snprintf(text, size, "POP H"); break;
+    case 0xe2: snprintf(text, size, "JPO #$%02x%02x", code[2], code[1]); opSize = 3; break;
+    case 0xe3: snprintf(text, size, "XTHL"); break;
+    case 0xe4: snprintf(text, size, "CPO #$%02x%02x", code[2], code[1]); opSize = 3; break;
+    case 0xe5: snprintf(text, size, "PUSH H"); break;
+    case 0xe6: snprintf(text, size, "ANI #$%02x", code[1]); opSize = 2; break;
+    case 0xe7: snprintf(text, size, "RST 4"); break;
+    case 0xe8: snprintf(text, size, "RPE"); break;
+    case 0xe9: snprintf(text, size, "PCHL"); break;
+    case 0xea: snprintf(text, size, "JPE #$%02x%02x", code[2], code[1]); opSize = 3; break;
+    case 0xeb: snprintf(text, size, "XCHG"); break;
+    case 0xec: snprintf(text, size, "CPE #$%02x%02x", code[2], code[1]); opSize = 3; break;
+    case 0xed: snprintf(text, size, "NOP"); break;
+    case 0xee: snprintf(text, size, "XRI #$%02x", code[1]); opSize = 2; break;
+    case 0xef: snprintf(text, size, "RST 5"); break;
+    // 240-255
+    case 0xf0: snprintf(text, size, "RP"); break;
+    case 0xf1: snprintf(text, size, "POP PSW"); break;
+    case 0xf2: snprintf(text, size, "JP #$%02x%02x", code[2], code[1]); opSize = 3; break;
+    case 0xf3: snprintf(text, size, "DI"); break;
+    case 0xf4: snprintf(text, size, "CP #$%02x%02x", code[2], code[1]); opSize = 3; break;
+    case 0xf5: snprintf(text, size, "PUSH PSW"); break;
+    case 0xf6: snprintf(text, size, "ORI #$%02x", code[1]); opSize = 2; break;
+    case 0xf7: snprintf(text, size, "RST 6"); break;
+    case 0xf8: snprintf(text, size, "RM"); break;
+    case 0xf9: snprintf(text, size, "SPHL"); break;
+    case 0xfa: snprintf(text, size, "JM #$%02x%02x", code[2], code[1]); opSize = 3; break;
+    case 0xfb: snprintf(text, size, "EI"); break;
+    case 0xfc: snprintf(text, size, "CM #$%02x%02x", code[2], code[1]); opSize = 3; break;
+    case 0xfd: snprintf(text, size, "NOP"); break;
+    case 0xfe: snprintf(text, size, "CPI #$%02x", code[1]); opSize = 2; break;
+    case 0xff: snprintf(text, size, "RST 7"); break;
+  }
+  return opSize;
+}
+
+/* Disassembler function for 8080 assembly code
+  Input: pointer to assembly code, program counter
+  Output: Number of bytes the operation took
+  Prints the operation performed by the opcode
+*/
+int disassembleAsm(unsigned char *codeBuffer, int pc) {
+  char text[32];
+  int opSize = decodeAsm(&codeBuffer[pc], text, sizeof(text));
+  printf("%04x %s\n", pc, text);
+  return opSize;
+}
+
+#ifndef NO_DISASSEMBLER_MAIN
 /* Main function for 8080 disassembler
   Input: File name
   Output: int 0
@@ -38,293 +338,4 @@ int main(int argc, char const *argv[]) {
   }
   return 0;
 }
-
-/* Disassembler function for 8080 assembly code
-  Input: pointer to assembly code, program counter
-  Output: Number of bytes the operation took
-  Prints the operation performed by the opcode
-*/
-int disassembleAsm(unsigned char *codeBuffer, int pc) {
-  // Get specific opcode, set default opSize
-  unsigned char *code = &codeBuffer[pc];
-  int opSize = 1;
-  printf("%04x ", pc);
-  // Switch off of the 0xff opcodes
-  switch (*code) {
-    // 0-15
-    case 0x00: printf("NOP"); break;
-    case 0x01: printf("LXI B,#$%02x%02x", code[2], code[1]); opSize = 3; break;
-    case 0x02: printf("STAX B"); break;
-    case 0x03: printf("INX B"); break;
-    case 0x04: printf("INR B"); break;
-    case 0x05: printf("DCR B"); break;
-    case 0x06: printf("MVI B,#$%02x", code[1]); opSize = 2; break;
-    case 0x07: printf("RLC"); break;
-    case 0x08: printf("NOP"); break;
-    case 0x09: printf("DAD B"); break;
-    case 0x0a: printf("LDAX B"); break;
-    case 0x0b: printf("DCX B"); break;
-    case 0x0c: printf("INR C"); break;
-    case 0x0d: printf("DCR C"); break;
-    case 0x0e: printf("MVI C,#$%02x", code[1]); opSize = 2; break;
-    case 0x0f: printf("RRC"); break;
-    // 16-31
-    case 0x10: printf("NOP"); break;
-    case 0x11: printf("LXI D,#$%02x%02x", code[2], code[1]); opSize = 3; break;
-    case 0x12: printf("STAX D"); break;
-    case 0x13: printf("INX D"); break;
-    case 0x14: printf("INR D"); break;
-    case 0x15: printf("DCR D"); break;
-    case 0x16: printf("MVI D,#$%02x", code[1]); opSize = 2; break;
-    case 0x17: printf("RAL"); break;
-    case 0x18: printf("NOP"); break;
-    case 0x19: printf("DAD D"); break;
-    case 0x1a: printf("LDAX D"); break;
-    case 0x1b: printf("DCX D"); break;
-    case 0x1c: printf("INR E"); break;
-    case 0x1d: printf("DCR E"); break;
-    case 0x1e: printf("MVI E,#$%02x", code[1]); opSize = 2; break;
-    case 0x1f: printf("RAR"); break;
-    // 32-47
-    case 0x20: printf("RIM"); break;
-    case 0x21: printf("LXI H,#$%02x%02x", code[2], code[1]); opSize = 3; break;
-    case 0x22: printf("SHLD $%02x%02x", code[2], code[1]); opSize = 3; break;
-    case 0x23: printf("INX H"); break;
-    case 0x24: printf("INR H"); break;
-    case 0x25: printf("DCR H"); break;
-    case 0x26: printf("MVI H,#$%02x", code[1]); opSize = 2; break;
-    case 0x27: printf("DAA"); break;
-    case 0x28: printf("NOP"); break;
-    case 0x29: printf("DAD H"); break;
-    case 0x2a: printf("LHLD $%02x%02x", code[2], code[1]); opSize = 3; break;
-    case 0x2b: printf("DCX H"); break;
-    case 0x2c: printf("INR L"); break;
-    case 0x2d: printf("DCR L"); break;
-    case 0x2e: printf("MVI L,#$%02x", code[1]); opSize = 2; break;
-    case 0x2f: printf("CMA"); break;
-    // 48-63
-    case 0x30: printf("SIM"); break;
-    case 0x31: printf("LXI SP,#$%02x#$%02x", code[2], code[1]); opSize = 3; break;
-    case 0x32: printf("STA $%02x$%02x", code[2], code[1]); opSize = 3; break;
-    case 0x33: printf("INX SP"); break;
-    case 0x34: printf("INR M"); break;
-    case 0x35: printf("DCR M"); break;
-    case 0x36: printf("MVI M,#$%02x", code[1]); opSize = 2; break;
-    case 0x37: printf("STC"); break;
-    case 0x38: printf("NOP"); break;
-    case 0x39: printf("DAD SP"); break;
-    case 0x3a: printf("LDA $%02x%02x", code[2], code[1]); opSize = 3; break;
-    case 0x3b: printf("DCX SP"); break;
-    case 0x3c: printf("INR A"); break;
-    case 0x3d: printf("DCR A"); break;
-    case 0x3e: printf("MVI A,#$%02x", code[1]); opSize = 2; break;
-    case 0x3f: printf("CMC"); break;
-    // 64-79
-    case 0x40: printf("MOV B,B"); break;
-    case 0x41: printf("MOV B,C"); break;
-    case 0x42: printf("MOV B,D"); break;
-    case 0x43: printf("MOV B,E"); break;
-    case 0x44: printf("MOV B,H"); break;
-    case 0x45: printf("MOV B,L"); break;
-    case 0x46: printf("MOV B,M"); break;
-    case 0x47: printf("MOV B,A"); break;
-    case 0x48: printf("MOV C,B"); break;
-    case 0x49: printf("MOV C,C"); break;
-    case 0x4a: printf("MOV C,D"); break;
-    case 0x4b: printf("MOV C,E"); break;
-    case 0x4c: printf("MOV C,H"); break;
-    case 0x4d: printf("MOV C,L"); break;
-    case 0x4e: printf("MOV C,M"); break;
-    case 0x4f: printf("MOV C,A"); break;
-    // 80-95
-    case 0x50: printf("MOV D,B"); break;
-    case 0x51: printf("MOV D,C"); break;
-    case 0x52: printf("MOV D,D"); break;
-    case 0x53: printf("MOV D,E"); break;
-    case 0x54: printf("MOV D,H"); break;
-    case 0x55: printf("MOV D,L"); break;
-    case 0x56: printf("MOV D,M"); break;
-    case 0x57: printf("MOV D,A"); break;
-    case 0x58: printf("MOV E,B"); break;
-    case 0x59: printf("MOV E,C"); break;
-    case 0x5a: printf("MOV E,D"); break;
-    case 0x5b: printf("MOV E,E"); break;
-    case 0x5c: printf("MOV E,H"); break;
-    case 0x5d: printf("MOV E,L"); break;
-    case 0x5e: printf("MOV E,M"); break;
-    case 0x5f: printf("MOV E,A"); break;
-    // 96 - 111
-    case 0x60: printf("MOV H,B"); break;
-    case 0x61: printf("MOV H,C"); break;
-    case 0x62: printf("MOV H,D"); break;
-    case 0x63: printf("MOV H,E"); break;
-    case 0x64: printf("MOV H,H"); break;
-    case 0x65: printf("MOV H,L"); break;
-    case 0x66: printf("MOV H,M"); break;
-    case 0x67: printf("MOV H,A"); break;
-    case 0x68: printf("MOV L,B"); break;
-    case 0x69: printf("MOV L,C"); break;
-    case 0x6a: printf("MOV L,D"); break;
-    case 0x6b: printf("MOV L,E"); break;
-    case 0x6c: printf("MOV L,H"); break;
-    case 0x6d: printf("MOV L,L"); break;
-    case 0x6e: printf("MOV L,M"); break;
-    case 0x6f: printf("MOV L,A"); break;
-    // 112-127
-    case 0x70: printf("MOV M,B"); break;
-    case 0x71: printf("MOV M,C"); break;
-    case 0x72: printf("MOV M,D"); break;
-    case 0x73: printf("MOV M,E"); break;
-    case 0x74: printf("MOV M,H"); break;
-    case 0x75: printf("MOV M,L"); break;
-    case 0x76: printf("HLT"); break;
-    case 0x77: printf("MOV M,A"); break;
-    case 0x78: printf("MOV A,B"); break;
-    case 0x79: printf("MOV A,C"); break;
-    case 0x7a: printf("MOV A,D"); break;
-    case 0x7b: printf("MOV A,E"); break;
-    case 0x7c: printf("MOV A,H"); break;
-    case 0x7d: printf("MOV A,L"); break;
-    case 0x7e: printf("MOV A,M"); break;
-    case 0x7f: printf("MOV A,A"); break;
-    // 128- 143
-    case 0x80: printf("ADD B"); break;
-    case 0x81: printf("ADD C"); break;
-    case 0x82: printf("ADD D"); break;
-    case 0x83: printf("ADD E"); break;
-    case 0x84: printf("ADD H"); break;
-    case 0x85: printf("ADD L"); break;
-    case 0x86: printf("ADD M"); break;
-    case 0x87: printf("ADD A"); break;
-    case 0x88: printf("ADC B"); break;
-    case 0x89: printf("ADC C"); break;
-    case 0x8a: printf("ADC D"); break;
-    case 0x8b: printf("ADC E"); break;
-    case 0x8c: printf("ADC H"); break;
-    case 0x8d: printf("ADC L"); break;
-    case 0x8e: printf("ADC M"); break;
-    case 0x8f: printf("ADC A"); break;
-    // 144-159
-    case 0x90: printf("SUB B"); break;
-    case 0x91: printf("SUB C"); break;
-    case 0x92: printf("SUB D"); break;
-    case 0x93: printf("SUB E"); break;
-    case 0x94: printf("SUB H"); break;
-    case 0x95: printf("SUB L"); break;
-    case 0x96: printf("SUB M"); break;
-    case 0x97: printf("SUB A"); break;
-    case 0x98: printf("SBB B"); break;
-    case 0x99: printf("SBB C"); break;
-    case 0x9a: printf("SBB D"); break;
-    case 0x9b: printf("SBB E"); break;
-    case 0x9c: printf("SBB H"); break;
-    case 0x9d: printf("SBB L"); break;
-    case 0x9e: printf("SBB M"); break;
-    case 0x9f: printf("SBB A"); break;
-    // 160-175
-    case 0xa0: printf("ANA B"); break;
-    case 0xa1: printf("ANA C"); break;
-    case 0xa2: printf("ANA D"); break;
-    case 0xa3: printf("ANA E"); break;
-    case 0xa4: printf("ANA H"); break;
-    case 0xa5: printf("ANA L"); break;
-    case 0xa6: printf("ANA M"); break;
-    case 0xa7: printf("ANA A"); break;
-    case 0xa8: printf("XRA B"); break;
-    case 0xa9: printf("XRA C"); break;
-    case 0xaa: printf("XRA D"); break;
-    case 0xab: printf("XRA E"); break;
-    case 0xac: printf("XRA H"); break;
-    case 0xad: printf("XRA L"); break;
-    case 0xae: printf("XRA M"); break;
-    case 0xaf: printf("XRA A"); break;
-    // 176-191
-    case 0xb0: printf("ORA B"); break;
-    case 0xb1: printf("ORA C"); break;
-    case 0xb2: printf("ORA D"); break;
-    case 0xb3: printf("ORA E"); break;
-    case 0xb4: printf("ORA H"); break;
-    case 0xb5: printf("ORA L"); break;
-    case 0xb6: printf("ORA M"); break;
-    case 0xb7: printf("ORA A"); break;
-    case 0xb8: printf("CMP B"); break;
-    case 0xb9: printf("CMP C"); break;
-    case 0xba: printf("CMP D"); break;
-    case 0xbb: printf("CMP E"); break;
-    case 0xbc: printf("CMP H"); break;
-    case 0xbd: printf("CMP L"); break;
-    case 0xbe: printf("CMP M"); break;
-    case 0xbf: printf("CMP A"); break;
-    // 192-207
-    case 0xc0: printf("RNZ"); break;
-    case 0xc1: printf("POP B"); break;
-    case 0xc2: printf("JNZ #$%02x%02x", code[2], code[1]); opSize = 3; break;
-    case 0xc3: printf("JMP #$%02x%02x", code[2], code[1]); opSize = 3; break;
-    case 0xc4: printf("CNZ #$%02x%02x", code[2], code[1]); opSize = 3; break;
-    case 0xc5: printf("PUSH B"); break;
-    case 0xc6: printf("ADI #$%02x", code[1]); opSize = 2; break;
-    case 0xc7: printf("RST 0"); break;
-    case 0xc8: printf("RZ"); break;
-    case 0xc9: printf("RET"); break;
-    case 0xca: printf("JZ #$%02x%02x", code[2], code[1]); opSize = 3; break;
-    case 0xcb: printf("NOP"); break;
-    case 0xcc: printf("CZ #$%02x%02x", code[2], code[1]); opSize = 3; break;
-    case 0xcd: printf("CALL #$%02x%02x", code[2], code[1]); opSize = 3; break;
-    case 0xce: printf("ACI #$%02x", code[1]); opSize = 2; break;
-    case 0xcf: printf("RST 1"); break;
-    // 208-223
-    case 0xd0: printf("RNC"); break;
-    case 0xd1: printf("POP D"); break;
-    case 0xd2: printf("JNC #$%02x%02x", code[2], code[1]); opSize = 3; break;
-    case 0xd3: printf("OUT #$%02x", code[1]); opSize = 2; break;
-    case 0xd4: printf("CNC #$%02x%02x", code[1], code[2]); opSize = 3; break;
-    case 0xd5: printf("PUSH D"); break;
-    case 0xd6: printf("SUI #$%02x", code[1]); opSize = 2; break;
-    case 0xd7: printf("RST 2"); break;
-    case 0xd8: printf("RC 1"); break;
-    case 0xd9: printf("NOP"); break;
-    case 0xda: printf("JC #$%02x%02x", code[2], code[1]); opSize = 3; break;
-    case 0xdb: printf("IN #$%02x", code[1]); opSize = 2; break;
-    case 0xdc: printf("CC #$%02x%02x", code[2], code[1]); opSize = 3; break;
-    case 0xdd: printf("NOP"); break;
-    case 0xde: printf("SBI #$%02x", code[1]); opSize = 2; break;
-    case 0xdf: printf("RST 3"); break;
-    // 224 - 239
-    case 0xe0: printf("RPO"); break;
-    case 0xe1: printf("POP H"); break;
-    case 0xe2: printf("JPO #$%02x%02x", code[2], code[1]); opSize = 3; break;
-    case 0xe3: printf("XTHL"); break;
-    case 0xe4: printf("CPO #$%02x%02x", code[2], code[1]); opSize = 3; break;
-    case 0xe5: printf("PUSH H"); break;
-    case 0xe6: printf("ANI #$%02x", code[1]); opSize = 2; break;
-    case 0xe7: printf("RST 4"); break;
-    case 0xe8: printf("RPE"); break;
-    case 0xe9: printf("PCHL"); break;
-    case 0xea: printf("JPE #$%02x%02x", code[2], code[1]); opSize = 3; break;
-    case 0xeb: printf("XCHG"); break;
-    case 0xec: printf("CPE #$%02x%02x", code[2], code[1]); opSize = 3; break;
-    case 0xed: printf("NOP"); break;
-    case 0xee: printf("XRI #$%02x", code[1]); opSize = 2; break;
-    case 0xef: printf("RST 5"); break;
-    // 240-255
-    case 0xf0: printf("RP"); break;
-    case 0xf1: printf("POP PSW"); break;
-    case 0xf2: printf("JP #$%02x%02x", code[2], code[1]); opSize = 3; break;
-    case 0xf3: printf("DI"); break;
-    case 0xf4: printf("CP #$%02x%02x", code[2], code[1]); opSize = 3; break;
-    case 0xf5: printf("PUSH PSW"); break;
-    case 0xf6: printf("ORI #$%02x", code[1]); opSize = 2; break;
-    case 0xf7: printf("RST 6"); break;
-    case 0xf8: printf("RM"); break;
-    case 0xf9: printf("SPHL"); break;
-    case 0xfa: printf("JM #$%02x%02x", code[2], code[1]); opSize = 3; break;
-    case 0xfb: printf("EI"); break;
-    case 0xfc: printf("CM #$%02x%02x", code[2], code[1]); opSize = 3; break;
-    case 0xfd: printf("NOP"); break;
-    case 0xfe: printf("CPI #$%02x", code[1]); opSize = 2; break;
-    case 0xff: printf("RST 7"); break;
-  }
-  // Print newline char, return pc increment
-  printf("\n");
-  return opSize;
-}
+#endif
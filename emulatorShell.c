@@ -3,13 +3,26 @@
   7-31-2018
 */
 
+#ifdef WATCHPOINTS
+#define _GNU_SOURCE // For the host registers in ucontext_t
+#endif
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#define NO_DISASSEMBLER_MAIN
 #include"disassembler.c"
 
 /* Struct emulating the flags of the 8080 processor
   All flags default to 1
+  ALU ops don't write these directly, see setFlags and syncFlags
 */
 typedef struct conditionCodes {
   uint8_t z:1; // Zero Flag
@@ -20,23 +33,83 @@ typedef struct conditionCodes {
   uint8_t pad:1;
 } conditionCodes;
 
+/* Struct holding one pre decoded instruction
+  Filled in the first time the op at an address is run when built
+  with PREDECODE_CACHE or BLOCK_CACHE, so handlers never re-read the
+  op code bytes
+*/
+typedef struct decodedOp {
+  void *handler; // Handler label, only used with THREADED_DISPATCH
+  uint16_t operand; // Immediate data, (opCode[2] << 8) | opCode[1]
+  uint8_t opCode;
+  uint8_t length; // Instruction length, 0 if not decoded yet
+#ifdef FUSE_OPS
+  uint8_t span; // Bytes covered by the op, or by its fused sequence
+#endif
+} decodedOp;
+
+/* Macro for a register pair, usable as one 16 bit word or two bytes
+  The bytes are ordered so the first register is the high byte of the
+  word on both little and big endian hosts
+*/
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define REGISTER_PAIR(word, high, low) union { uint16_t word; struct { high; low; }; }
+#else
+#define REGISTER_PAIR(word, high, low) union { uint16_t word; struct { low; high; }; }
+#endif
+
+#define MEMORY_PAGE_SIZE 0x100
+#define MEMORY_PAGES 0x100
+#define DIRTY_WORDS (MEMORY_PAGES / 64)
+
 /* Struct emulating the state of the 8080 processor
   Features registers A-L, the stack pointer, program counter,
   the memory, condition codes, etc.
+  Guest memory is reached through readPages and writePages, which point
+  each 256 byte page into memory, or writes to ROM into romSink
+  BC, DE and HL can be used as pairs through bc, de and hl
 */
 typedef struct state8080 {
-  uint8_t a;
-  uint8_t b;
-  uint8_t c;
-  uint8_t d;
-  uint8_t e;
-  uint8_t h;
-  uint8_t l;
+  REGISTER_PAIR(psw, uint8_t a, struct conditionCodes cc); // A and the flags
+  REGISTER_PAIR(bc, uint8_t b, uint8_t c);
+  REGISTER_PAIR(de, uint8_t d, uint8_t e);
+  REGISTER_PAIR(hl, uint8_t h, uint8_t l);
   uint16_t sp; // Stack Pointer
   uint16_t pc; // Program Counter
-  uint8_t *memory;
-  struct conditionCodes cc;
+  uint8_t *memory; // 64k the memory map points into
+  uint8_t *readPages[MEMORY_PAGES + 1]; // Where each page is read from, then page 0 again
+  uint8_t *writePages[MEMORY_PAGES]; // Where each page is written to
+  uint8_t romSink[MEMORY_PAGE_SIZE]; // Takes the writes to ROM pages
+#ifdef DIRTY_PAGES
+  uint64_t dirtyPages[DIRTY_WORDS]; // Bit per page written since collectDirtyPages
+#endif
+#if defined(DIRTY_PAGES) || defined(PREDECODE_CACHE) || defined(BLOCK_CACHE)
+  uint8_t pageOwners[MEMORY_PAGES]; // Page a page's memory belongs to, the source for mirrors
+#endif
+#if defined(PREDECODE_CACHE) || defined(BLOCK_CACHE)
+  uint8_t pageAliases[MEMORY_PAGES]; // Next page with the same owner, a ring back to the page
+#endif
+#ifdef WATCHPOINTS
+  uint8_t *watchMap; // Bit per byte of memory watched, NULL if none ever were
+  void (*watchHook)(struct state8080* state, uint16_t address, uint8_t value); // NULL prints
+#endif
   uint8_t intEnable;
+  uint8_t interruptPending; // Set by requestInterrupt, taken by runCycles
+  uint8_t interruptNumber; // RST number of the pending interrupt
+  uint8_t stopRequested; // Set by requestStop to end runCycles early
+  uint8_t lazyFlags; // Flags in cc that are out of date, LAZY_SZP and LAZY_CY
+  uint8_t szpResult; // Last result that set Z, S and P
+  uint16_t cyResult; // Last result that set CY, carry is anything over 0xff
+  uint8_t (*inPort)(struct state8080* state, uint8_t port); // IN hook, NULL if unused
+  void (*outPort)(struct state8080* state, uint8_t port, uint8_t value); // OUT hook
+  void *userData; // For the hooks, the emulator doesn't touch it
+  struct stateArena *arena; // Arena the state was made in, NULL for initializeState
+#ifdef PREDECODE_CACHE
+  decodedOp *decodeCache; // One entry per address
+#endif
+#ifdef BLOCK_CACHE
+  struct blockCache *blockCache;
+#endif
 } state8080;
 
 /* Exception for unimplimented instructions
@@ -49,25 +122,260 @@ void unimplementedInstruction(state8080* state) {
     exit(1);
 }
 
-/* Helper function for calculating parity of an 8-bit input
-  Input: an unsigned 8-bit int
-  Output: 0 if even parity, 1 if odd parity
+#define MEMORY_RAM 0
+#define MEMORY_ROM 1
+#define MEMORY_MIRROR 2
+
+/* Struct for one region of a machine's memory map
+  start and size are multiples of MEMORY_PAGE_SIZE
+  A MEMORY_MIRROR region repeats the pages from source to
+  source + sourceSize over and over until it is full
+*/
+typedef struct memoryRegion {
+  uint16_t start;
+  uint32_t size;
+  uint8_t kind; // MEMORY_RAM, MEMORY_ROM or MEMORY_MIRROR
+  uint16_t source; // Only used by mirrors
+  uint32_t sourceSize;
+} memoryRegion;
+
+// Memory map of a bare 8080, 64k of RAM
+const memoryRegion flatMap = { 0x0000, 0x10000, MEMORY_RAM, 0, 0 };
+
+// Memory map of Space Invaders, 8k of ROM and 8k of RAM repeated above 0x4000
+const memoryRegion spaceInvadersMap[] = {
+  { 0x0000, 0x2000, MEMORY_ROM, 0, 0 },
+  { 0x2000, 0x2000, MEMORY_RAM, 0, 0 },
+  { 0x4000, 0xc000, MEMORY_MIRROR, 0x0000, 0x4000 }
+};
+#define SPACE_INVADERS_REGIONS (int) (sizeof(spaceInvadersMap) / sizeof(spaceInvadersMap[0]))
+
+#if defined(PREDECODE_CACHE) || defined(BLOCK_CACHE)
+/* Helper function to link the pages that share memory
+  Input: state8080 struct
+  Output: void
+  Each page goes into a ring with the other pages of its owner, so a
+  write can find every address its byte is decoded from
 */
-int parity(uint8_t input) {
-  int count = 0;
-  int i,b = 1;
-  for(i = 0; i < 8; i++) {
-    if(input & (b << i)) {
-      count++;
+void linkPageAliases(state8080* state) {
+  int firstAlias[MEMORY_PAGES];
+  int page;
+  for(page = 0; page < MEMORY_PAGES; page++) {
+    firstAlias[page] = -1;
+  }
+  for(page = 0; page < MEMORY_PAGES; page++) {
+    int owner = state->pageOwners[page];
+    if(firstAlias[owner] < 0) {
+      firstAlias[owner] = page;
+      state->pageAliases[page] = page;
+    } else {
+      state->pageAliases[page] = state->pageAliases[firstAlias[owner]];
+      state->pageAliases[firstAlias[owner]] = page;
     }
   }
-  return count % 2;
+}
+#endif
+
+/* Function to lay out the memory of a machine
+  Input: state8080 struct, regions of the map, number of regions
+  Output: void
+  Regions are mapped in order, so a mirror has to come after the
+  regions it repeats. Pages no region covers keep their old mapping.
+  The extra read page past the end always repeats page 0, see FETCH_BYTE
+*/
+void mapMemory(state8080* state, const memoryRegion* regions, int numRegions) {
+  int i, page;
+  for(i = 0; i < numRegions; i++) {
+    const memoryRegion *region = &regions[i];
+    int first = region->start / MEMORY_PAGE_SIZE;
+    int last = first + region->size / MEMORY_PAGE_SIZE;
+    for(page = first; page < last && page < MEMORY_PAGES; page++) {
+      if(region->kind == MEMORY_MIRROR) {
+        int source = region->source / MEMORY_PAGE_SIZE +
+          (page - first) % (region->sourceSize / MEMORY_PAGE_SIZE);
+        state->readPages[page] = state->readPages[source];
+        state->writePages[page] = state->writePages[source];
+#if defined(DIRTY_PAGES) || defined(PREDECODE_CACHE) || defined(BLOCK_CACHE)
+        state->pageOwners[page] = state->pageOwners[source];
+#endif
+      } else {
+        state->readPages[page] = &state->memory[page * MEMORY_PAGE_SIZE];
+        state->writePages[page] = region->kind == MEMORY_ROM ?
+          state->romSink : state->readPages[page];
+#if defined(DIRTY_PAGES) || defined(PREDECODE_CACHE) || defined(BLOCK_CACHE)
+        state->pageOwners[page] = page;
+#endif
+      }
+    }
+  }
+  state->readPages[MEMORY_PAGES] = state->readPages[0];
+#if defined(PREDECODE_CACHE) || defined(BLOCK_CACHE)
+  linkPageAliases(state);
+#endif
+}
+
+/* Macros for reading and writing guest memory through the memory map
+  One table lookup per access, addresses past 0xffff wrap around
+  With DIRTY_PAGES a write also sets the bit of its page, or of the
+  page it mirrors. With PREDECODE_CACHE or BLOCK_CACHE every write,
+  from any op, drops the code translated from the byte, see codeWritten.
+*/
+#define READ_BYTE(address) \
+  (state->readPages[(uint16_t) (address) >> 8][(address) & 0xff])
+#ifdef DIRTY_PAGES
+#define MARK_DIRTY(page) \
+  (state->dirtyPages[state->pageOwners[page] / 64] |= (uint64_t) 1 << (state->pageOwners[page] % 64))
+#define STORE_BYTE(address, value) \
+  (MARK_DIRTY((uint16_t) (address) >> 8), \
+  state->writePages[(uint16_t) (address) >> 8][(address) & 0xff] = (value))
+#else
+#define STORE_BYTE(address, value) \
+  (state->writePages[(uint16_t) (address) >> 8][(address) & 0xff] = (value))
+#endif
+#if defined(PREDECODE_CACHE) || defined(BLOCK_CACHE)
+#define WRITE_BYTE(address, value) \
+  (STORE_BYTE(address, value), codeWritten(state, (uint16_t) (address)))
+#else
+#define WRITE_BYTE(address, value) STORE_BYTE(address, value)
+#endif
+
+/* Macro for reading the bytes of an op, from pc up to pc + 2
+  The address isn't wrapped, an op at 0xfffe or 0xffff reads its
+  operands through the guard page at the end of readPages instead
+*/
+#define FETCH_BYTE(address) (state->readPages[(address) >> 8][(address) & 0xff])
+
+#ifdef DIRTY_PAGES
+/* Function to list the pages written since the last call
+  Input: state8080 struct, array of MEMORY_PAGES page numbers to fill
+  Output: number of pages listed, in increasing order
+  Clears the bits, so the caller owns the changes it was handed
+  Pages are MEMORY_PAGE_SIZE bytes, page n starts at address n << 8
+*/
+int collectDirtyPages(state8080* state, uint8_t* pages) {
+  int numPages = 0;
+  int word, bit;
+  for(word = 0; word < DIRTY_WORDS; word++) {
+    uint64_t bits = state->dirtyPages[word];
+    state->dirtyPages[word] = 0;
+    for(bit = 0; bits != 0; bit++, bits >>= 1) {
+      if(bits & 1) {
+        pages[numPages++] = word * 64 + bit;
+      }
+    }
+  }
+  return numPages;
+}
+
+/* Function to check one page without clearing it
+  Input: state8080 struct, page number
+  Output: 1 if the page was written since collectDirtyPages, 0 otherwise
+*/
+int pageIsDirty(state8080* state, uint8_t page) {
+  return (state->dirtyPages[page / 64] >> (page % 64)) & 1;
+}
+#endif
+
+// Zero, sign and parity bits of szpTable, in PUSH PSW order
+#define FLAG_Z 0x01
+#define FLAG_S 0x02
+#define FLAG_P 0x04
+
+/* Macros building szpTable at compile time
+  SZP_PARITY is set for odd parity, like the parity flag of the handlers
+*/
+#define SZP_PARITY(x) \
+  ((((x) ^ ((x) >> 1) ^ ((x) >> 2) ^ ((x) >> 3) ^ \
+  ((x) >> 4) ^ ((x) >> 5) ^ ((x) >> 6) ^ ((x) >> 7)) & 1) ? FLAG_P : 0)
+#define SZP(x) (((x) == 0 ? FLAG_Z : 0) | ((x) & 0x80 ? FLAG_S : 0) | SZP_PARITY(x))
+#define SZP4(x) SZP(x), SZP((x) + 1), SZP((x) + 2), SZP((x) + 3)
+#define SZP16(x) SZP4(x), SZP4((x) + 4), SZP4((x) + 8), SZP4((x) + 12)
+#define SZP64(x) SZP16(x), SZP16((x) + 16), SZP16((x) + 32), SZP16((x) + 48)
+
+// Zero, sign and parity flags for every byte value
+const uint8_t szpTable[256] = {
+  SZP64(0), SZP64(64), SZP64(128), SZP64(192)
+};
+
+#define LAZY_SZP 0x01
+#define LAZY_CY 0x02
+
+/* Helper functions for recording the flags of an ALU op
+  Input: state8080 struct, result of the op
+  Output: void
+  Only the result is kept, the flags are looked up in szpTable when a
+  conditional op or PUSH PSW reads them
+*/
+void setFlags(state8080* state, uint16_t result) {
+  state->szpResult = result & 0xff;
+  state->cyResult = result;
+  state->lazyFlags = LAZY_SZP | LAZY_CY;
+}
+
+void setZSP(state8080* state, uint8_t result) {
+  state->szpResult = result;
+  state->lazyFlags |= LAZY_SZP;
+}
+
+void setCarry(state8080* state, uint8_t carry) {
+  state->cc.cy = carry;
+  state->lazyFlags &= ~LAZY_CY;
+}
+
+/* Helper functions for reading flags
+  Input: state8080 struct
+  Output: value of the flag, 0 or 1
+*/
+uint8_t getZero(state8080* state) {
+  if(state->lazyFlags & LAZY_SZP) {
+    return szpTable[state->szpResult] & FLAG_Z;
+  }
+  return state->cc.z;
+}
+
+uint8_t getSign(state8080* state) {
+  if(state->lazyFlags & LAZY_SZP) {
+    return (szpTable[state->szpResult] & FLAG_S) != 0;
+  }
+  return state->cc.s;
+}
+
+uint8_t getParity(state8080* state) {
+  if(state->lazyFlags & LAZY_SZP) {
+    return (szpTable[state->szpResult] & FLAG_P) != 0;
+  }
+  return state->cc.p;
+}
+
+uint8_t getCarry(state8080* state) {
+  if(state->lazyFlags & LAZY_CY) {
+    return state->cyResult > 0xff;
+  }
+  return state->cc.cy;
+}
+
+/* Function to bring every flag in cc up to date
+  Input: state8080 struct
+  Output: void
+  Call before reading cc directly
+*/
+void syncFlags(state8080* state) {
+  if(state->lazyFlags & LAZY_SZP) {
+    uint8_t szp = szpTable[state->szpResult];
+    state->cc.z = szp & FLAG_Z;
+    state->cc.s = (szp & FLAG_S) != 0;
+    state->cc.p = (szp & FLAG_P) != 0;
+  }
+  if(state->lazyFlags & LAZY_CY) {
+    state->cc.cy = getCarry(state);
+  }
+  state->lazyFlags = 0;
 }
 
 // Array of cycle counts for each operation
 unsigned char cycles[] = {
-  4, 10, 7, 5, 5, 7, 4, 4, 10, 7, 5, 5, 5, 7, 4,
-  4, 10, 7, 5, 5, 7, 4, 4, 10, 7, 5, 5, 5, 7, 4,
+  4, 10, 7, 5, 5, 5, 7, 4, 4, 10, 7, 5, 5, 5, 7, 4,
+  4, 10, 7, 5, 5, 5, 7, 4, 4, 10, 7, 5, 5, 5, 7, 4,
   4, 10, 16, 5, 5, 5, 7, 4, 4, 10, 16, 5, 5, 5, 7, 4,
   4, 10, 13, 5, 10, 10, 10, 4, 4, 10, 13, 5, 5, 5, 7, 4,
   5, 5, 5, 5, 5, 5, 7, 5, 5, 5, 5, 5, 5, 5, 7, 5,
@@ -84,1722 +392,1812 @@ unsigned char cycles[] = {
   11, 10, 10, 4, 17, 11, 7, 11, 11, 5, 10, 4, 17, 17, 7, 11
 };
 
+// Array of instruction lengths for each operation
+unsigned char opLengths[] = {
+  1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+  1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+  1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1,
+  1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1,
+  1, 1, 3, 2, 3, 1, 2, 1, 1, 1, 3, 2, 3, 1, 2, 1,
+  1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1,
+  1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1
+};
+
+/* Function to decode the instruction at an address
+  Input: state8080 struct, address of the op code, entry to fill in
+  Output: void
+  Operand bytes past 0xffff wrap around to the start of memory
+*/
+void decodeOp(state8080* state, uint16_t address, decodedOp* entry) {
+  entry->opCode = FETCH_BYTE(address);
+  entry->length = opLengths[entry->opCode];
+  entry->operand = 0;
+  if(entry->length > 1) {
+    entry->operand = FETCH_BYTE(address + 1);
+  }
+  if(entry->length > 2) {
+    entry->operand |= FETCH_BYTE(address + 2) << 8;
+  }
+#ifdef FUSE_OPS
+  entry->span = entry->length;
+#endif
+}
+
+#ifdef BLOCK_CACHE
+#include"blockCache.c"
+#endif
+#ifdef FUSE_OPS
+#include"fusedOps.c"
+#endif
+#ifdef PROFILE_OPCODES
+#include"opProfile.c"
+#endif
+
+#ifdef PREDECODE_CACHE
+/* Function to drop cached instructions that cover an address
+  Input: state8080 struct, address that was written to
+  Output: void
+  Checks the entries that start up to two bytes before the address,
+  since their operands may include the written byte
+  With FUSE_OPS the entries that start a fused sequence covering the
+  address are dropped too
+*/
+void invalidateDecoded(state8080* state, uint16_t address) {
+  int back;
+#ifdef FUSE_OPS
+  for(back = 0; back < FUSED_MAX_SPAN; back++) {
+    decodedOp *entry = &state->decodeCache[(uint16_t) (address - back)];
+    if(entry->length != 0 && entry->span > back) {
+      entry->length = 0;
+    }
+  }
+#else
+  for(back = 0; back < 3; back++) {
+    decodedOp *entry = &state->decodeCache[(uint16_t) (address - back)];
+    if(entry->length > back) {
+      entry->length = 0;
+    }
+  }
+#endif
+}
+#endif
+
+#if defined(PREDECODE_CACHE) || defined(BLOCK_CACHE)
+/* Function to keep the decoded ops or blocks in step with a write
+  Input: state8080 struct, address that was written to
+  Output: void
+  Called by WRITE_BYTE after every store. Writes to ROM pages land in
+  romSink, see mapMemory, and don't change any code, so only writable
+  pages are checked. The byte is checked at every address it shows up
+  at, through mirrors of its page as well.
+*/
+void codeWritten(state8080* state, uint16_t address) {
+  uint8_t page = address >> 8;
+  uint8_t alias = page;
+  if(state->writePages[page] == state->romSink) {
+    return;
+  }
+  do {
+    uint16_t aliasAddress = (alias << 8) | (address & 0xff);
+#ifdef PREDECODE_CACHE
+    invalidateDecoded(state, aliasAddress);
+#endif
+#ifdef BLOCK_CACHE
+    if(state->blockCache->codeMap[aliasAddress]) {
+      flushBlocks(state);
+    }
+#endif
+    alias = state->pageAliases[alias];
+  } while(alias != page);
+}
+#endif
+
 /* Function to control writes to state memory
   Input: state8080 struct, value to write, address to write to
   Output: void
-  Does not write if the address is in the first 2k of memory
-  Fails if address is out of memory range
+  Writes to ROM pages land in romSink, see mapMemory
 */
 void writeToMemory(state8080* state, uint8_t value, uint8_t topBits, uint8_t botBits) {
   uint16_t address = (topBits << 8) | botBits;
-  if(address <= 2000) {
-    printf("This is ROM. Can't write here.");
-  } else if(address >= 0x10000) {
-    printf("Address out of bounds.");
-    exit(1);
-  } else {
-    state->memory[address] = value;
-  }
+  WRITE_BYTE(address, value);
 }
 
 /*  Function to facilitate reads from memory
   Input: state8080 struct, address to read from memory
   Output: uint8_t value
-  Fails if address is out of memory range
 */
 uint8_t readFromMemory(state8080* state, uint8_t topBits, uint8_t botBits) {
-  uint16_t address = (topBits << 8) | botBits;
-  if(address >= 0x10000) {
-    printf("Address out of bounds.");
-    exit(1);
-  } else {
-    return state->memory[address];
+  return READ_BYTE((topBits << 8) | botBits);
+}
+
+/* Function to handle the IN op
+  Input: state8080 struct, port number
+  Output: uint8_t value read from the port
+  Leaves A unchanged if no inPort hook is set
+*/
+uint8_t readFromPort(state8080* state, uint8_t port) {
+  if(state->inPort == NULL) {
+    return state->a;
   }
+  return state->inPort(state, port);
 }
 
-/* Code implementation of the 8080 op codes
-  Input: state8080 Struct
+/* Function to handle the OUT op
+  Input: state8080 struct, port number, value to write
   Output: void
+  Does nothing if no outPort hook is set
+*/
+void writeToPort(state8080* state, uint8_t port, uint8_t value) {
+  if(state->outPort != NULL) {
+    state->outPort(state, port, value);
+  }
+}
+
+#ifdef JIT_RECOMPILER
+#include"jitX86.c"
+#endif
+#ifdef WATCHPOINTS
+#include"watchpoints.c"
+#endif
+
+#ifdef AOT_BLOCKS
+/* Struct for one block compiled ahead of time by recompiler.c
+  hash covers the guest bytes of the block, so the code is only used
+  while memory still holds what it was compiled from
+*/
+typedef struct aotBlock {
+  uint16_t start;
+  uint16_t end;
+  uint32_t hash;
+  aotFunction code;
+} aotBlock;
+
+/* Helper function to hash guest code
+  Input: state8080 struct, first address, address after the last byte
+  Output: FNV-1a hash of the bytes, matching the one in recompiler.c
+*/
+uint32_t hashGuestCode(state8080* state, uint16_t start, uint16_t end) {
+  uint32_t hash = 2166136261u;
+  uint16_t address;
+  for(address = start; address != end; address++) {
+    hash = (hash ^ READ_BYTE(address)) * 16777619u;
+  }
+  return hash;
+}
+
+// Generated by recompiler.c, defines aotBlocks sorted by start address
+#include"aotBlocks.c"
+
+/* Function to find the compiled code for a translated block
+  Input: state8080 struct, block
+  Output: compiled code, or NULL if the block wasn't compiled or the
+    code in memory has changed since
+*/
+aotFunction findAotBlock(state8080* state, codeBlock* block) {
+  int low = 0;
+  int high = NUM_AOT_BLOCKS - 1;
+  while(low <= high) {
+    int mid = (low + high) / 2;
+    const aotBlock *candidate = &aotBlocks[mid];
+    if(candidate->start < block->start) {
+      low = mid + 1;
+    } else if(candidate->start > block->start) {
+      high = mid - 1;
+    } else if(candidate->end == block->end &&
+        candidate->hash == hashGuestCode(state, block->start, block->end)) {
+      return candidate->code;
+    } else {
+      return NULL;
+    }
+  }
+  return NULL;
+}
+#endif
+
+/* Build time selection of the dispatch engine
+  By default emulateOps decodes through one switch statement.
+  Define THREADED_DISPATCH to use a computed goto table instead, where
+  each handler jumps straight to the handler of the next op code.
+  Define PREDECODE_CACHE to fetch ops and their immediate data from
+  the per-address decode cache instead of memory.
+  Define BLOCK_CACHE to run translated basic blocks, with cycles
+  counted and the budget checked once per block.
+  Define JIT_RECOMPILER as well to run hot blocks as native x86-64 code,
+  or AOT_BLOCKS to run the blocks recompiler.c turned into C.
+  Define IDLE_LOOP_SKIP as well to stop running a block that spins
+  waiting for an interrupt, and count the rest of the budget as used.
+  All engines share the handler code below.
+*/
+#if defined(PREDECODE_CACHE) && defined(BLOCK_CACHE)
+#error "PREDECODE_CACHE and BLOCK_CACHE can't be used together"
+#endif
+#if defined(JIT_RECOMPILER) && !defined(BLOCK_CACHE)
+#error "JIT_RECOMPILER needs BLOCK_CACHE"
+#endif
+#if defined(IDLE_LOOP_SKIP) && !defined(BLOCK_CACHE)
+#error "IDLE_LOOP_SKIP needs BLOCK_CACHE"
+#endif
+#if defined(AOT_BLOCKS) && (!defined(BLOCK_CACHE) || defined(JIT_RECOMPILER))
+#error "AOT_BLOCKS needs BLOCK_CACHE and can't be used with JIT_RECOMPILER"
+#endif
+#if defined(FUSE_OPS) && !(defined(THREADED_DISPATCH) && defined(PREDECODE_CACHE))
+#error "FUSE_OPS needs THREADED_DISPATCH and PREDECODE_CACHE"
+#endif
+
+#if defined(PREDECODE_CACHE)
+#define FETCH_OP() \
+  entry = &state->decodeCache[state->pc]; \
+  if(entry->length == 0) { \
+    decodeOp(state, state->pc, entry); \
+    DECODE_HANDLER(entry); \
+    FUSE_HANDLER(entry); \
+  }
+#define FINISH_OP() \
+  state->pc += 1; \
+  cyclesRun += cycles[entry->opCode]; \
+  if(cyclesRun >= cycleBudget) return cyclesRun
+#elif defined(BLOCK_CACHE)
+#define FETCH_OP() \
+  while(entry == blockEnd) { \
+    if(block != NULL && cyclesRun >= cycleBudget) return cyclesRun; \
+    SKIP_IDLE_LOOP(); \
+    block = nextBlock(state, block); \
+    if(!block->prepared) { \
+      for(entry = block->ops; entry < block->ops + block->numOps; entry++) { \
+        DECODE_HANDLER(entry); \
+      } \
+      PREPARE_COMPILED_BLOCK(); \
+      block->prepared = 1; \
+    } \
+    cyclesRun += block->cycles; \
+    entry = block->ops; \
+    blockEnd = block->ops + block->numOps; \
+    RUN_COMPILED_BLOCK(); \
+  }
+#define FINISH_OP() \
+  state->pc += 1; \
+  entry++; \
+  SKIP_FLUSHED_OPS()
+// A store flushed the running block, so its ops after entry may be
+// stale. Stop at entry, taking back the cycles counted for the rest.
+#define SKIP_FLUSHED_OPS() \
+  if(state->blockCache->numBlocks == 0) { \
+    for(; entry < blockEnd; entry++) cyclesRun -= cycles[entry->opCode]; \
+  }
+#ifdef JIT_RECOMPILER
+#define RUN_COMPILED_BLOCK() \
+  if(block->jitCode != NULL || \
+      (++block->runs == JIT_HOT_RUNS && jitCompileBlock(state, block))) { \
+    entry += runCompiledBlock(state, block); \
+    SKIP_FLUSHED_OPS(); \
+    if(block->jitUsesPorts) cycleBudget = 0; \
+  }
+#define PREPARE_COMPILED_BLOCK()
+#elif defined(AOT_BLOCKS)
+#define RUN_COMPILED_BLOCK() \
+  if(block->aotCode != NULL) { \
+    int aotResult = block->aotCode(state); \
+    if(aotResult & AOT_END_RUN) cycleBudget = 0; \
+    entry = blockEnd; \
+    if(aotResult & AOT_STOPPED) { \
+      entry = block->ops + opsBefore(block, state->pc); \
+      SKIP_FLUSHED_OPS(); \
+    } \
+  }
+#define PREPARE_COMPILED_BLOCK() block->aotCode = findAotBlock(state, block)
+#else
+#define RUN_COMPILED_BLOCK()
+#define PREPARE_COMPILED_BLOCK()
+#endif
+#ifdef IDLE_LOOP_SKIP
+// Count the rest of the budget as spent looping, whole blocks at a time
+#define SKIP_IDLE_LOOP() \
+  if(block != NULL && block->idleLoop && state->pc == block->start) { \
+    cyclesRun += (cycleBudget - cyclesRun + block->cycles - 1) / block->cycles * block->cycles; \
+    return cyclesRun; \
+  }
+#else
+#define SKIP_IDLE_LOOP()
+#endif
+#else
+#define FETCH_OP() \
+  opCode[0] = FETCH_BYTE(state->pc); \
+  opCode[1] = FETCH_BYTE(state->pc + 1); \
+  opCode[2] = FETCH_BYTE(state->pc + 2)
+#define FINISH_OP() \
+  state->pc += 1; \
+  cyclesRun += cycles[*opCode]; \
+  if(cyclesRun >= cycleBudget) return cyclesRun
+#endif
+
+#if defined(PREDECODE_CACHE) || defined(BLOCK_CACHE)
+#define CURRENT_OP (entry->opCode)
+#define DATA8 (entry->operand & 0xff)
+#define DATA_HI (entry->operand >> 8)
+#define DATA16 (entry->operand)
+#else
+#define CURRENT_OP (*opCode)
+#define DATA8 (opCode[1])
+#define DATA_HI (opCode[2])
+#define DATA16 ((opCode[2] << 8) | opCode[1])
+#endif
+
+#ifdef THREADED_DISPATCH
+#ifndef __GNUC__
+#error "THREADED_DISPATCH needs the GCC/Clang labels as values extension"
+#endif
+#if defined(PREDECODE_CACHE) || defined(BLOCK_CACHE)
+#define DECODE_HANDLER(decoded) (decoded)->handler = dispatchTable[(decoded)->opCode]
+#define JUMP_OP() goto *entry->handler
+#else
+#define JUMP_OP() goto *dispatchTable[*opCode]
+#endif
+#define OPCODE(code) op_##code
+#define NEXT_OP do { PROFILE_OP(); FINISH_OP(); FETCH_OP(); JUMP_OP(); } while(0)
+#define BEGIN_DISPATCH FETCH_OP(); JUMP_OP();
+#define END_DISPATCH
+#else
+#define DECODE_HANDLER(decoded)
+#define OPCODE(code) case code
+#define NEXT_OP break
+#define BEGIN_DISPATCH for(;;) { FETCH_OP(); switch(CURRENT_OP) {
+#define END_DISPATCH } PROFILE_OP(); FINISH_OP(); }
+#endif
+
+#ifdef FUSE_OPS
+#define FUSE_HANDLER(decoded) fuseOps(state, (decoded), fusedHandlers)
+#else
+#define FUSE_HANDLER(decoded)
+#endif
+#ifdef PROFILE_OPCODES
+#define PROFILE_OP() profileOp(CURRENT_OP)
+#else
+#define PROFILE_OP()
+#endif
+
+/* Bodies of the ops that can be part of a fused sequence
+  Shared by the single op handlers and the ones fusedOps.c generates
+*/
+#define DCR_BODY(reg) { \
+    uint16_t val = (uint16_t) state->reg - 1; \
+    setZSP(state, val); \
+    state->reg = val & 0xff; \
+  }
+#define BODY_0x02 writeToMemory(state, state->a, state->b, state->c) // STAX B
+#define BODY_0x03 state->bc += 1 // INX B
+#define BODY_0x05 DCR_BODY(b) // DCR B
+#define BODY_0x0a state->a = readFromMemory(state, state->b, state->c) // LDAX B
+#define BODY_0x0b state->bc -= 1 // DCX B
+#define BODY_0x0d DCR_BODY(c) // DCR C
+#define BODY_0x12 writeToMemory(state, state->a, state->d, state->e) // STAX D
+#define BODY_0x13 state->de += 1 // INX D
+#define BODY_0x15 DCR_BODY(d) // DCR D
+#define BODY_0x1a state->a = readFromMemory(state, state->d, state->e) // LDAX D
+#define BODY_0x1b state->de -= 1 // DCX D
+#define BODY_0x1d DCR_BODY(e) // DCR E
+#define BODY_0x23 state->hl += 1 // INX H
+#define BODY_0x25 DCR_BODY(h) // DCR H
+#define BODY_0x2b state->hl -= 1 // DCX H
+#define BODY_0x2d DCR_BODY(l) // DCR L
+#define BODY_0x3d DCR_BODY(a) // DCR A
+#define BODY_0x77 writeToMemory(state, state->a, state->h, state->l) // MOV M,A
+#define BODY_0x7e state->a = readFromMemory(state, state->h, state->l) // MOV A,M
+#define BODY_0xc2 \
+  if(getZero(state) == 0) { \
+    state->pc = DATA16; \
+  } else { \
+    state->pc += 2; \
+  } // JNZ adr
+#define BODY_0xca \
+  if(getZero(state) == 1) { \
+    state->pc = DATA16; \
+  } else { \
+    state->pc += 2; \
+  } // JZ adr
+
+/* Code implementation of the 8080 op codes
+  Input: state8080 Struct, number of cycles to run for
+  Output: number of cycles actually run
+  Runs ops until the cycle budget is used up, always at least one
+  With BLOCK_CACHE whole blocks are run, so the budget can overrun
+  IN, OUT and EI end the run early so runCycles can check for
+  interrupts and stop requests
   Changes fields in state8080 struct
   TODO: Debug and refactor with helper functions
 */
-int emulateOp(state8080* state) {
-  unsigned char *opCode = &state->memory[state->pc];
-  switch(*opCode) {
-    case 0x00:
-    case 0x08:
-    case 0x10:
-    case 0x18:
-    case 0x20:
-    case 0x28:
-    case 0x30:
-    case 0x38:
-    case 0xcb:
-    case 0xd9:
-    case 0xdd:
-    case 0xed:
-    case 0xfd:
-      break; // NOP
+int emulateOps(state8080* state, int cycleBudget) {
+#if defined(PREDECODE_CACHE)
+  decodedOp *entry;
+#elif defined(BLOCK_CACHE)
+  codeBlock *block = NULL;
+  decodedOp *entry = NULL;
+  decodedOp *blockEnd = NULL;
+#else
+  unsigned char opCode[3]; // Op code and operand bytes, read through the memory map
+#endif
+#ifdef FUSE_OPS
+  decodedOp *fusedHead; // First op of the fused sequence running
+  static void *fusedHandlers[NUM_FUSED] = {
+    FUSED_OPS(FUSED_LABEL2, FUSED_LABEL3)
+  };
+#endif
+  int cyclesRun = 0;
+#ifdef THREADED_DISPATCH
+  static void *dispatchTable[256] = {
+    &&op_0x00, &&op_0x01, &&op_0x02, &&op_0x03, &&op_0x04, &&op_0x05, &&op_0x06, &&op_0x07,
+    &&op_0x08, &&op_0x09, &&op_0x0a, &&op_0x0b, &&op_0x0c, &&op_0x0d, &&op_0x0e, &&op_0x0f,
+    &&op_0x10, &&op_0x11, &&op_0x12, &&op_0x13, &&op_0x14, &&op_0x15, &&op_0x16, &&op_0x17,
+    &&op_0x18, &&op_0x19, &&op_0x1a, &&op_0x1b, &&op_0x1c, &&op_0x1d, &&op_0x1e, &&op_0x1f,
+    &&op_0x20, &&op_0x21, &&op_0x22, &&op_0x23, &&op_0x24, &&op_0x25, &&op_0x26, &&op_0x27,
+    &&op_0x28, &&op_0x29, &&op_0x2a, &&op_0x2b, &&op_0x2c, &&op_0x2d, &&op_0x2e, &&op_0x2f,
+    &&op_0x30, &&op_0x31, &&op_0x32, &&op_0x33, &&op_0x34, &&op_0x35, &&op_0x36, &&op_0x37,
+    &&op_0x38, &&op_0x39, &&op_0x3a, &&op_0x3b, &&op_0x3c, &&op_0x3d, &&op_0x3e, &&op_0x3f,
+    &&op_0x40, &&op_0x41, &&op_0x42, &&op_0x43, &&op_0x44, &&op_0x45, &&op_0x46, &&op_0x47,
+    &&op_0x48, &&op_0x49, &&op_0x4a, &&op_0x4b, &&op_0x4c, &&op_0x4d, &&op_0x4e, &&op_0x4f,
+    &&op_0x50, &&op_0x51, &&op_0x52, &&op_0x53, &&op_0x54, &&op_0x55, &&op_0x56, &&op_0x57,
+    &&op_0x58, &&op_0x59, &&op_0x5a, &&op_0x5b, &&op_0x5c, &&op_0x5d, &&op_0x5e, &&op_0x5f,
+    &&op_0x60, &&op_0x61, &&op_0x62, &&op_0x63, &&op_0x64, &&op_0x65, &&op_0x66, &&op_0x67,
+    &&op_0x68, &&op_0x69, &&op_0x6a, &&op_0x6b, &&op_0x6c, &&op_0x6d, &&op_0x6e, &&op_0x6f,
+    &&op_0x70, &&op_0x71, &&op_0x72, &&op_0x73, &&op_0x74, &&op_0x75, &&op_0x76, &&op_0x77,
+    &&op_0x78, &&op_0x79, &&op_0x7a, &&op_0x7b, &&op_0x7c, &&op_0x7d, &&op_0x7e, &&op_0x7f,
+    &&op_0x80, &&op_0x81, &&op_0x82, &&op_0x83, &&op_0x84, &&op_0x85, &&op_0x86, &&op_0x87,
+    &&op_0x88, &&op_0x89, &&op_0x8a, &&op_0x8b, &&op_0x8c, &&op_0x8d, &&op_0x8e, &&op_0x8f,
+    &&op_0x90, &&op_0x91, &&op_0x92, &&op_0x93, &&op_0x94, &&op_0x95, &&op_0x96, &&op_0x97,
+    &&op_0x98, &&op_0x99, &&op_0x9a, &&op_0x9b, &&op_0x9c, &&op_0x9d, &&op_0x9e, &&op_0x9f,
+    &&op_0xa0, &&op_0xa1, &&op_0xa2, &&op_0xa3, &&op_0xa4, &&op_0xa5, &&op_0xa6, &&op_0xa7,
+    &&op_0xa8, &&op_0xa9, &&op_0xaa, &&op_0xab, &&op_0xac, &&op_0xad, &&op_0xae, &&op_0xaf,
+    &&op_0xb0, &&op_0xb1, &&op_0xb2, &&op_0xb3, &&op_0xb4, &&op_0xb5, &&op_0xb6, &&op_0xb7,
+    &&op_0xb8, &&op_0xb9, &&op_0xba, &&op_0xbb, &&op_0xbc, &&op_0xbd, &&op_0xbe, &&op_0xbf,
+    &&op_0xc0, &&op_0xc1, &&op_0xc2, &&op_0xc3, &&op_0xc4, &&op_0xc5, &&op_0xc6, &&op_0xc7,
+    &&op_0xc8, &&op_0xc9, &&op_0xca, &&op_0xcb, &&op_0xcc, &&op_0xcd, &&op_0xce, &&op_0xcf,
+    &&op_0xd0, &&op_0xd1, &&op_0xd2, &&op_0xd3, &&op_0xd4, &&op_0xd5, &&op_0xd6, &&op_0xd7,
+    &&op_0xd8, &&op_0xd9, &&op_0xda, &&op_0xdb, &&op_0xdc, &&op_0xdd, &&op_0xde, &&op_0xdf,
+    &&op_0xe0, &&op_0xe1, &&op_0xe2, &&op_0xe3, &&op_0xe4, &&op_0xe5, &&op_0xe6, &&op_0xe7,
+    &&op_0xe8, &&op_0xe9, &&op_0xea, &&op_0xeb, &&op_0xec, &&op_0xed, &&op_0xee, &&op_0xef,
+    &&op_0xf0, &&op_0xf1, &&op_0xf2, &&op_0xf3, &&op_0xf4, &&op_0xf5, &&op_0xf6, &&op_0xf7,
+    &&op_0xf8, &&op_0xf9, &&op_0xfa, &&op_0xfb, &&op_0xfc, &&op_0xfd, &&op_0xfe, &&op_0xff
+  };
+#endif
+
+  BEGIN_DISPATCH
+    OPCODE(0x00):
+    OPCODE(0x08):
+    OPCODE(0x10):
+    OPCODE(0x18):
+    OPCODE(0x20):
+    OPCODE(0x28):
+    OPCODE(0x30):
+    OPCODE(0x38):
+    OPCODE(0xcb):
+    OPCODE(0xd9):
+    OPCODE(0xdd):
+    OPCODE(0xed):
+    OPCODE(0xfd):
+      NEXT_OP; // NOP
 
     // Register Manipulation
-    case 0x01:
-      state->c = opCode[1];
-      state->b = opCode[2];
-      state->pc +=2;
-      break; // LXI B,D1
+    OPCODE(0x01):
+      state->bc = DATA16;
+      state->pc += 2;
+      NEXT_OP; // LXI B,D1
 
     // TODO: Review STAX B in data book
-    case 0x02:
-      writeToMemory(state, state->a, state->b, state->c);
-      break; // STAX B
-
-    case 0x03: {
-      // Put BC into one value
-      uint16_t combined = (state->b << 8) | state->c;
-      // Increment by 1
-      combined += 1;
-      // Replace c with new value, masking top bits
-      state->c = combined & 0xff;
-      // Replace b with the shifted value
-      state->b = (combined >> 8) & 0xff;
-      break; // INX B
-    }
-
-    case 0x04: {
+    OPCODE(0x02): BODY_0x02; NEXT_OP; // STAX B
+
+    OPCODE(0x03): BODY_0x03; NEXT_OP; // INX B
+
+    OPCODE(0x04): {
       uint16_t val = (uint16_t) state->b + 1;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.p = parity(val & 0xff);
+      setZSP(state, val);
       state->b = val & 0xff;
-      break; // INR B
+      NEXT_OP; // INR B
     }
 
-    case 0x05: {
-      uint16_t val = (uint16_t) state->b - 1;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.p = parity(val & 0xff);
-      state->b = val & 0xff;
-      break; // DCR B
-    }
+    OPCODE(0x05): BODY_0x05; NEXT_OP; // DCR B
 
-    case 0x06:
-      state->b = opCode[1];
+    OPCODE(0x06):
+      state->b = DATA8;
       state->pc += 1;
-      break; // MVI B,D8
+      NEXT_OP; // MVI B,D8
 
-    case 0x07: {
+    OPCODE(0x07): {
       uint8_t leftMost = (state->a >> 7) & 0x01;
       state->a = (state->a << 1) | leftMost;
-      state->cc.cy = leftMost;
-      break; // RLC
+      setCarry(state, leftMost);
+      NEXT_OP; // RLC
     }
 
-    case 0x09: {
-      uint16_t hl = (state->h << 8) | state->l;
-      uint16_t bc = (state->b << 8) | state->c;
-      uint32_t total = hl + bc;
+    OPCODE(0x09): {
+      uint32_t total = state->hl + state->bc;
       if(total > 0xffff) {
-        state->cc.cy = 1;
+        setCarry(state, 1);
       } else {
-        state->cc.cy = 0;
+        setCarry(state, 0);
       }
-      state->h = (total >> 8) & 0xff;
-      state->l = total & 0xff;
-      break; // DAD B
+      state->hl = total & 0xffff;
+      NEXT_OP; // DAD B
     }
 
-    case 0x0a:
-      state->a = readFromMemory(state, state->b, state->c);
-      break; // LDAX B
+    OPCODE(0x0a): BODY_0x0a; NEXT_OP; // LDAX B
 
-    case 0x0b: {
-      // Put BC into one value
-      uint16_t combined = (state->b << 8) | state->c;
-      // Decrement by 1
-      combined -= 1;
-      // Replace c with new value, masking top bits
-      state->c = combined & 0xff;
-      // Replace b with the shifted value
-      state->b = (combined >> 8) & 0xff;
-      break; // DCX B
-    }
+    OPCODE(0x0b): BODY_0x0b; NEXT_OP; // DCX B
 
-    case 0x0c: {
+    OPCODE(0x0c): {
       uint16_t val = (uint16_t) state->c + 1;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.p = parity(val & 0xff);
+      setZSP(state, val);
       state->c = val & 0xff;
-      break; // INR C
+      NEXT_OP; // INR C
     }
 
-    case 0x0d: {
-      uint16_t val = (uint16_t) state->c - 1;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.p = parity(val & 0xff);
-      state->c = val & 0xff;;
-      break; // DCR C
-    }
+    OPCODE(0x0d): BODY_0x0d; NEXT_OP; // DCR C
 
-    case 0x0e:
-      state->c = opCode[1];
+    OPCODE(0x0e):
+      state->c = DATA8;
       state->pc += 1;
-      break; // MVI C,D8
+      NEXT_OP; // MVI C,D8
 
-    case 0x0f: {
+    OPCODE(0x0f): {
       uint8_t rightMost = state->a & 0x01;
       state->a = (state->a >> 1) | (rightMost << 7);
-      state->cc.cy = rightMost;
-      break; // RRC
+      setCarry(state, rightMost);
+      NEXT_OP; // RRC
     }
 
-    case 0x11:
-      state->e = opCode[1];
-      state->d = opCode[2];
+    OPCODE(0x11):
+      state->de = DATA16;
       state->pc += 2;
-      break; // LXI D,D16
+      NEXT_OP; // LXI D,D16
 
-    case 0x12:
-      writeToMemory(state, state->a, state->d, state->e);
-      break; // STAX D
+    OPCODE(0x12): BODY_0x12; NEXT_OP; // STAX D
 
-    case 0x13: {
-      uint16_t combined = (state->d << 8) | state->e;
-      combined += 1;
-      state->e = combined & 0xff;
-      state->d = (combined >> 8) & 0xff;
-      break; // INX D
-    }
+    OPCODE(0x13): BODY_0x13; NEXT_OP; // INX D
 
-    case 0x14: {
+    OPCODE(0x14): {
       uint16_t val = (uint16_t) state->d + 1;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.p = parity(val & 0xff);
+      setZSP(state, val);
       state->d = val & 0xff;
-      break; // INR D
+      NEXT_OP; // INR D
     }
 
-    case 0x15: {
-      uint16_t val = (uint16_t) state->d - 1;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.p = parity(val & 0xff);
-      state->d = val & 0xff;
-      break; // DCR D
-    }
+    OPCODE(0x15): BODY_0x15; NEXT_OP; // DCR D
 
-    case 0x16:
-      state->d = opCode[1];
+    OPCODE(0x16):
+      state->d = DATA8;
       state->pc += 1;
-      break; // MVI D,D8
+      NEXT_OP; // MVI D,D8
 
-    case 0x17: {
+    OPCODE(0x17): {
       uint8_t leftMost = (state->a >> 7) & 0x01;
-      state->a = (state->a << 1) | state->cc.cy;
-      state->cc.cy = leftMost;
-      break; // RAL
+      state->a = (state->a << 1) | getCarry(state);
+      setCarry(state, leftMost);
+      NEXT_OP; // RAL
     }
 
-    case 0x19: {
-      uint16_t hl = (state->h << 8) | state->l;
-      uint16_t de = (state->d << 8) | state->e;
-      uint32_t total = hl + de;
+    OPCODE(0x19): {
+      uint32_t total = state->hl + state->de;
       if(total > 0xffff) {
-        state->cc.cy = 1;
+        setCarry(state, 1);
       } else {
-        state->cc.cy = 0;
+        setCarry(state, 0);
       }
-      state->h = (total >> 8) & 0xff;
-      state->l = total & 0xff;
-      break; // DAD D
+      state->hl = total & 0xffff;
+      NEXT_OP; // DAD D
     }
 
-    case 0x1a:
-      state->a = readFromMemory(state, state->d, state->e);
-      break; // LDAX D
+    OPCODE(0x1a): BODY_0x1a; NEXT_OP; // LDAX D
 
-    case 0x1b: {
-      uint16_t combined = (state->d << 8) | state->e;
-      combined -= 1;
-      state->e = combined & 0xff;
-      state->d = (combined >> 8) & 0xff;
-      break; // DCX D
-    }
+    OPCODE(0x1b): BODY_0x1b; NEXT_OP; // DCX D
 
-    case 0x1c: {
+    OPCODE(0x1c): {
       uint16_t val = (uint16_t) state->e + 1;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.p = parity(val & 0xff);
+      setZSP(state, val);
       state->e = val & 0xff;
-      break; // ICR E
+      NEXT_OP; // ICR E
     }
 
-    case 0x1d: {
-      uint16_t val = (uint16_t) state->e - 1;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.p = parity(val & 0xff);
-      state->e = val & 0xff;
-      break; // DCR E
-    }
+    OPCODE(0x1d): BODY_0x1d; NEXT_OP; // DCR E
 
-    case 0x1e:
-      state->e = opCode[1];
+    OPCODE(0x1e):
+      state->e = DATA8;
       state->pc += 1;
-      break; // MVI E,D8
+      NEXT_OP; // MVI E,D8
 
-    case 0x1f: {
+    OPCODE(0x1f): {
       uint8_t rightMost = state->a & 0x01;
       uint8_t leftMost = state->a & 0x80;
       state->a = (state->a >> 1) | leftMost;
-      state->cc.cy = rightMost;
-      break; // RAR
+      setCarry(state, rightMost);
+      NEXT_OP; // RAR
     }
 
-    case 0x21:
-      state->l = opCode[1];
-      state->h = opCode[2];
+    OPCODE(0x21):
+      state->hl = DATA16;
       state->pc += 2;
-      break; // LXIH,D16
+      NEXT_OP; // LXIH,D16
 
-    case 0x22:
-      state->memory[(opCode[2] << 8) | opCode[1]] = state->l;
-      state->memory[((opCode[2] << 8) | opCode[1]) + 1] = state->h;
+    OPCODE(0x22):
+      WRITE_BYTE(DATA16, state->l);
+      WRITE_BYTE(DATA16 + 1, state->h);
       state->pc += 2;
-      break; // SHLD adr
+      NEXT_OP; // SHLD adr
 
-    case 0x23: {
-      uint16_t combined = (state->h << 8) | state->l;
-      combined += 1;
-      state->l = combined & 0xff;
-      state->h = (combined >> 8) & 0xff;
-      break; // INX H
-    }
+    OPCODE(0x23): BODY_0x23; NEXT_OP; // INX H
 
-    case 0x24: {
+    OPCODE(0x24): {
       uint16_t val = (uint16_t) state->h + 1;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.p = parity(val & 0xff);
+      setZSP(state, val);
       state->h = val & 0xff;
-      break; // INR H
+      NEXT_OP; // INR H
     }
 
-    case 0x25: {
-      uint16_t val = (uint16_t) state->h - 1;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.p = parity(val & 0xff);
-      state->h = val & 0xff;
-      break; // DCR H
-    }
+    OPCODE(0x25): BODY_0x25; NEXT_OP; // DCR H
 
-    case 0x26:
-      state->h = opCode[1];
+    OPCODE(0x26):
+      state->h = DATA8;
       state->pc += 1;
-      break; // MVI L,D8
+      NEXT_OP; // MVI L,D8
 
-    case 0x27: unimplementedInstruction(state); break; // DAA
+    OPCODE(0x27): unimplementedInstruction(state); NEXT_OP; // DAA
 
-    case 0x29: {
-      uint16_t hl = (state->h << 8) | state->l;
-      uint32_t total = hl + hl;
+    OPCODE(0x29): {
+      uint32_t total = state->hl + state->hl;
       if(total > 0xffff) {
-        state->cc.cy = 1;
+        setCarry(state, 1);
       } else {
-        state->cc.cy = 0;
+        setCarry(state, 0);
       }
-      state->h = (total >> 8) & 0xff;
-      state->l = total & 0xff;
-      break; // DAD H
+      state->hl = total & 0xffff;
+      NEXT_OP; // DAD H
     }
 
-    case 0x2a:
-      state->l = state->memory[(opCode[2] << 8) | opCode[1]];
-      state->h = state->memory[((opCode[2] << 8) | opCode[1]) + 1];
+    OPCODE(0x2a):
+      state->l = READ_BYTE(DATA16);
+      state->h = READ_BYTE(DATA16 + 1);
       state->pc += 2;
-      break; // LHLD adr
+      NEXT_OP; // LHLD adr
 
-    case 0x2b: {
-      uint16_t combined = (state->h << 8) | state->l;
-      combined -= 1;
-      state->l = combined & 0xff;
-      state->h = (combined >> 8) & 0xff;
-      break; // DCX H
-    }
+    OPCODE(0x2b): BODY_0x2b; NEXT_OP; // DCX H
 
-    case 0x2c: {
+    OPCODE(0x2c): {
       uint16_t val = (uint16_t) state->l + 1;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.p = parity(val & 0xff);
+      setZSP(state, val);
       state->l = val & 0xff;
-      break; // INR L
+      NEXT_OP; // INR L
     }
 
-    case 0x2d: {
-      uint16_t val = (uint16_t) state->l - 1;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.p = parity(val & 0xff);
-      state->l = val & 0xff;
-      break; // DCR L
-    }
+    OPCODE(0x2d): BODY_0x2d; NEXT_OP; // DCR L
 
-    case 0x2e:
-      state->l = opCode[1];
+    OPCODE(0x2e):
+      state->l = DATA8;
       state->pc += 1;
-      break; // MVI L,D8
+      NEXT_OP; // MVI L,D8
 
-    case 0x2f:
+    OPCODE(0x2f):
       state->a = ~(state->a);
-      break; // CMA
+      NEXT_OP; // CMA
 
-    case 0x31:
-      state->sp = (opCode[2] << 8) | opCode[1];
+    OPCODE(0x31):
+      state->sp = DATA16;
       state->pc += 2;
-      break; // LXI SP,D16
+      NEXT_OP; // LXI SP,D16
 
-    case 0x32:
-      writeToMemory(state, state->a, opCode[2], opCode[1]);
+    OPCODE(0x32):
+      writeToMemory(state, state->a, DATA_HI, DATA8);
       state->pc += 2;
-      break; // STA adr
+      NEXT_OP; // STA adr
 
-    case 0x33:
+    OPCODE(0x33):
       state->sp += 1;
-      break; // INX SP
+      NEXT_OP; // INX SP
 
-    case 0x34: {
-      uint16_t val = state->memory[(state->h << 8) | state->l] + 1;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.p = parity(val & 0xff);
-      state->memory[(state->h << 8) | state->l] += 1;
-      break; // INR M
+    OPCODE(0x34): {
+      uint16_t val = READ_BYTE(state->hl) + 1;
+      setZSP(state, val);
+      WRITE_BYTE(state->hl, val & 0xff);
+      NEXT_OP; // INR M
     }
 
-    case 0x35: {
-      uint16_t val = state->memory[(state->h << 8) | state->l] - 1;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.p = parity(val & 0xff);
-      state->memory[(state->h << 8) | state->l] -= 1;
-      break; // DCR M
+    OPCODE(0x35): {
+      uint16_t val = READ_BYTE(state->hl) - 1;
+      setZSP(state, val);
+      WRITE_BYTE(state->hl, val & 0xff);
+      NEXT_OP; // DCR M
     }
 
-    case 0x36:
-      writeToMemory(state, opCode[1], state->h, state->l);
+    OPCODE(0x36):
+      writeToMemory(state, DATA8, state->h, state->l);
       state->pc += 1;
-      break; // MVI M,D8
+      NEXT_OP; // MVI M,D8
 
-    case 0x37:
-      state->cc.cy = 1;
-      break; // STC
+    OPCODE(0x37):
+      setCarry(state, 1);
+      NEXT_OP; // STC
 
-    case 0x39: {
-      uint32_t val = ((state->h << 8) | state->l) + state->sp;
+    OPCODE(0x39): {
+      uint32_t val = state->hl + state->sp;
       if(val > 0xffff){
-        state->cc.cy = 1;
+        setCarry(state, 1);
       }
-      state->h = (val >> 8) & 0xff;
-      state->l = val & 0xff;
-      break; // DAD SP
+      state->hl = val & 0xffff;
+      NEXT_OP; // DAD SP
     }
 
-    case 0x3a:
-      state->a readFromMemory(state, opCode[2], opCode[1]);
+    OPCODE(0x3a):
+      state->a = readFromMemory(state, DATA_HI, DATA8);
       state->pc += 2;
-      break; // LDA adr
+      NEXT_OP; // LDA adr
 
-    case 0x3b:
+    OPCODE(0x3b):
       state->sp -= 1;
-      break; // DCX SP
+      NEXT_OP; // DCX SP
 
-    case 0x3c: {
+    OPCODE(0x3c): {
       uint16_t val = (uint16_t) state->a + 1;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.p = parity(val & 0xff);
+      setZSP(state, val);
       state->a = val & 0xff;
-      break; // INR A
+      NEXT_OP; // INR A
     }
 
-    case 0x3d: {
-      uint16_t val = (uint16_t) state->a - 1;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.p = parity(val & 0xff);
-      state->a = val & 0xff;
-      break; // DCR A
-    }
+    OPCODE(0x3d): BODY_0x3d; NEXT_OP; // DCR A
 
-    case 0x3e:
-      state->a = opCode[1];
+    OPCODE(0x3e):
+      state->a = DATA8;
       state->pc += 1;
-      break; // MVI A,D8
+      NEXT_OP; // MVI A,D8
 
-    case 0x3f:
-      state->cc.cy = ~(state->cc.cy);
-      break; // CMC
+    OPCODE(0x3f):
+      setCarry(state, getCarry(state) ^ 1);
+      NEXT_OP; // CMC
 
     // Data Transfer Operations
-    case 0x40: state->b = state->b; break; // MOV B,B
+    OPCODE(0x40): state->b = state->b; NEXT_OP; // MOV B,B
 
-    case 0x41: state->b = state->c; break; // MOV B,C
+    OPCODE(0x41): state->b = state->c; NEXT_OP; // MOV B,C
 
-    case 0x42: state->b = state->d; break; // MOV B,D
+    OPCODE(0x42): state->b = state->d; NEXT_OP; // MOV B,D
 
-    case 0x43: state->b = state->e; break; // MOV B,E
+    OPCODE(0x43): state->b = state->e; NEXT_OP; // MOV B,E
 
-    case 0x44: state->b = state->h; break; // MOV B,H
+    OPCODE(0x44): state->b = state->h; NEXT_OP; // MOV B,H
 
-    case 0x45: state->b = state->l; break; // MOV B,L
+    OPCODE(0x45): state->b = state->l; NEXT_OP; // MOV B,L
 
-    case 0x46:
+    OPCODE(0x46):
       state->b = readFromMemory(state, state->h, state->l);
-      break; // MOV B,M
+      NEXT_OP; // MOV B,M
 
-    case 0x47: state->b = state->a; break; // MOV B,A
+    OPCODE(0x47): state->b = state->a; NEXT_OP; // MOV B,A
 
-    case 0x48: state->c = state->b; break;
+    OPCODE(0x48): state->c = state->b; NEXT_OP;
 
-    case 0x49: state->c = state->c; break;
+    OPCODE(0x49): state->c = state->c; NEXT_OP;
 
-    case 0x4a: state->c = state->d; break;
+    OPCODE(0x4a): state->c = state->d; NEXT_OP;
 
-    case 0x4b: state->c = state->e; break;
+    OPCODE(0x4b): state->c = state->e; NEXT_OP;
 
-    case 0x4c: state->c = state->h; break;
+    OPCODE(0x4c): state->c = state->h; NEXT_OP;
 
-    case 0x4d: state->c = state->l; break;
+    OPCODE(0x4d): state->c = state->l; NEXT_OP;
 
-    case 0x4e:
+    OPCODE(0x4e):
       state->c = readFromMemory(state, state->h, state->l);
-      break; // MOV C,M
+      NEXT_OP; // MOV C,M
 
-    case 0x4f: state->c = state->a; break;
+    OPCODE(0x4f): state->c = state->a; NEXT_OP;
 
-    case 0x50: state->d = state->b; break;
+    OPCODE(0x50): state->d = state->b; NEXT_OP;
 
-    case 0x51: state->d = state->c; break;
+    OPCODE(0x51): state->d = state->c; NEXT_OP;
 
-    case 0x52: state->d = state->d; break;
+    OPCODE(0x52): state->d = state->d; NEXT_OP;
 
-    case 0x53: state->d = state->e; break;
+    OPCODE(0x53): state->d = state->e; NEXT_OP;
 
-    case 0x54: state->d = state->h; break;
+    OPCODE(0x54): state->d = state->h; NEXT_OP;
 
-    case 0x55: state->d = state->l; break;
+    OPCODE(0x55): state->d = state->l; NEXT_OP;
 
-    case 0x56:
+    OPCODE(0x56):
       state->d = readFromMemory(state, state->h, state->l);
-      break; // MOV D,M
+      NEXT_OP; // MOV D,M
 
-    case 0x57: state->d = state->a; break;
+    OPCODE(0x57): state->d = state->a; NEXT_OP;
 
-    case 0x58: state->e = state->b; break;
+    OPCODE(0x58): state->e = state->b; NEXT_OP;
 
-    case 0x59: state->e = state->c; break;
+    OPCODE(0x59): state->e = state->c; NEXT_OP;
 
-    case 0x5a: state->e = state->d; break;
+    OPCODE(0x5a): state->e = state->d; NEXT_OP;
 
-    case 0x5b: state->e = state->e; break;
+    OPCODE(0x5b): state->e = state->e; NEXT_OP;
 
-    case 0x5c: state->e = state->h; break;
+    OPCODE(0x5c): state->e = state->h; NEXT_OP;
 
-    case 0x5d: state->e = state->l; break;
+    OPCODE(0x5d): state->e = state->l; NEXT_OP;
 
-    case 0x5e:
+    OPCODE(0x5e):
       state->e = readFromMemory(state, state->h, state->l);
-      break; // MOV E,M
+      NEXT_OP; // MOV E,M
 
-    case 0x5f: state->e = state->a; break;
+    OPCODE(0x5f): state->e = state->a; NEXT_OP;
 
-    case 0x60: state->h = state->b; break;
+    OPCODE(0x60): state->h = state->b; NEXT_OP;
 
-    case 0x61: state->h = state->c; break;
+    OPCODE(0x61): state->h = state->c; NEXT_OP;
 
-    case 0x62: state->h = state->d; break;
+    OPCODE(0x62): state->h = state->d; NEXT_OP;
 
-    case 0x63: state->h = state->e; break;
+    OPCODE(0x63): state->h = state->e; NEXT_OP;
 
-    case 0x64: state->h = state->h; break;
+    OPCODE(0x64): state->h = state->h; NEXT_OP;
 
-    case 0x65: state->h = state->l; break;
+    OPCODE(0x65): state->h = state->l; NEXT_OP;
 
-    case 0x66:
+    OPCODE(0x66):
       state->h = readFromMemory(state, state->h, state->l);
-      break; // MOV H,M
+      NEXT_OP; // MOV H,M
 
-    case 0x67: state->h = state->a; break;
+    OPCODE(0x67): state->h = state->a; NEXT_OP;
 
-    case 0x68: state->l = state->b; break;
+    OPCODE(0x68): state->l = state->b; NEXT_OP;
 
-    case 0x69: state->l = state->c; break;
+    OPCODE(0x69): state->l = state->c; NEXT_OP;
 
-    case 0x6a: state->l = state->d; break;
+    OPCODE(0x6a): state->l = state->d; NEXT_OP;
 
-    case 0x6b: state->l = state->e; break;
+    OPCODE(0x6b): state->l = state->e; NEXT_OP;
 
-    case 0x6c: state->l = state->h; break;
+    OPCODE(0x6c): state->l = state->h; NEXT_OP;
 
-    case 0x6d: state->l = state->l; break;
+    OPCODE(0x6d): state->l = state->l; NEXT_OP;
 
-    case 0x6e:
+    OPCODE(0x6e):
       state->l = readFromMemory(state, state->h, state->l);
-      break; // MOV L,M
+      NEXT_OP; // MOV L,M
 
-    case 0x6f: state->l = state->a; break;
+    OPCODE(0x6f): state->l = state->a; NEXT_OP;
 
-    case 0x70:
+    OPCODE(0x70):
       writeToMemory(state, state->b, state->h, state->l);
-      break; // MOV M,B
+      NEXT_OP; // MOV M,B
 
-    case 0x71:
+    OPCODE(0x71):
       writeToMemory(state, state->c, state->h, state->l);
-      break; // MOV M,C
+      NEXT_OP; // MOV M,C
 
-    case 0x72:
+    OPCODE(0x72):
       writeToMemory(state, state->d, state->h, state->l);
-      break; // MOV M,D
+      NEXT_OP; // MOV M,D
 
-    case 0x73:
+    OPCODE(0x73):
       writeToMemory(state, state->e, state->h, state->l);
-      break; // MOV M,E
+      NEXT_OP; // MOV M,E
 
-    case 0x74:
+    OPCODE(0x74):
       writeToMemory(state, state->h, state->h, state->l);
-      break; // MOV M,H
+      NEXT_OP; // MOV M,H
 
-    case 0x75:
+    OPCODE(0x75):
       writeToMemory(state, state->l, state->h, state->l);
-      break; // MOV M,L
+      NEXT_OP; // MOV M,L
 
-    case 0x76: exit(0); break; // HLT
+    OPCODE(0x76): exit(0); NEXT_OP; // HLT
 
-    case 0x77:
-      writeToMemory(state, state->a, state->h, state->l);
-      break; // MOV M,A
+    OPCODE(0x77): BODY_0x77; NEXT_OP; // MOV M,A
 
-    case 0x78: state->a = state->b; break;
+    OPCODE(0x78): state->a = state->b; NEXT_OP;
 
-    case 0x79: state->a = state->c; break;
+    OPCODE(0x79): state->a = state->c; NEXT_OP;
 
-    case 0x7a: state->a = state->d; break;
+    OPCODE(0x7a): state->a = state->d; NEXT_OP;
 
-    case 0x7b: state->a = state->e; break;
+    OPCODE(0x7b): state->a = state->e; NEXT_OP;
 
-    case 0x7c: state->a = state->h; break;
+    OPCODE(0x7c): state->a = state->h; NEXT_OP;
 
-    case 0x7d: state->a = state->l; break;
+    OPCODE(0x7d): state->a = state->l; NEXT_OP;
 
-    case 0x7e:
-      state->a = readFromMemory(state, state->h, state->l);
-      break; // MOV A,M
+    OPCODE(0x7e): BODY_0x7e; NEXT_OP; // MOV A,M
 
-    case 0x7f: state->a = state->a; break;
+    OPCODE(0x7f): state->a = state->a; NEXT_OP;
 
     // Arithmatic
-    case 0x80: {
+    OPCODE(0x80): {
       uint16_t val = state->a + state->b;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // ADD B
+      NEXT_OP; // ADD B
     }
 
-    case 0x81: {
+    OPCODE(0x81): {
       uint16_t val = state->a + state->c;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // ADD C
+      NEXT_OP; // ADD C
     }
 
-    case 0x82: {
+    OPCODE(0x82): {
       uint16_t val = state->a + state->d;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // ADD D
+      NEXT_OP; // ADD D
     }
 
-    case 0x83: {
+    OPCODE(0x83): {
       uint16_t val = state->a + state->e;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // ADD E
+      NEXT_OP; // ADD E
     }
 
-    case 0x84: {
+    OPCODE(0x84): {
       uint16_t val = state->a + state->h;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // ADD B
+      NEXT_OP; // ADD B
     }
 
-    case 0x85: {
+    OPCODE(0x85): {
       uint16_t val = state->a + state->l;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // ADD L
+      NEXT_OP; // ADD L
     }
 
-    case 0x86: {
+    OPCODE(0x86): {
       uint16_t val = state->a + readFromMemory(state, state->h, state->l);
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // ADD M
+      NEXT_OP; // ADD M
     }
 
-    case 0x87: {
+    OPCODE(0x87): {
       uint16_t val = state->a + state->a;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // ADD A
+      NEXT_OP; // ADD A
     }
 
-    case 0x88: {
-      uint16_t val = state->a + state->b + state->cc.cy;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+    OPCODE(0x88): {
+      uint16_t val = state->a + state->b + getCarry(state);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // ADC B
+      NEXT_OP; // ADC B
     }
 
-    case 0x89: {
-      uint16_t val = state->a + state->c + state->cc.cy;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+    OPCODE(0x89): {
+      uint16_t val = state->a + state->c + getCarry(state);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // ADC C
+      NEXT_OP; // ADC C
     }
 
-    case 0x8a: {
-      uint16_t val = state->a + state->d + state->cc.cy;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+    OPCODE(0x8a): {
+      uint16_t val = state->a + state->d + getCarry(state);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // ADC D
+      NEXT_OP; // ADC D
     }
 
-    case 0x8b: {
-      uint16_t val = state->a + state->e + state->cc.cy;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+    OPCODE(0x8b): {
+      uint16_t val = state->a + state->e + getCarry(state);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // ADC E
+      NEXT_OP; // ADC E
     }
-    case 0x8c: {
-      uint16_t val = state->a + state->h + state->cc.cy;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+    OPCODE(0x8c): {
+      uint16_t val = state->a + state->h + getCarry(state);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // ADC H
+      NEXT_OP; // ADC H
     }
 
-    case 0x8d: {
-      uint16_t val = state->a + state->l + state->cc.cy;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+    OPCODE(0x8d): {
+      uint16_t val = state->a + state->l + getCarry(state);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // ADC L
+      NEXT_OP; // ADC L
     }
 
-    case 0x8e: {
-      uint16_t val = state->a + readFromMemory(state, state->h, state->l) + state->cc.cy;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+    OPCODE(0x8e): {
+      uint16_t val = state->a + readFromMemory(state, state->h, state->l) + getCarry(state);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // ADC M
+      NEXT_OP; // ADC M
     }
 
-    case 0x8f: {
-      uint16_t val = state->a + state->a + state->cc.cy;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+    OPCODE(0x8f): {
+      uint16_t val = state->a + state->a + getCarry(state);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // ADC A
+      NEXT_OP; // ADC A
     }
 
-    case 0x90: {
+    OPCODE(0x90): {
       uint16_t val = state->a - state->b;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // SUB B
+      NEXT_OP; // SUB B
     }
 
-    case 0x91: {
+    OPCODE(0x91): {
       uint16_t val = state->a - state->c;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // SUB C
+      NEXT_OP; // SUB C
     }
 
-    case 0x92: {
+    OPCODE(0x92): {
       uint16_t val = state->a - state->d;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // SUB D
+      NEXT_OP; // SUB D
     }
 
-    case 0x93: {
+    OPCODE(0x93): {
       uint16_t val = state->a - state->e;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // SUB E
+      NEXT_OP; // SUB E
     }
 
-    case 0x94: {
+    OPCODE(0x94): {
       uint16_t val = state->a - state->h;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // SUB H
+      NEXT_OP; // SUB H
     }
 
-    case 0x95: {
+    OPCODE(0x95): {
       uint16_t val = state->a - state->l;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // SUB L
+      NEXT_OP; // SUB L
     }
 
-    case 0x96: {
+    OPCODE(0x96): {
       uint16_t val = state->a - readFromMemory(state, state->h, state->l);
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // SUB M
+      NEXT_OP; // SUB M
     }
 
-    case 0x97: {
+    OPCODE(0x97): {
       uint16_t val = state->a - state->a;
-      state->cc.z = 1;
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // SUB A
+      NEXT_OP; // SUB A
     }
 
-    case 0x98: {
-      uint16_t val = state->a - state->b - state->cc.cy;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+    OPCODE(0x98): {
+      uint16_t val = state->a - state->b - getCarry(state);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // SBB B
+      NEXT_OP; // SBB B
     }
 
-    case 0x99: {
-      uint16_t val = state->a - state->c - state->cc.cy;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+    OPCODE(0x99): {
+      uint16_t val = state->a - state->c - getCarry(state);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // SBCBC
+      NEXT_OP; // SBCBC
     }
 
-    case 0x9a: {
-      uint16_t val = state->a - state->d - state->cc.cy;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+    OPCODE(0x9a): {
+      uint16_t val = state->a - state->d - getCarry(state);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // SBB D
+      NEXT_OP; // SBB D
     }
 
-    case 0x9b: {
-      uint16_t val = state->a - state->e - state->cc.cy;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+    OPCODE(0x9b): {
+      uint16_t val = state->a - state->e - getCarry(state);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // SBB E
+      NEXT_OP; // SBB E
     }
 
-    case 0x9c: {
-      uint16_t val = state->a - state->h - state->cc.cy;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+    OPCODE(0x9c): {
+      uint16_t val = state->a - state->h - getCarry(state);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // SBB H
+      NEXT_OP; // SBB H
     }
 
-    case 0x9d: {
-      uint16_t val = state->a - state->l - state->cc.cy;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+    OPCODE(0x9d): {
+      uint16_t val = state->a - state->l - getCarry(state);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // SBB L
+      NEXT_OP; // SBB L
     }
 
-    case 0x9e: {
-      uint16_t val = state->a - readFromMemory(state, state->h, state->l) - state->cc.cy;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+    OPCODE(0x9e): {
+      uint16_t val = state->a - readFromMemory(state, state->h, state->l) - getCarry(state);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // SBB M
+      NEXT_OP; // SBB M
     }
 
-    case 0x9f: {
-      uint16_t val = state->a - state->a - state->cc.cy;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+    OPCODE(0x9f): {
+      uint16_t val = state->a - state->a - getCarry(state);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // SBB A
+      NEXT_OP; // SBB A
     }
 
     // Logic
-    case 0xa0: {
+    OPCODE(0xa0): {
       uint16_t val = state->a & state->b;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // AND B
+      NEXT_OP; // AND B
     }
 
-    case 0xa1: {
+    OPCODE(0xa1): {
       uint16_t val = state->a & state->c;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // AND C
+      NEXT_OP; // AND C
     }
 
-    case 0xa2: {
+    OPCODE(0xa2): {
       uint16_t val = state->a & state->d;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // AND D
+      NEXT_OP; // AND D
     }
 
-    case 0xa3: {
+    OPCODE(0xa3): {
       uint16_t val = state->a & state->e;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // AND E
+      NEXT_OP; // AND E
     }
 
-    case 0xa4: {
+    OPCODE(0xa4): {
       uint16_t val = state->a & state->h;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // AND H
+      NEXT_OP; // AND H
     }
 
-    case 0xa5: {
+    OPCODE(0xa5): {
       uint16_t val = state->a & state->l;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // AND L
+      NEXT_OP; // AND L
     }
 
-    case 0xa6: {
+    OPCODE(0xa6): {
       uint16_t val = state->a & readFromMemory(state, state->h, state->l);
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // AND M
+      NEXT_OP; // AND M
     }
 
-    case 0xa7: {
+    OPCODE(0xa7): {
       uint16_t val = state->a & state->a;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // AND A
+      NEXT_OP; // AND A
     }
 
-    case 0xa8: {
+    OPCODE(0xa8): {
       uint16_t val = state->a ^ state->b;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // XRA B
+      NEXT_OP; // XRA B
     }
 
-    case 0xa9: {
+    OPCODE(0xa9): {
       uint16_t val = state->a ^ state->c;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // XRA C
+      NEXT_OP; // XRA C
     }
 
-    case 0xaa: {
+    OPCODE(0xaa): {
       uint16_t val = state->a ^ state->d;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // XRA D
+      NEXT_OP; // XRA D
     }
 
-    case 0xab: {
+    OPCODE(0xab): {
       uint16_t val = state->a ^ state->e;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // XRA E
+      NEXT_OP; // XRA E
     }
 
-    case 0xac: {
+    OPCODE(0xac): {
       uint16_t val = state->a ^ state->h;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // XRA H
+      NEXT_OP; // XRA H
     }
 
-    case 0xad:{
+    OPCODE(0xad):{
       uint16_t val = state->a ^ state->l;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // XRA L
+      NEXT_OP; // XRA L
     }
 
-    case 0xae: {
+    OPCODE(0xae): {
       uint16_t val = state->a ^ readFromMemory(state, state->h, state->l);
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // XRA M
+      NEXT_OP; // XRA M
     }
 
-    case 0xaf: {
+    OPCODE(0xaf): {
       uint16_t val = state->a ^ state->a;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // XRA A
+      NEXT_OP; // XRA A
     }
 
-    case 0xb0: {
+    OPCODE(0xb0): {
       uint16_t val = state->a | state->b;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // ORA B
+      NEXT_OP; // ORA B
     }
 
-    case 0xb1: {
+    OPCODE(0xb1): {
       uint16_t val = state->a | state->c;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // ORA C
+      NEXT_OP; // ORA C
     }
 
-    case 0xb2: {
+    OPCODE(0xb2): {
       uint16_t val = state->a | state->d;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // ORA D
+      NEXT_OP; // ORA D
     }
 
-    case 0xb3: {
+    OPCODE(0xb3): {
       uint16_t val = state->a | state->e;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // ORA E
+      NEXT_OP; // ORA E
     }
 
-    case 0xb4: {
+    OPCODE(0xb4): {
       uint16_t val = state->a | state->h;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // ORA H
+      NEXT_OP; // ORA H
     }
 
-    case 0xb5: {
+    OPCODE(0xb5): {
       uint16_t val = state->a | state->l;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // ORA L
+      NEXT_OP; // ORA L
     }
 
-    case 0xb6: {
+    OPCODE(0xb6): {
       uint16_t val = state->a | readFromMemory(state, state->h, state->l);
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // ORA M
+      NEXT_OP; // ORA M
     }
 
-    case 0xb7: {
+    OPCODE(0xb7): {
       uint16_t val = state->a | state->a;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      setFlags(state, val);
       state->a = val & 0xff;
-      break; // ORA A
+      NEXT_OP; // ORA A
     }
 
-    case 0xb8: {
+    OPCODE(0xb8): {
       uint16_t val = state->a - state->b;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
-      break; // CMP B
+      setFlags(state, val);
+      NEXT_OP; // CMP B
     }
 
-    case 0xb9: {
+    OPCODE(0xb9): {
       uint16_t val = state->a - state->c;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
-      break; // CMP C
+      setFlags(state, val);
+      NEXT_OP; // CMP C
     }
 
-    case 0xba: {
+    OPCODE(0xba): {
       uint16_t val = state->a - state->d;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
-      break; // CMP D
+      setFlags(state, val);
+      NEXT_OP; // CMP D
     }
 
-    case 0xbb: {
+    OPCODE(0xbb): {
       uint16_t val = state->a - state->e;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
-      break; // CMP E
+      setFlags(state, val);
+      NEXT_OP; // CMP E
     }
 
-    case 0xbc: {
+    OPCODE(0xbc): {
       uint16_t val = state->a - state->h;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
-      break; // CMP H
+      setFlags(state, val);
+      NEXT_OP; // CMP H
     }
 
-    case 0xbd: {
+    OPCODE(0xbd): {
       uint16_t val = state->a - state->l;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
-      break; // CMP L
+      setFlags(state, val);
+      NEXT_OP; // CMP L
     }
 
-    case 0xbe: {
+    OPCODE(0xbe): {
       uint16_t val = state->a - readFromMemory(state, state->h, state->l);
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
-      break; // CMP M
+      setFlags(state, val);
+      NEXT_OP; // CMP M
     }
 
-    case 0xbf: {
+    OPCODE(0xbf): {
       uint16_t val = state->a - state->a;
-      state->cc.z = 1;
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
-      break; // CMP A
+      setFlags(state, val);
+      NEXT_OP; // CMP A
     }
 
     // Branches and Stack Management
-    case 0xc0:
-      if(state->cc.z == 0) {
-        state->pc = (state->memory[(state->sp) + 1] << 8 ) | (state->memory[state->sp]);
+    OPCODE(0xc0):
+      if(getZero(state) == 0) {
+        state->pc = (READ_BYTE(state->sp + 1) << 8) | READ_BYTE(state->sp);
         state->sp += 2;
       }
-      break; // RNZ
+      NEXT_OP; // RNZ
 
-    case 0xc1:
-      state->c = state->memory[state->sp];
-      state->b = state->memory[state->sp+1];
+    OPCODE(0xc1):
+      state->c = READ_BYTE(state->sp);
+      state->b = READ_BYTE(state->sp+1);
       state->sp += 2;
-      break; // POP B
+      NEXT_OP; // POP B
 
-    case 0xc2:
-      if(state->cc.z == 0) {
-        state->pc = (opCode[2] << 8) | opCode[1];
-      } else {
-        state->pc += 2;
-      }
-      break; // JNZ adr
+    OPCODE(0xc2): BODY_0xc2; NEXT_OP; // JNZ adr
 
-    case 0xc3:
-      state->pc = (opCode[2] << 8) | opCode[1];
+    OPCODE(0xc3):
+      state->pc = DATA16;
       state->pc += 2;
-      break; // JMP adr
+      NEXT_OP; // JMP adr
 
-    case 0xc4:
-      if(state->cc.z == 0) {
-        state->memory[state->pc - 1] = (state->pc >> 8) & 0xff;
-        state->memory[state->pc - 2] = state->pc & 0xff;
+    OPCODE(0xc4):
+      if(getZero(state) == 0) {
+        WRITE_BYTE(state->pc - 1, (state->pc >> 8) & 0xff);
+        WRITE_BYTE(state->pc - 2, state->pc & 0xff);
         state->sp += 2;
-        state->pc = (opCode[2] << 8) | opCode[1];
+        state->pc = DATA16;
       } else {
         state->pc += 2;
       }
-      break; // CNZ
+      NEXT_OP; // CNZ
 
-    case 0xc5:
-      state->memory[state->sp-1] = state->b;
-      state->memory[state->sp-2] = state->c;
+    OPCODE(0xc5):
+      WRITE_BYTE(state->sp-1, state->b);
+      WRITE_BYTE(state->sp-2, state->c);
       state->sp -= 2;
-      break; // PUSH B
+      NEXT_OP; // PUSH B
 
-    case 0xc6: {
-      uint16_t val = state->a + opCode[1];
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+    OPCODE(0xc6): {
+      uint16_t val = state->a + DATA8;
+      setFlags(state, val);
       state->a = val & 0xff;
       state->pc += 1;
-      break; // ADI D8
+      NEXT_OP; // ADI D8
     }
 
-    case 0xc7:
-      state->memory[state->pc - 1] = (state->pc >> 8) & 0xff;
-      state->memory[state->pc - 2] = state->pc & 0xff;
+    OPCODE(0xc7):
+      WRITE_BYTE(state->pc - 1, (state->pc >> 8) & 0xff);
+      WRITE_BYTE(state->pc - 2, state->pc & 0xff);
       state->sp += 2;
       state->pc = 0x00;
-      break; // RST 0
+      NEXT_OP; // RST 0
 
-    case 0xc8:
-      if(state->cc.z == 1) {
-        state->pc = (state->memory[(state->sp) + 1] << 8 ) | (state->memory[state->sp]);
+    OPCODE(0xc8):
+      if(getZero(state) == 1) {
+        state->pc = (READ_BYTE(state->sp + 1) << 8) | READ_BYTE(state->sp);
         state->sp += 2;
       }
-      break; // RZ
+      NEXT_OP; // RZ
 
-    case 0xc9:
-      state->pc = (state->memory[(state->sp) + 1] << 8 ) | (state->memory[state->sp]);
+    OPCODE(0xc9):
+      state->pc = (READ_BYTE(state->sp + 1) << 8) | READ_BYTE(state->sp);
       state->sp += 2;
-      break; // RET
+      NEXT_OP; // RET
 
-    case 0xca:
-      if(state->cc.z == 1) {
-        state->pc = (opCode[2] << 8) | opCode[1];
-      } else {
-        state->pc += 2;
-      }
-      break; // JZ adr
+    OPCODE(0xca): BODY_0xca; NEXT_OP; // JZ adr
 
-    case 0xcc:
-      if(state->cc.z == 1) {
-        state->memory[state->pc - 1] = (state->pc >> 8) & 0xff;
-        state->memory[state->pc - 2] = state->pc & 0xff;
+    OPCODE(0xcc):
+      if(getZero(state) == 1) {
+        WRITE_BYTE(state->pc - 1, (state->pc >> 8) & 0xff);
+        WRITE_BYTE(state->pc - 2, state->pc & 0xff);
         state->sp += 2;
-        state->pc = (opCode[2] << 8) | opCode[1];
+        state->pc = DATA16;
       } else {
         state->pc += 2;
       }
-      break; // CZ adr
+      NEXT_OP; // CZ adr
 
-    case 0xcd:
-      state->memory[state->pc - 1] = (state->pc >> 8) & 0xff;
-      state->memory[state->pc - 2] = state->pc & 0xff;
+    OPCODE(0xcd):
+      WRITE_BYTE(state->pc - 1, (state->pc >> 8) & 0xff);
+      WRITE_BYTE(state->pc - 2, state->pc & 0xff);
       state->sp += 2;
-      state->pc = (opCode[2] << 8) | opCode[1];
-      break; // CALL adr
+      state->pc = DATA16;
+      NEXT_OP; // CALL adr
 
-    case 0xce: {
-      uint16_t val = state->a + opCode[1] + state->cc.cy;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+    OPCODE(0xce): {
+      uint16_t val = state->a + DATA8 + getCarry(state);
+      setFlags(state, val);
       state->a = val & 0xff;
       state->pc += 1;
-      break; // ACI D8
+      NEXT_OP; // ACI D8
     }
 
-    case 0xcf:
-      state->memory[state->pc - 1] = (state->pc >> 8) & 0xff;
-      state->memory[state->pc - 2] = state->pc & 0xff;
+    OPCODE(0xcf):
+      WRITE_BYTE(state->pc - 1, (state->pc >> 8) & 0xff);
+      WRITE_BYTE(state->pc - 2, state->pc & 0xff);
       state->sp += 2;
       state->pc = 0x08;
-      break; // RST 1
+      NEXT_OP; // RST 1
 
-    case 0xd0:
-      if(state->cc.cy == 0) {
-        state->pc = (state->memory[(state->sp) + 1] << 8 ) | (state->memory[state->sp]);
+    OPCODE(0xd0):
+      if(getCarry(state) == 0) {
+        state->pc = (READ_BYTE(state->sp + 1) << 8) | READ_BYTE(state->sp);
         state->sp += 2;
       }
-      break; //RNC
+      NEXT_OP; //RNC
 
-    case 0xd1:
-      state->e = state->memory[state->sp];
-      state->d = state->memory[state->sp+1];
+    OPCODE(0xd1):
+      state->e = READ_BYTE(state->sp);
+      state->d = READ_BYTE(state->sp+1);
       state->sp += 2;
-      break; // POP D
+      NEXT_OP; // POP D
 
-    case 0xd2:
-      if(state->cc.cy == 0) {
-        state->pc = (opCode[2] << 8) | opCode[1];
+    OPCODE(0xd2):
+      if(getCarry(state) == 0) {
+        state->pc = DATA16;
       } else {
         state->pc += 2;
       }
-      break; // JNC
+      NEXT_OP; // JNC
 
-    case 0xd3: /*Skip for now */ break; // OUT D8
+    OPCODE(0xd3):
+      writeToPort(state, DATA8, state->a);
+      state->pc += 1;
+      cycleBudget = 0; // The port may have raised an interrupt or a stop
+      NEXT_OP; // OUT D8
 
-    case 0xd4:
-      if(state->cc.cy == 0) {
-        state->memory[state->pc - 1] = (state->pc >> 8) & 0xff;
-        state->memory[state->pc - 2] = state->pc & 0xff;
+    OPCODE(0xd4):
+      if(getCarry(state) == 0) {
+        WRITE_BYTE(state->pc - 1, (state->pc >> 8) & 0xff);
+        WRITE_BYTE(state->pc - 2, state->pc & 0xff);
         state->sp += 2;
-        state->pc = (opCode[2] << 8) | opCode[1];
+        state->pc = DATA16;
       } else {
         state->pc += 2;
       }
-      break; // CNC
+      NEXT_OP; // CNC
 
-    case 0xd5:
-      state->memory[state->sp-1] = state->d;
-      state->memory[state->sp-2] = state->e;
+    OPCODE(0xd5):
+      WRITE_BYTE(state->sp-1, state->d);
+      WRITE_BYTE(state->sp-2, state->e);
       state->sp -= 2;
-      break; // PUSH D
+      NEXT_OP; // PUSH D
 
-    case 0xd6: {
-      uint16_t val = state->a - opCode[1];
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+    OPCODE(0xd6): {
+      uint16_t val = state->a - DATA8;
+      setFlags(state, val);
       state->a = val & 0xff;
       state->pc += 1;
-      break; // SUI D8
+      NEXT_OP; // SUI D8
     }
 
-    case 0xd7:
-      state->memory[state->pc - 1] = (state->pc >> 8) & 0xff;
-      state->memory[state->pc - 2] = state->pc & 0xff;
+    OPCODE(0xd7):
+      WRITE_BYTE(state->pc - 1, (state->pc >> 8) & 0xff);
+      WRITE_BYTE(state->pc - 2, state->pc & 0xff);
       state->sp += 2;
       state->pc = 0x10;
-      break; // RST 2
+      NEXT_OP; // RST 2
 
-    case 0xd8:
-      if(state->cc.cy == 1) {
-        state->pc = (state->memory[(state->sp) + 1] << 8 ) | (state->memory[state->sp]);
+    OPCODE(0xd8):
+      if(getCarry(state) == 1) {
+        state->pc = (READ_BYTE(state->sp + 1) << 8) | READ_BYTE(state->sp);
         state->sp += 2;
       }
-      break; // RC
+      NEXT_OP; // RC
 
-    case 0xda:
-      if(state->cc.cy == 1) {
-        state->pc = (opCode[2] << 8) | opCode[1];
+    OPCODE(0xda):
+      if(getCarry(state) == 1) {
+        state->pc = DATA16;
       } else {
         state->pc += 2;
       }
-      break; // JC adr
+      NEXT_OP; // JC adr
 
-    case 0xdb: /*Skip for now */  break; // IN D8
+    OPCODE(0xdb):
+      state->a = readFromPort(state, DATA8);
+      state->pc += 1;
+      cycleBudget = 0; // The port may have raised an interrupt or a stop
+      NEXT_OP; // IN D8
 
-    case 0xdc:
-      if(state->cc.cy == 1) {
-        state->memory[state->pc - 1] = (state->pc >> 8) & 0xff;
-        state->memory[state->pc - 2] = state->pc & 0xff;
+    OPCODE(0xdc):
+      if(getCarry(state) == 1) {
+        WRITE_BYTE(state->pc - 1, (state->pc >> 8) & 0xff);
+        WRITE_BYTE(state->pc - 2, state->pc & 0xff);
         state->sp += 2;
-        state->pc = (opCode[2] << 8) | opCode[1];
+        state->pc = DATA16;
       } else {
         state->pc += 2;
       }
-      break; // CC
+      NEXT_OP; // CC
 
-    case 0xde: {
-      uint16_t val = state->a - opCode[1] - state->cc.cy;
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+    OPCODE(0xde): {
+      uint16_t val = state->a - DATA8 - getCarry(state);
+      setFlags(state, val);
       state->a = val & 0xff;
       state->pc += 1;
-      break; // SUI D8
+      NEXT_OP; // SUI D8
     }
 
-    case 0xdf:
-      state->memory[state->pc - 1] = (state->pc >> 8) & 0xff;
-      state->memory[state->pc - 2] = state->pc & 0xff;
+    OPCODE(0xdf):
+      WRITE_BYTE(state->pc - 1, (state->pc >> 8) & 0xff);
+      WRITE_BYTE(state->pc - 2, state->pc & 0xff);
       state->sp += 2;
       state->pc = 0x18;
-      break; // RST 3
+      NEXT_OP; // RST 3
 
-    case 0xe0:
-      if(state->cc.p == 1) {
-        state->pc = (state->memory[(state->sp) + 1] << 8 ) | (state->memory[state->sp]);
+    OPCODE(0xe0):
+      if(getParity(state) == 1) {
+        state->pc = (READ_BYTE(state->sp + 1) << 8) | READ_BYTE(state->sp);
         state->sp += 2;
       }
-      break; // RPO
+      NEXT_OP; // RPO
 
-    case 0xe1:
-      state->l = state->memory[state->sp];
-      state->h = state->memory[state->sp+1];
+    OPCODE(0xe1):
+      state->l = READ_BYTE(state->sp);
+      state->h = READ_BYTE(state->sp+1);
       state->sp += 2;
-      break; // POP H
+      NEXT_OP; // POP H
 
-    case 0xe2:
-      if(state->cc.p == 1) {
-        state->pc = (opCode[2] << 8) | opCode[1];
+    OPCODE(0xe2):
+      if(getParity(state) == 1) {
+        state->pc = DATA16;
       } else {
         state->pc += 2;
       }
-      break; // JPO adr
+      NEXT_OP; // JPO adr
 
-    case 0xe3: {
-      uint8_t storage = state->memory[state->sp];
-      state->memory[state->sp] = state->l;
+    OPCODE(0xe3): {
+      uint8_t storage = READ_BYTE(state->sp);
+      WRITE_BYTE(state->sp, state->l);
       state->l = storage;
-      storage = state->memory[state->sp+1];
-      state->memory[state->sp+1] = state->h;
-      break; // XTHL
+      storage = READ_BYTE(state->sp+1);
+      WRITE_BYTE(state->sp+1, state->h);
+      NEXT_OP; // XTHL
     }
 
-    case 0xe4:
-      if(state->cc.p == 1) {
-        state->memory[state->pc - 1] = (state->pc >> 8) & 0xff;
-        state->memory[state->pc - 2] = state->pc & 0xff;
+    OPCODE(0xe4):
+      if(getParity(state) == 1) {
+        WRITE_BYTE(state->pc - 1, (state->pc >> 8) & 0xff);
+        WRITE_BYTE(state->pc - 2, state->pc & 0xff);
         state->sp += 2;
-        state->pc = (opCode[2] << 8) | opCode[1];
+        state->pc = DATA16;
       } else {
         state->pc += 2;
       }
-      break; // CPO adr
+      NEXT_OP; // CPO adr
 
-    case 0xe5:
-      state->memory[state->sp-1] = state->h;
-      state->memory[state->sp-2] = state->l;
+    OPCODE(0xe5):
+      WRITE_BYTE(state->sp-1, state->h);
+      WRITE_BYTE(state->sp-2, state->l);
       state->sp -= 2;
-      break; // PUSH H
+      NEXT_OP; // PUSH H
 
-    case 0xe6: {
-      uint16_t val = state->a & opCode[1];
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+    OPCODE(0xe6): {
+      uint16_t val = state->a & DATA8;
+      setFlags(state, val);
       state->a = val & 0xff;
       state->pc += 1;
-      break; // ANI D8
+      NEXT_OP; // ANI D8
     }
 
-    case 0xe7:
-      state->memory[state->pc - 1] = (state->pc >> 8) & 0xff;
-      state->memory[state->pc - 2] = state->pc & 0xff;
+    OPCODE(0xe7):
+      WRITE_BYTE(state->pc - 1, (state->pc >> 8) & 0xff);
+      WRITE_BYTE(state->pc - 2, state->pc & 0xff);
       state->sp += 2;
       state->pc = 0x20;
-      break; // RST 4
+      NEXT_OP; // RST 4
 
-    case 0xe8:
-      if(state->cc.p == 0)
+    OPCODE(0xe8):
+      if(getParity(state) == 0)
       {
-        state->pc = (state->memory[(state->sp) + 1] << 8 ) | (state->memory[state->sp]);
+        state->pc = (READ_BYTE(state->sp + 1) << 8) | READ_BYTE(state->sp);
         state->sp += 2;
       }
-      break; // RPE
+      NEXT_OP; // RPE
 
-    case 0xe9:
-      state->pc = (state->h << 8) | state->l;
-      break; // PCHL
+    OPCODE(0xe9):
+      state->pc = state->hl;
+      NEXT_OP; // PCHL
 
-    case 0xea:
-      if(state->cc.p == 0) {
-        state->pc = (opCode[2] << 8) | opCode[1];
+    OPCODE(0xea):
+      if(getParity(state) == 0) {
+        state->pc = DATA16;
       } else {
         state->pc += 2;
       }
-      break; // JPE adr
-
-    case 0xeb: {
-      uint8_t storage = state->h;
-      state->h = state->d;
-      state->d = storage;
-      storage = state->l;
-      state->l = state->e;
-      state->e = storage;
-      break; // XCHG
-    }
-
-    case 0xec:
-      if(state->cc.p == 0) {
-        state->memory[state->pc - 1] = (state->pc >> 8) & 0xff;
-        state->memory[state->pc - 2] = state->pc & 0xff;
+      NEXT_OP; // JPE adr
+
+    OPCODE(0xeb): {
+      uint16_t storage = state->hl;
+      state->hl = state->de;
+      state->de = storage;
+      NEXT_OP; // XCHG
+    }
+
+    OPCODE(0xec):
+      if(getParity(state) == 0) {
+        WRITE_BYTE(state->pc - 1, (state->pc >> 8) & 0xff);
+        WRITE_BYTE(state->pc - 2, state->pc & 0xff);
         state->sp += 2;
-        state->pc = (opCode[2] << 8) | opCode[1];
+        state->pc = DATA16;
       } else {
         state->pc += 2;
       }
-      break; // CPE adr
+      NEXT_OP; // CPE adr
 
-    case 0xee:  {
-      uint16_t val = state->a ^ opCode[1];
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+    OPCODE(0xee):  {
+      uint16_t val = state->a ^ DATA8;
+      setFlags(state, val);
       state->a = val & 0xff;
       state->pc += 1;
-      break; // XRI D8
+      NEXT_OP; // XRI D8
     }
 
-    case 0xef:
-      state->memory[state->pc - 1] = (state->pc >> 8) & 0xff;
-      state->memory[state->pc - 2] = state->pc & 0xff;
+    OPCODE(0xef):
+      WRITE_BYTE(state->pc - 1, (state->pc >> 8) & 0xff);
+      WRITE_BYTE(state->pc - 2, state->pc & 0xff);
       state->sp += 2;
       state->pc = 0x28;
-      break; // RST 5
+      NEXT_OP; // RST 5
 
-    case 0xf0:
-      if(state->cc.cy == 0) {
-        state->pc = (state->memory[(state->sp) + 1] << 8 ) | (state->memory[state->sp]);
+    OPCODE(0xf0):
+      if(getCarry(state) == 0) {
+        state->pc = (READ_BYTE(state->sp + 1) << 8) | READ_BYTE(state->sp);
         state->sp += 2;
       }
-      break; // RP
-
-    case 0xf1: {
-      state->a = state->memory[state->sp + 1];
-      uint8_t psw = state->memory[state->sp];
-      state->cc.z = psw & 0xfe;
-      state->cc.s = psw & 0xfd;
-      state->cc.p = psw & 0xfb;
-      state->cc.cy = psw & 0xf7;
-      state->cc.ac = psw & 0x2f;
-      state->cc.pad = psw & 0x1f;
-      break; // POP PSW
-    }
-
-    case 0xf2:
-      if(state->cc.p == 0) {
-        state->pc = (opCode[2] << 8) | opCode[1];
+      NEXT_OP; // RP
+
+    OPCODE(0xf1): {
+      uint8_t psw = READ_BYTE(state->sp);
+      state->a = READ_BYTE(state->sp + 1);
+      state->cc.z = psw & 0x01;
+      state->cc.s = (psw >> 1) & 0x01;
+      state->cc.p = (psw >> 2) & 0x01;
+      state->cc.cy = (psw >> 3) & 0x01;
+      state->cc.ac = (psw >> 4) & 0x01;
+      state->cc.pad = (psw >> 5) & 0x01;
+      state->lazyFlags = 0;
+      state->sp += 2;
+      NEXT_OP; // POP PSW
+    }
+
+    OPCODE(0xf2):
+      if(getParity(state) == 0) {
+        state->pc = DATA16;
       } else {
         state->pc += 2;
       }
-      break; // JP adr
+      NEXT_OP; // JP adr
 
-    case 0xf3: state->intEnable = 0; break; // DI
+    OPCODE(0xf3): state->intEnable = 0; NEXT_OP; // DI
 
-    case 0xf4:
-      if(state->cc.p == 0) {
-        state->memory[state->pc - 1] = (state->pc >> 8) & 0xff;
-        state->memory[state->pc - 2] = state->pc & 0xff;
+    OPCODE(0xf4):
+      if(getParity(state) == 0) {
+        WRITE_BYTE(state->pc - 1, (state->pc >> 8) & 0xff);
+        WRITE_BYTE(state->pc - 2, state->pc & 0xff);
         state->sp += 2;
-        state->pc = (opCode[2] << 8) | opCode[1];
+        state->pc = DATA16;
       } else {
         state->pc += 2;
       }
-      break; // CP adr
+      NEXT_OP; // CP adr
 
-    case 0xf5:
-      state->memory[state->sp - 1] = state->a;
-      state->memory[state->sp - 2] = (state->cc.z | (state->cc.s << 1) | (state->cc.p << 2) |
-        (state->cc.cy << 3) | (state->cc.ac << 4) | (state->cc.pad << 5));
+    OPCODE(0xf5):
+      WRITE_BYTE(state->sp - 1, state->a);
+      syncFlags(state);
+      WRITE_BYTE(state->sp - 2, (state->cc.z | (state->cc.s << 1) | (state->cc.p << 2) |
+        (state->cc.cy << 3) | (state->cc.ac << 4) | (state->cc.pad << 5)));
       state->sp -=2;
-      break; // PUSH PSW
+      NEXT_OP; // PUSH PSW
 
-    case 0xf6: {
-      uint16_t val = state->a | opCode[1];
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+    OPCODE(0xf6): {
+      uint16_t val = state->a | DATA8;
+      setFlags(state, val);
       state->a = val & 0xff;
       state->pc += 1;
-      break; // ORI D8
+      NEXT_OP; // ORI D8
     }
 
-    case 0xf7:
-      state->memory[state->pc - 1] = (state->pc >> 8) & 0xff;
-      state->memory[state->pc - 2] = state->pc & 0xff;
+    OPCODE(0xf7):
+      WRITE_BYTE(state->pc - 1, (state->pc >> 8) & 0xff);
+      WRITE_BYTE(state->pc - 2, state->pc & 0xff);
       state->sp += 2;
       state->pc = 0x30;
-      break; // RST 6
+      NEXT_OP; // RST 6
 
-    case 0xf8:
-      if(state->cc.s == 1) {
-        state->pc = (state->memory[(state->sp) + 1] << 8 ) | (state->memory[state->sp]);
+    OPCODE(0xf8):
+      if(getSign(state) == 1) {
+        state->pc = (READ_BYTE(state->sp + 1) << 8) | READ_BYTE(state->sp);
         state->sp += 2;
       }
-      break; // RM
+      NEXT_OP; // RM
 
-    case 0xf9:
-      state->sp = (state->h << 8) | state->l;
-      break;// SPHL
+    OPCODE(0xf9):
+      state->sp = state->hl;
+      NEXT_OP;// SPHL
 
-    case 0xfa:
-      if(state->cc.s == 1) {
-        state->pc = (opCode[2] << 8) | opCode[1];
+    OPCODE(0xfa):
+      if(getSign(state) == 1) {
+        state->pc = DATA16;
       } else {
         state->pc += 2;
       }
-      break; // JM adr
+      NEXT_OP; // JM adr
 
-    case 0xfb: state->intEnable = 1; break; // EI
+    OPCODE(0xfb):
+      state->intEnable = 1;
+      cycleBudget = 0; // A pending interrupt can be taken now
+      NEXT_OP; // EI
 
-    case 0xfc:
-      if(state->cc.s == 1) {
-        state->memory[state->pc - 1] = (state->pc >> 8) & 0xff;
-        state->memory[state->pc - 2] = state->pc & 0xff;
+    OPCODE(0xfc):
+      if(getSign(state) == 1) {
+        WRITE_BYTE(state->pc - 1, (state->pc >> 8) & 0xff);
+        WRITE_BYTE(state->pc - 2, state->pc & 0xff);
         state->sp += 2;
-        state->pc = (opCode[2] << 8) | opCode[1];
+        state->pc = DATA16;
       } else {
         state->pc += 2;
       }
-      break; // CM adr
-
-    case 0xfe: {
-      uint16_t val = state->a - opCode[1];
-      state->cc.z = ((val & 0xff) == 0);
-      state->cc.s = ((val & 0x80) != 0);
-      state->cc.cy = (val > 0xff);
-      state->cc.p = parity(val & 0xff);
+      NEXT_OP; // CM adr
+
+    OPCODE(0xfe): {
+      uint16_t val = state->a - DATA8;
+      setFlags(state, val);
       state->pc += 1;
-      break; // CPI D8
+      NEXT_OP; // CPI D8
     }
 
-    case 0xff:
-      state->memory[state->pc - 1] = (state->pc >> 8) & 0xff;
-      state->memory[state->pc - 2] = state->pc & 0xff;
+    OPCODE(0xff):
+      WRITE_BYTE(state->pc - 1, (state->pc >> 8) & 0xff);
+      WRITE_BYTE(state->pc - 2, state->pc & 0xff);
       state->sp += 2;
       state->pc = 0x38;
-      break; // RST 7
-  }
-  // Increment program counter
-  state->pc+=1;
-  // Return number of cucles for op
-  return cycles[*opCode];
+      NEXT_OP; // RST 7
+  END_DISPATCH
+#ifdef FUSE_OPS
+  FUSED_OPS(FUSED_HANDLER2, FUSED_HANDLER3)
+#endif
+}
+
+/* Code to run a single 8080 op code
+  Input: state8080 Struct
+  Output: number of cycles the op took
+*/
+int emulateOp(state8080* state) {
+  return emulateOps(state, 1);
 }
 
 /* Code to facilitate interrupts in code
@@ -1809,11 +2207,51 @@ int emulateOp(state8080* state) {
   Changes program counter
 */
 void generateInterrupt(state8080* state, int number) {
-  state->memory[state->sp-2] = state->pc & 0xff;
-  state->memory[state->sp-1] = (state->pc >> 8) & 0xff;
+  WRITE_BYTE(state->sp-2, state->pc & 0xff);
+  WRITE_BYTE(state->sp-1, (state->pc >> 8) & 0xff);
   state->pc = 8 * number;
 }
 
+/* Function to raise an interrupt for runCycles to take
+  Input: state8080 struct, RST number
+  Output: void
+  The interrupt waits until interrupts are enabled
+*/
+void requestInterrupt(state8080* state, int number) {
+  state->interruptNumber = number;
+  state->interruptPending = 1;
+}
+
+/* Function to make runCycles return early
+  Input: state8080 struct
+  Output: void
+  Can be called from a port hook
+*/
+void requestStop(state8080* state) {
+  state->stopRequested = 1;
+}
+
+/* Function to run the emulator for a number of cycles
+  Input: state8080 struct, number of cycles to run for
+  Output: number of cycles actually run
+  Interrupts and stop requests are only checked between calls to
+  emulateOps, which ends at block boundaries and after IN, OUT and EI
+*/
+int runCycles(state8080* state, int budget) {
+  int cyclesRun = 0;
+  while(cyclesRun < budget && !state->stopRequested) {
+    if(state->interruptPending && state->intEnable) {
+      // The 8080 turns interrupts off when it takes one
+      state->interruptPending = 0;
+      state->intEnable = 0;
+      generateInterrupt(state, state->interruptNumber);
+    }
+    cyclesRun += emulateOps(state, budget - cyclesRun);
+  }
+  state->stopRequested = 0;
+  return cyclesRun;
+}
+
 /* Code to read files into state memory
   Input: state8080 struct, filename, 32 bit memory location
   Output: Void
@@ -1827,8 +2265,12 @@ void readFileIntoMemory(state8080* state, char* fileName, uint32_t location) {
     exit(1);
   } else {
     fseek(f, 0L, SEEK_END);
-    int fsize = ftell(f);
+    long fsize = ftell(f);
     fseek(f, 0L, SEEK_SET);
+    if(fsize < 0 || location + fsize > 0x10000) {
+      printf("ERROR: %s doesn't fit in memory at %04x\n", fileName, location);
+      exit(1);
+    }
 
     // Allocate memory for opCodes
     uint8_t *buffer = &state->memory[location];
@@ -1839,29 +2281,172 @@ void readFileIntoMemory(state8080* state, char* fileName, uint32_t location) {
   }
 }
 
+#define ROM_FILE_SLOTS 16
+
+/* Struct for a ROM file mapped read only into the host's memory
+  The page cache backs the mapping, so every state loading the file
+  reads the same physical pages
+*/
+typedef struct romFile {
+  char name[256];
+  uint8_t *data;
+  size_t size;
+} romFile;
+
+romFile romFiles[ROM_FILE_SLOTS];
+int numRomFiles;
+
+/* Function to map a ROM file, once per process
+  Input: filename
+  Output: the mapped file
+  Exits if the file can't be opened or mapped
+*/
+romFile* openRomFile(const char* fileName) {
+  struct stat info;
+  romFile *rom;
+  int i, fd;
+  for(i = 0; i < numRomFiles; i++) {
+    if(strcmp(romFiles[i].name, fileName) == 0) {
+      return &romFiles[i];
+    }
+  }
+  if(numRomFiles == ROM_FILE_SLOTS || strlen(fileName) >= sizeof(romFiles[0].name)) {
+    printf("ERROR: Too many ROM files to map %s\n", fileName);
+    exit(1);
+  }
+
+  fd = open(fileName, O_RDONLY);
+  if(fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0) {
+    printf("ERROR: Cannot open %s\n", fileName);
+    exit(1);
+  }
+  rom = &romFiles[numRomFiles];
+  rom->data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(rom->data == MAP_FAILED) {
+    printf("ERROR: Cannot map %s\n", fileName);
+    exit(1);
+  }
+  strcpy(rom->name, fileName);
+  rom->size = info.st_size;
+  numRomFiles++;
+  return rom;
+}
+
+/* Function to load a ROM file into the memory map without copying it
+  Input: state8080 struct, filename, memory location
+  Output: void
+  The pages the file covers are read straight from its mapping, and
+  writes to them are dropped. The location has to be a multiple of
+  MEMORY_PAGE_SIZE. A partial last page reads zeros past the file.
+  Pages mirroring the ones the file covers are remapped with them.
+*/
+void mapRomFile(state8080* state, const char* fileName, uint32_t location) {
+  romFile *rom = openRomFile(fileName);
+  uint32_t offset;
+  int page;
+  if(location % MEMORY_PAGE_SIZE != 0 || location + rom->size > 0x10000) {
+    printf("ERROR: %s doesn't fit in memory at %04x\n", fileName, location);
+    exit(1);
+  }
+  for(offset = 0; offset < rom->size; offset += MEMORY_PAGE_SIZE) {
+    uint8_t *replaced = state->readPages[(location + offset) / MEMORY_PAGE_SIZE];
+    for(page = 0; page < MEMORY_PAGES; page++) {
+      if(state->readPages[page] == replaced) {
+        state->readPages[page] = rom->data + offset;
+        state->writePages[page] = state->romSink;
+      }
+    }
+  }
+  state->readPages[MEMORY_PAGES] = state->readPages[0];
+}
+
+#include"stateArena.c"
+
 /* Function to creat 8080 state
   Input: void
   Output: new state8080 struct w/ 16k=K bits of memory
+  Memory starts out mapped as all RAM, see mapMemory. Its host pages
+  only take up space once written, so pages mapped from ROM files
+  cost nothing per state
 */
 state8080* initializeState() {
   state8080* state = calloc(1, sizeof(state8080));
-  state->memory = malloc(0x10000);
+  state->memory = mmap(NULL, 0x10000, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(state->memory == MAP_FAILED) {
+    printf("ERROR: Cannot allocate memory\n");
+    exit(1);
+  }
+  mapMemory(state, &flatMap, 1);
+#ifdef PREDECODE_CACHE
+  state->decodeCache = calloc(0x10000, sizeof(decodedOp));
+#endif
+#ifdef BLOCK_CACHE
+  state->blockCache = createBlockCache();
+#endif
+#ifdef JIT_RECOMPILER
+  state->blockCache->jitBuffer = createJitBuffer(1);
+#endif
   return state;
 }
 
+/* Function to free a state made by initializeState or arenaState
+  Input: state8080 struct
+  Output: void
+  ROM files stay mapped, since other states may still read them
+*/
+void freeState(state8080* state) {
+  if(state->arena != NULL) {
+    releaseArenaState(state);
+    return;
+  }
+#ifdef WATCHPOINTS
+  forgetWatchpoints(state);
+#endif
+#ifdef JIT_RECOMPILER
+  if(state->blockCache->jitBuffer != NULL) {
+    munmap(state->blockCache->jitBuffer, JIT_BUFFER_SIZE);
+  }
+#endif
+#ifdef BLOCK_CACHE
+  free(state->blockCache);
+#endif
+#ifdef PREDECODE_CACHE
+  free(state->decodeCache);
+#endif
+  munmap(state->memory, 0x10000);
+  free(state);
+}
+
+#include"snapshots.c"
+
+#ifdef LOCKSTEP
+#include"lockstep.c"
+#endif
+
+// Cycles run per 60Hz frame by the 2MHz 8080
+#define CYCLES_PER_FRAME 33333
+
+#ifndef NO_EMULATOR_MAIN
 /* Main function for 8080 emulator
   Loads space invaders into memory of state
   Runs emulator operations
+  Define NO_EMULATOR_MAIN to include this file in another program
 */
 int main(int argc, char const *argv[]) {
   int finished = 0;
   state8080* state = initializeState();
-  readFileIntoMemory(state, "invaders.h", 0x100);
-  readFileIntoMemory(state, "invaders.g", 0x900);
-  readFileIntoMemory(state, "invaders.f", 0x1100);
-  readFileIntoMemory(state, "invaders.e", 0x1900);
+  mapMemory(state, spaceInvadersMap, SPACE_INVADERS_REGIONS);
+  mapRomFile(state, "invaders.h", 0x0000);
+  mapRomFile(state, "invaders.g", 0x0800);
+  mapRomFile(state, "invaders.f", 0x1000);
+  mapRomFile(state, "invaders.e", 0x1800);
+#ifdef PROFILE_OPCODES
+  atexit(printOpProfile);
+#endif
 
   while(finished == 0) {
-    emulateOp(state);
+    runCycles(state, CYCLES_PER_FRAME);
   }
 }
+#endif
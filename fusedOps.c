@@ -0,0 +1,116 @@
+/* Fused op handlers for the 8080 emulator
+  Jack R. McCluskey
+
+  Common sequences of two or three ops are run as one dispatch. The
+  first op of a sequence gets a fused handler in the decode cache,
+  which runs the bodies of every op in the sequence back to back and
+  skips the indirect jump between them.
+  Included by emulatorShell.c when built with FUSE_OPS, which needs
+  THREADED_DISPATCH and PREDECODE_CACHE.
+*/
+
+/* Table of the sequences to fuse
+  Every op used needs a BODY_ macro in emulatorShell.c, and only the
+  last op of a sequence may change the program counter.
+  Retune this list from a PROFILE_OPCODES run of the ROM being played.
+*/
+#define FUSED_OPS(FUSE2, FUSE3) \
+  FUSE3(0x1a, 0x77, 0x23) /* LDAX D; MOV M,A; INX H */ \
+  FUSE3(0x13, 0x05, 0xc2) /* INX D; DCR B; JNZ */ \
+  FUSE2(0x0a, 0x03) /* LDAX B; INX B */ \
+  FUSE2(0x1a, 0x13) /* LDAX D; INX D */ \
+  FUSE2(0x02, 0x03) /* STAX B; INX B */ \
+  FUSE2(0x12, 0x13) /* STAX D; INX D */ \
+  FUSE2(0x7e, 0x23) /* MOV A,M; INX H */ \
+  FUSE2(0x77, 0x23) /* MOV M,A; INX H */ \
+  FUSE2(0x05, 0xc2) /* DCR B; JNZ */ \
+  FUSE2(0x0d, 0xc2) /* DCR C; JNZ */
+
+#define FUSED_MAX_OPS 3
+#define FUSED_MAX_SPAN 9 // Bytes covered by the longest possible sequence
+
+/* Struct for one sequence of FUSED_OPS
+*/
+typedef struct fusedSequence {
+  uint8_t numOps;
+  uint8_t ops[FUSED_MAX_OPS];
+} fusedSequence;
+
+#define FUSED_SEQUENCE2(op1, op2) { 2, { op1, op2, 0 } },
+#define FUSED_SEQUENCE3(op1, op2, op3) { 3, { op1, op2, op3 } },
+const fusedSequence fusedSequences[] = {
+  FUSED_OPS(FUSED_SEQUENCE2, FUSED_SEQUENCE3)
+};
+#define NUM_FUSED (int) (sizeof(fusedSequences) / sizeof(fusedSequences[0]))
+
+// Labels of the fused handlers, in the same order as fusedSequences
+#define FUSED_LABEL2(op1, op2) &&fuse_##op1##_##op2,
+#define FUSED_LABEL3(op1, op2, op3) &&fuse_##op1##_##op2##_##op3,
+
+/* Macros generating the fused handlers inside emulateOps
+  FUSE_STEP finishes one op of the sequence and fetches the next one
+  without a dispatch. If a store in the sequence has overwritten the
+  ops after it, the rest is dispatched again as single ops.
+*/
+#define FUSE_STEP() \
+  PROFILE_OP(); \
+  FINISH_OP(); \
+  if(fusedHead->length == 0) { \
+    FETCH_OP(); \
+    JUMP_OP(); \
+  } \
+  FETCH_OP()
+#define FUSED_HANDLER2(op1, op2) \
+  fuse_##op1##_##op2: \
+    fusedHead = entry; \
+    BODY_##op1; FUSE_STEP(); \
+    BODY_##op2; NEXT_OP;
+#define FUSED_HANDLER3(op1, op2, op3) \
+  fuse_##op1##_##op2##_##op3: \
+    fusedHead = entry; \
+    BODY_##op1; FUSE_STEP(); \
+    BODY_##op2; FUSE_STEP(); \
+    BODY_##op3; NEXT_OP;
+
+/* Function to give a newly decoded op a fused handler
+  Input: state8080 struct, decoded op at the program counter, handlers
+    for fusedSequences
+  Output: void
+  Picks the longest sequence in the table that matches the ops at the
+  program counter. The ops after the first are decoded into a scratch
+  copy, so they still get their own fusion check when first fetched.
+  The span of the first op grows to cover every op of the sequence,
+  so a write to any of them drops the fusion.
+*/
+void fuseOps(state8080* state, decodedOp* entry, void** fusedHandlers) {
+  decodedOp ops[FUSED_MAX_OPS];
+  uint16_t address = state->pc;
+  int best = -1;
+  int i, j;
+
+  ops[0] = *entry;
+  for(i = 1; i < FUSED_MAX_OPS; i++) {
+    address += ops[i - 1].length;
+    decodeOp(state, address, &ops[i]);
+  }
+
+  for(i = 0; i < NUM_FUSED; i++) {
+    for(j = 0; j < fusedSequences[i].numOps; j++) {
+      if(ops[j].opCode != fusedSequences[i].ops[j]) {
+        break;
+      }
+    }
+    if(j == fusedSequences[i].numOps &&
+        (best < 0 || fusedSequences[i].numOps > fusedSequences[best].numOps)) {
+      best = i;
+    }
+  }
+
+  if(best >= 0) {
+    entry->handler = fusedHandlers[best];
+    entry->span = 0;
+    for(j = 0; j < fusedSequences[best].numOps; j++) {
+      entry->span += ops[j].length;
+    }
+  }
+}
@@ -0,0 +1,209 @@
+/* Vectorized Space Invaders environment
+  Jack R. McCluskey
+
+  Wraps many Space Invaders machines behind reset, step and observe
+  calls, for programs that drive the game instead of a player. The
+  video RAM of every machine, 0x2400 to 0x3fff, is mapped into one
+  buffer, machine after machine INVADERS_VRAM_SIZE bytes apart, so
+  observeInvadersEnv hands out pointers into it without copying.
+  The machines' states come from one arena. Not thread safe, use one
+  environment per thread.
+  Usage: invadersEnv machines steps frames   (prints the speed)
+  Define NO_ENV_MAIN to use it as a library.
+*/
+
+#define NO_EMULATOR_MAIN
+#include"emulatorShell.c"
+#include"invadersMachine.c"
+#include <time.h>
+
+#define INVADERS_VRAM 0x2400
+#define INVADERS_VRAM_SIZE 0x1c00 // 256 by 224 pixels, a bit each
+
+/* Struct for a set of machines stepped together
+  observations[i] points at vram + i * INVADERS_VRAM_SIZE. Clones of
+  the machines' states would share their video RAM, see snapshots.c.
+*/
+typedef struct invadersEnv {
+  stateArena *arena;
+  invadersMachine *machines;
+  int numMachines;
+  uint8_t *vram; // Every machine's video RAM, contiguous
+  uint8_t **observations;
+  uint8_t dipSwitches; // Port 2 bits 0-3 and 7 for every machine, 0 is 3 lives
+} invadersEnv;
+
+/* Helper function to move a machine's video RAM into the shared buffer
+  Input: machine, its INVADERS_VRAM_SIZE bytes of the buffer
+  Output: void
+  Mirrors of the video RAM pages are moved with them, like mapRomFile
+  does for ROM pages
+*/
+void mapInvadersVram(invadersMachine* machine, uint8_t* vram) {
+  state8080 *state = machine->state;
+  int page, vramPage;
+  for(vramPage = 0; vramPage < INVADERS_VRAM_SIZE / MEMORY_PAGE_SIZE; vramPage++) {
+    uint8_t *replaced = state->readPages[INVADERS_VRAM / MEMORY_PAGE_SIZE + vramPage];
+    uint8_t *moved = vram + vramPage * MEMORY_PAGE_SIZE;
+    for(page = 0; page < MEMORY_PAGES; page++) {
+      if(state->readPages[page] == replaced) {
+        state->readPages[page] = moved;
+        state->writePages[page] = moved;
+      }
+    }
+  }
+}
+
+/* Helper function to power a machine on again
+  Input: invadersEnv struct, machine number
+  Output: void
+  Gives the machine a fresh state from the arena and clears its video RAM
+*/
+void resetInvadersMachine(invadersEnv* env, int id) {
+  invadersMachine *machine = &env->machines[id];
+  if(machine->state != NULL) {
+    freeState(machine->state);
+  }
+  initializeInvaders(machine, env->arena);
+  machine->port2 = env->dipSwitches & ~INVADERS_PLAYER_BUTTONS;
+  setInvadersButtons(machine, 0);
+  memset(env->observations[id], 0, INVADERS_VRAM_SIZE);
+  mapInvadersVram(machine, env->observations[id]);
+}
+
+/* Function to make an environment
+  Input: number of machines
+  Output: new invadersEnv struct, every machine at power on
+  Reads invaders.h, .g, .f and .e from the working directory
+*/
+invadersEnv* createInvadersEnv(int numMachines) {
+  invadersEnv *env = calloc(1, sizeof(invadersEnv));
+  int i;
+  env->numMachines = numMachines;
+  env->arena = createStateArena(numMachines, ARENA_HUGE_PAGES);
+  env->machines = calloc(numMachines, sizeof(invadersMachine));
+  env->observations = calloc(numMachines, sizeof(uint8_t*));
+  env->vram = mmap(NULL, (size_t) numMachines * INVADERS_VRAM_SIZE, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(env->vram == MAP_FAILED) {
+    printf("ERROR: Cannot allocate memory\n");
+    exit(1);
+  }
+  for(i = 0; i < numMachines; i++) {
+    env->observations[i] = env->vram + (size_t) i * INVADERS_VRAM_SIZE;
+    resetInvadersMachine(env, i);
+  }
+  return env;
+}
+
+/* Function to power machines on again
+  Input: invadersEnv struct, machine numbers, how many there are
+  Output: void
+  Pass NULL for the numbers to reset every machine. The observation
+  pointers don't change.
+*/
+void resetInvadersEnv(invadersEnv* env, const int* ids, int numIds) {
+  int i;
+  if(ids == NULL) {
+    numIds = env->numMachines;
+  }
+  for(i = 0; i < numIds; i++) {
+    int id = ids == NULL ? i : ids[i];
+    if(id >= 0 && id < env->numMachines) {
+      resetInvadersMachine(env, id);
+    }
+  }
+}
+
+/* Function to run every machine with the buttons held down
+  Input: invadersEnv struct, INVADERS_ button bits for each machine,
+    number of frames to hold them for
+  Output: void
+  Pass NULL for the buttons to let go of them all. Each frame raises
+  the mid screen and end of screen interrupts, see runInvadersFrame.
+*/
+void stepInvadersEnv(invadersEnv* env, const uint8_t* actions, int frames) {
+  int i, frame;
+  for(i = 0; i < env->numMachines; i++) {
+    invadersMachine *machine = &env->machines[i];
+    setInvadersButtons(machine, actions != NULL ? actions[i] : 0);
+    for(frame = 0; frame < frames; frame++) {
+      runInvadersFrame(machine);
+    }
+  }
+}
+
+/* Function to see every machine's screen
+  Input: invadersEnv struct
+  Output: array of numMachines pointers to video RAM
+  The pointers are into env->vram and stay the same for the life of
+  the environment, so the screens can be read at any time without
+  calling this again. Each row of 32 bytes is one column of the
+  screen from the bottom up, the cabinet's monitor is turned on its side.
+*/
+uint8_t** observeInvadersEnv(invadersEnv* env) {
+  return env->observations;
+}
+
+/* Function to free an environment
+  Input: invadersEnv struct
+  Output: void
+*/
+void freeInvadersEnv(invadersEnv* env) {
+  freeStateArena(env->arena);
+  munmap(env->vram, (size_t) env->numMachines * INVADERS_VRAM_SIZE);
+  free(env->observations);
+  free(env->machines);
+  free(env);
+}
+
+#ifndef NO_ENV_MAIN
+/* Main function for the environment
+  Steps the machines with random buttons and prints the speed
+*/
+int main(int argc, char const *argv[]) {
+  invadersEnv *env;
+  uint8_t *actions;
+  int numMachines, steps, frames, step, i;
+  struct timespec started, finished;
+  double seconds;
+  unsigned long lit = 0;
+
+  if(argc != 4) {
+    printf("Usage: %s machines steps frames\n", argv[0]);
+    return 1;
+  }
+  numMachines = atoi(argv[1]);
+  steps = atoi(argv[2]);
+  frames = atoi(argv[3]);
+  if(numMachines < 1 || steps < 0 || frames < 1) {
+    printf("ERROR: Machines and frames must be at least 1\n");
+    return 1;
+  }
+
+  env = createInvadersEnv(numMachines);
+  actions = malloc(numMachines);
+  clock_gettime(CLOCK_MONOTONIC, &started);
+  for(step = 0; step < steps; step++) {
+    for(i = 0; i < numMachines; i++) {
+      actions[i] = rand() & (INVADERS_COIN | INVADERS_P1_START | INVADERS_PLAYER_BUTTONS);
+    }
+    stepInvadersEnv(env, actions, frames);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &finished);
+  seconds = finished.tv_sec - started.tv_sec + (finished.tv_nsec - started.tv_nsec) / 1e9;
+
+  for(i = 0; i < numMachines * INVADERS_VRAM_SIZE; i++) {
+    lit += __builtin_popcount(env->vram[i]);
+  }
+  printf("%d machines, %d steps of %d frames in %.3f s\n", numMachines, steps, frames, seconds);
+  if(seconds > 0) {
+    printf("%.0f steps per second, %.0f frames per second\n",
+      numMachines * steps / seconds, (double) numMachines * steps * frames / seconds);
+  }
+  printf("%lu pixels lit\n", lit);
+  free(actions);
+  freeInvadersEnv(env);
+  return 0;
+}
+#endif
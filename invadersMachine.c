@@ -0,0 +1,143 @@
+/* Space Invaders machine for the 8080 emulator
+  Jack R. McCluskey
+
+  The hardware around the 8080 in a Space Invaders cabinet, ported
+  from SpaceInvadersEMU/SpaceInvadersMachine.m to portable C: the
+  shift register, the input ports and the two video interrupts per
+  frame. The interrupts are timed by the cycles the machine has run
+  instead of the host's clock, so machines run headless at any speed.
+  Included after emulatorShell.c by batchRunner.c and invadersEnv.c.
+  Save states of the machine are in saveStates.c, and its rewind
+  buffer in rewindBuffer.c.
+*/
+
+// Bits of input port 1, port 2 has the player 2 buttons on the same bits
+#define INVADERS_COIN 0x01
+#define INVADERS_P2_START 0x02
+#define INVADERS_P1_START 0x04
+#define INVADERS_PORT1_HIGH 0x08 // Always reads 1
+#define INVADERS_FIRE 0x10
+#define INVADERS_LEFT 0x20
+#define INVADERS_RIGHT 0x40
+#define INVADERS_PLAYER_BUTTONS (INVADERS_FIRE | INVADERS_LEFT | INVADERS_RIGHT)
+
+/* Struct for one Space Invaders machine
+  The shift register and input ports are the hardware outside the 8080
+*/
+typedef struct invadersMachine {
+  state8080 *state;
+  uint8_t shift0; // Low byte of the shift register
+  uint8_t shift1; // High byte
+  uint8_t shiftOffset;
+  uint8_t port1; // Coin, start and player 1 buttons, set by the caller
+  uint8_t port2; // DIP switches and player 2 buttons
+  uint8_t numInterrupt; // RST the video raises next, 1 at mid screen or 2 at the end
+  unsigned long nextInterrupt; // Value of cyclesRun the next one is raised at
+  unsigned long cyclesRun; // Cycles run since reset
+  int node; // NUMA node holding the machine's state, -1 if unknown, batchRunner only
+  unsigned long frames; // Frames run so far
+  int framesLeft; // Frames left in the current run, BATCH_STEALING only
+} invadersMachine;
+
+/* Function to handle the IN op of a Space Invaders machine
+  Input: state8080 struct, port number
+  Output: value read from the port
+*/
+uint8_t invadersIn(state8080* state, uint8_t port) {
+  invadersMachine *machine = state->userData;
+  switch(port) {
+    case 0:
+      return 1;
+    case 1:
+      return machine->port1;
+    case 2:
+      return machine->port2;
+    case 3: {
+      uint16_t value = (machine->shift1 << 8) | machine->shift0;
+      return (value >> (8 - machine->shiftOffset)) & 0xff;
+    }
+  }
+  return 0;
+}
+
+/* Function to handle the OUT op of a Space Invaders machine
+  Input: state8080 struct, port number, value written
+  Output: void
+  Sound and watchdog ports are ignored
+*/
+void invadersOut(state8080* state, uint8_t port, uint8_t value) {
+  invadersMachine *machine = state->userData;
+  switch(port) {
+    case 2:
+      machine->shiftOffset = value & 0x07;
+      break;
+    case 4:
+      machine->shift0 = machine->shift1;
+      machine->shift1 = value;
+      break;
+  }
+}
+
+/* Function to set up a Space Invaders machine
+  Input: machine to fill in, arena to make its state in
+  Output: void
+  Reads invaders.h, .g, .f and .e from the working directory
+*/
+void initializeInvaders(invadersMachine* machine, stateArena* arena) {
+  memset(machine, 0, sizeof(invadersMachine));
+  machine->state = arenaState(arena);
+  machine->state->inPort = invadersIn;
+  machine->state->outPort = invadersOut;
+  machine->state->userData = machine;
+  machine->numInterrupt = 1;
+  machine->nextInterrupt = CYCLES_PER_FRAME / 2;
+  mapMemory(machine->state, spaceInvadersMap, SPACE_INVADERS_REGIONS);
+  mapRomFile(machine->state, "invaders.h", 0x0000);
+  mapRomFile(machine->state, "invaders.g", 0x0800);
+  mapRomFile(machine->state, "invaders.f", 0x1000);
+  mapRomFile(machine->state, "invaders.e", 0x1800);
+}
+
+/* Function to set the buttons held down on a machine
+  Input: machine, INVADERS_ bits of the buttons
+  Output: void
+  Fire, left and right go to both players, since the game only reads
+  the buttons of the player whose turn it is. The DIP switches on
+  port 2 are kept.
+*/
+void setInvadersButtons(invadersMachine* machine, uint8_t buttons) {
+  machine->port1 = buttons | INVADERS_PORT1_HIGH;
+  machine->port2 = (machine->port2 & ~INVADERS_PLAYER_BUTTONS) | (buttons & INVADERS_PLAYER_BUTTONS);
+}
+
+/* Function to run a machine for one 60Hz frame
+  Input: machine
+  Output: void
+  The video hardware raises RST 1 at mid screen and RST 2 at the end.
+  Frames end on whole multiples of CYCLES_PER_FRAME, so a run that
+  overshoots one frame makes the next one shorter.
+*/
+void runInvadersFrame(invadersMachine* machine) {
+  unsigned long frameEnd = (machine->frames + 1) * CYCLES_PER_FRAME;
+  for(;;) {
+    while(machine->cyclesRun >= machine->nextInterrupt) {
+      requestInterrupt(machine->state, machine->numInterrupt);
+      if(machine->numInterrupt == 1) {
+        machine->numInterrupt = 2;
+        machine->nextInterrupt += CYCLES_PER_FRAME - CYCLES_PER_FRAME / 2;
+      } else {
+        machine->numInterrupt = 1;
+        machine->nextInterrupt += CYCLES_PER_FRAME / 2;
+      }
+    }
+    if(machine->cyclesRun >= frameEnd) {
+      break;
+    }
+    machine->cyclesRun += runCycles(machine->state,
+      (machine->nextInterrupt < frameEnd ? machine->nextInterrupt : frameEnd) - machine->cyclesRun);
+  }
+  machine->frames++;
+}
+
+#include"saveStates.c"
+#include"rewindBuffer.c"
@@ -0,0 +1,459 @@
+/* x86-64 dynamic recompiler for the 8080 emulator
+  Jack R. McCluskey
+
+  Translates hot basic blocks from blockCache.c into native code.
+  While a compiled block runs, A, B, C, D, E, H and L live in host
+  registers r8 to r14, and the host flags stand in for Z, S, P and CY.
+  Memory and I/O go through the same writeToMemory, readFromMemory,
+  writeToPort and readFromPort functions the interpreter uses.
+  Each block is compiled from its first op up to the first op the
+  recompiler can't handle, and the interpreter runs the rest.
+  Included by emulatorShell.c when built with JIT_RECOMPILER.
+*/
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+#if !defined(__x86_64__)
+#error "JIT_RECOMPILER only supports x86-64 hosts"
+#endif
+
+#ifndef JIT_HOT_RUNS
+#define JIT_HOT_RUNS 16 // Runs of a block before it gets compiled
+#endif
+#define JIT_BUFFER_SIZE 0x100000
+#define JIT_MAX_BLOCK_BYTES 0x2000 // Worst case code for one block
+
+// Host flag bits as saved by pushfq
+#define HOST_CF 0x01
+#define HOST_PF 0x04
+#define HOST_ZF 0x40
+#define HOST_SF 0x80
+
+// Host register for each 8080 register code, B C D E H L M A
+int hostRegs[8] = { 9, 10, 11, 12, 13, 14, -1, 8 };
+
+// Offset of each host register's 8080 register in state8080, r8 to r14
+int regOffsets[7] = {
+  offsetof(state8080, a), offsetof(state8080, b), offsetof(state8080, c),
+  offsetof(state8080, d), offsetof(state8080, e), offsetof(state8080, h),
+  offsetof(state8080, l)
+};
+
+// x86 ALU op for each 8080 ALU op, ADD ADC SUB SBB ANA XRA ORA CMP
+int aluOps[8] = { 0, 2, 5, 3, 4, 6, 1, 7 };
+
+/* Struct for the code buffer a block is being written into
+  exits are the jumps to the flush exit, patched once it is placed
+*/
+typedef struct jitAssembler {
+  uint8_t *code;
+  size_t used;
+  size_t exits[BLOCK_MAX_OPS];
+  int numExits;
+} jitAssembler;
+
+/* Helper functions for writing instruction bytes
+  Input: assembler, value to write
+  Output: void
+*/
+void emitByte(jitAssembler* as, uint8_t value) {
+  as->code[as->used++] = value;
+}
+
+void emitBytes(jitAssembler* as, int count, uint8_t b0, uint8_t b1, uint8_t b2, uint8_t b3) {
+  uint8_t bytes[4] = { b0, b1, b2, b3 };
+  int i;
+  for(i = 0; i < count; i++) {
+    emitByte(as, bytes[i]);
+  }
+}
+
+void emitWord(jitAssembler* as, uint16_t value) {
+  emitByte(as, value & 0xff);
+  emitByte(as, value >> 8);
+}
+
+void emitQuad(jitAssembler* as, uint64_t value) {
+  int i;
+  for(i = 0; i < 8; i++) {
+    emitByte(as, (value >> (8 * i)) & 0xff);
+  }
+}
+
+/* Function to load the 8080 registers from state into host registers
+  Input: assembler
+  Output: void
+  Emits movzx r8d..r14d, byte [r15 + offset]
+*/
+void emitLoadRegisters(jitAssembler* as) {
+  int i;
+  for(i = 0; i < 7; i++) {
+    emitBytes(as, 4, 0x45, 0x0f, 0xb6, 0x47 | (i << 3));
+    emitByte(as, regOffsets[i]);
+  }
+}
+
+/* Function to store the host registers back into state
+  Input: assembler
+  Output: void
+  Emits mov byte [r15 + offset], r8b..r14b
+*/
+void emitStoreRegisters(jitAssembler* as) {
+  int i;
+  for(i = 0; i < 7; i++) {
+    emitBytes(as, 3, 0x45, 0x88, 0x47 | (i << 3), 0);
+    emitByte(as, regOffsets[i]);
+  }
+}
+
+/* Function to emit a call to one of the interpreter's C functions
+  Input: assembler, function, program counter of the op making the call
+  Output: void
+  The caller loads esi, edx and ecx first. The registers are spilled
+  to state so the callee sees them, and the host flags are kept
+*/
+void emitCall(jitAssembler* as, void* function, uint16_t pc) {
+  emitStoreRegisters(as);
+  // mov word [r15 + pc], pc
+  emitBytes(as, 4, 0x66, 0x41, 0xc7, 0x47);
+  emitByte(as, offsetof(state8080, pc));
+  emitWord(as, pc);
+  emitByte(as, 0x9c); // pushfq
+  emitBytes(as, 4, 0x48, 0x83, 0xec, 0x08); // sub rsp, 8
+  emitBytes(as, 3, 0x4c, 0x89, 0xff, 0); // mov rdi, r15
+  emitBytes(as, 2, 0x48, 0xb8, 0, 0); // mov rax, function
+  emitQuad(as, (uint64_t) (uintptr_t) function);
+  emitBytes(as, 2, 0xff, 0xd0, 0, 0); // call rax
+  emitBytes(as, 4, 0x48, 0x83, 0xc4, 0x08); // add rsp, 8
+  emitByte(as, 0x9d); // popfq
+  emitLoadRegisters(as);
+}
+
+/* Function to emit a store through writeToMemory
+  Input: assembler, program counter of the op
+  Output: void
+  The caller loads the arguments. If the store flushed the blocks, the
+  code jumps to the flush exit with pc still on the op, so the rest of
+  the block isn't run from its stale copy.
+*/
+void emitStore(jitAssembler* as, uint16_t pc) {
+  emitCall(as, (void*) writeToMemory, pc);
+  emitByte(as, 0x9c); // pushfq
+  // mov rax, [r15 + blockCache]
+  emitBytes(as, 3, 0x49, 0x8b, 0x87, 0);
+  emitWord(as, offsetof(state8080, blockCache) & 0xffff);
+  emitWord(as, offsetof(state8080, blockCache) >> 16);
+  // cmp dword [rax + numBlocks], 0
+  emitBytes(as, 2, 0x83, 0xb8, 0, 0);
+  emitWord(as, offsetof(blockCache, numBlocks) & 0xffff);
+  emitWord(as, offsetof(blockCache, numBlocks) >> 16);
+  emitByte(as, 0);
+  // je flush exit, rel32 patched by jitCompileBlock
+  emitBytes(as, 2, 0x0f, 0x84, 0, 0);
+  as->exits[as->numExits++] = as->used;
+  emitWord(as, 0);
+  emitWord(as, 0);
+  emitByte(as, 0x9d); // popfq
+}
+
+/* Helper functions for loading C call arguments
+  Input: assembler, host register or immediate value
+  Output: void
+  Argument numbers 1, 2 and 3 are esi, edx and ecx
+*/
+int argRegs[4] = { 7, 6, 2, 1 };
+
+void emitArgRegister(jitAssembler* as, int arg, int host) {
+  // movzx arg, host
+  emitBytes(as, 4, 0x41, 0x0f, 0xb6, 0xc0 | (argRegs[arg] << 3) | (host & 7));
+}
+
+void emitArgImmediate(jitAssembler* as, int arg, uint32_t value) {
+  // mov arg, imm32
+  emitByte(as, 0xb8 | argRegs[arg]);
+  emitWord(as, value & 0xffff);
+  emitWord(as, value >> 16);
+}
+
+/* Function to move a call's result in al into a host register
+  Input: assembler, host register
+  Output: void
+*/
+void emitResult(jitAssembler* as, int host) {
+  emitBytes(as, 3, 0x41, 0x88, 0xc0 | (host & 7), 0);
+}
+
+/* Function to compile one op
+  Input: assembler, decoded op, program counter of the op
+  Output: 1 if the op could be compiled, 0 if it has to be interpreted
+  Sets *setsFlags when the op leaves Z, S and P in the host flags
+*/
+int compileOp(jitAssembler* as, decodedOp* op, uint16_t pc, int* setsFlags) {
+  uint8_t code = op->opCode;
+  int dst = hostRegs[(code >> 3) & 7];
+  int src = hostRegs[code & 7];
+  int a = hostRegs[7];
+
+  // MOV, with the memory forms going through the interpreter's functions
+  if(code >= 0x40 && code <= 0x7f && code != 0x76) {
+    if(dst < 0) {
+      emitArgRegister(as, 1, src);
+      emitArgRegister(as, 2, hostRegs[4]);
+      emitArgRegister(as, 3, hostRegs[5]);
+      emitStore(as, pc);
+    } else if(src < 0) {
+      emitArgRegister(as, 1, hostRegs[4]);
+      emitArgRegister(as, 2, hostRegs[5]);
+      emitCall(as, (void*) readFromMemory, pc);
+      emitResult(as, dst);
+    } else {
+      emitBytes(as, 3, 0x45, 0x88, 0xc0 | ((src & 7) << 3) | (dst & 7), 0);
+    }
+    return 1;
+  }
+
+  // ADD, ADC, SUB, SBB, ANA, XRA, ORA and CMP
+  if(code >= 0x80 && code <= 0xbf) {
+    uint8_t aluOp = aluOps[(code >> 3) & 7] << 3;
+    if(src < 0) {
+      emitArgRegister(as, 1, hostRegs[4]);
+      emitArgRegister(as, 2, hostRegs[5]);
+      emitCall(as, (void*) readFromMemory, pc);
+      // op a, al
+      emitBytes(as, 3, 0x41, aluOp, 0xc0 | (a & 7), 0);
+    } else {
+      emitBytes(as, 3, 0x45, aluOp, 0xc0 | ((src & 7) << 3) | (a & 7), 0);
+    }
+    *setsFlags = 1;
+    return 1;
+  }
+
+  switch(code) {
+    case 0x00: case 0x08: case 0x10: case 0x18: case 0x20: case 0x28:
+    case 0x30: case 0x38: case 0xcb: case 0xd9: case 0xdd: case 0xed:
+    case 0xfd:
+      return 1; // NOP
+
+    case 0x04: case 0x0c: case 0x14: case 0x1c: case 0x24: case 0x2c:
+    case 0x3c: // INR r
+    case 0x05: case 0x0d: case 0x15: case 0x1d: case 0x25: case 0x2d:
+    case 0x3d: // DCR r
+      emitBytes(as, 3, 0x41, 0xfe, 0xc0 | ((code & 1) << 3) | (dst & 7), 0);
+      *setsFlags = 1;
+      return 1;
+
+    case 0x06: case 0x0e: case 0x16: case 0x1e: case 0x26: case 0x2e:
+    case 0x3e: // MVI r
+      emitBytes(as, 3, 0x41, 0xb0 | (dst & 7), op->operand & 0xff, 0);
+      return 1;
+
+    case 0x36: // MVI M
+      emitArgImmediate(as, 1, op->operand & 0xff);
+      emitArgRegister(as, 2, hostRegs[4]);
+      emitArgRegister(as, 3, hostRegs[5]);
+      emitStore(as, pc);
+      return 1;
+
+    case 0x01: case 0x11: case 0x21: { // LXI B, D, H
+      int hi = hostRegs[(code >> 3) & 6];
+      int lo = hostRegs[((code >> 3) & 6) + 1];
+      emitBytes(as, 3, 0x41, 0xb0 | (lo & 7), op->operand & 0xff, 0);
+      emitBytes(as, 3, 0x41, 0xb0 | (hi & 7), op->operand >> 8, 0);
+      return 1;
+    }
+
+    case 0x03: case 0x13: case 0x23: // INX B, D, H
+    case 0x0b: case 0x1b: case 0x2b: { // DCX B, D, H
+      int hi = hostRegs[(code >> 3) & 6];
+      int lo = hostRegs[((code >> 3) & 6) + 1];
+      int decrement = code & 0x08;
+      emitByte(as, 0x9c); // pushfq
+      // add/sub lo, 1 then adc/sbb hi, 0
+      emitBytes(as, 4, 0x41, 0x80, (decrement ? 0xe8 : 0xc0) | (lo & 7), 1);
+      emitBytes(as, 4, 0x41, 0x80, (decrement ? 0xd8 : 0xd0) | (hi & 7), 0);
+      emitByte(as, 0x9d); // popfq
+      return 1;
+    }
+
+    case 0x02: case 0x12: // STAX B, D
+      emitArgRegister(as, 1, a);
+      emitArgRegister(as, 2, hostRegs[(code >> 3) & 6]);
+      emitArgRegister(as, 3, hostRegs[((code >> 3) & 6) + 1]);
+      emitStore(as, pc);
+      return 1;
+
+    case 0x0a: case 0x1a: // LDAX B, D
+      emitArgRegister(as, 1, hostRegs[(code >> 3) & 6]);
+      emitArgRegister(as, 2, hostRegs[((code >> 3) & 6) + 1]);
+      emitCall(as, (void*) readFromMemory, pc);
+      emitResult(as, a);
+      return 1;
+
+    case 0x32: // STA adr
+      emitArgRegister(as, 1, a);
+      emitArgImmediate(as, 2, op->operand >> 8);
+      emitArgImmediate(as, 3, op->operand & 0xff);
+      emitStore(as, pc);
+      return 1;
+
+    case 0x3a: // LDA adr
+      emitArgImmediate(as, 1, op->operand >> 8);
+      emitArgImmediate(as, 2, op->operand & 0xff);
+      emitCall(as, (void*) readFromMemory, pc);
+      emitResult(as, a);
+      return 1;
+
+    case 0xd3: // OUT D8
+      emitArgImmediate(as, 1, op->operand & 0xff);
+      emitArgRegister(as, 2, a);
+      emitCall(as, (void*) writeToPort, pc);
+      return 1;
+
+    case 0xdb: // IN D8
+      emitArgImmediate(as, 1, op->operand & 0xff);
+      emitCall(as, (void*) readFromPort, pc);
+      emitResult(as, a);
+      return 1;
+
+    case 0xc6: case 0xce: case 0xd6: case 0xde: // ADI, ACI, SUI, SBI
+    case 0xe6: case 0xee: case 0xf6: case 0xfe: // ANI, XRI, ORI, CPI
+      emitBytes(as, 4, 0x41, 0x80, 0xc0 | (aluOps[(code >> 3) & 7] << 3) | (a & 7), op->operand & 0xff);
+      *setsFlags = 1;
+      return 1;
+
+    case 0x07: // RLC
+    case 0x0f: // RRC
+    case 0x17: // RAL
+      emitBytes(as, 3, 0x41, 0xd0, 0xc0 | (code & 0x18) | (a & 7), 0);
+      return 1;
+
+    case 0x2f: // CMA
+      emitBytes(as, 3, 0x41, 0xf6, 0xd0 | (a & 7), 0);
+      return 1;
+
+    case 0x37: emitByte(as, 0xf9); return 1; // STC
+
+    case 0x3f: emitByte(as, 0xf5); return 1; // CMC
+
+    case 0xeb: // XCHG
+      emitBytes(as, 3, 0x45, 0x86, 0xc0 | ((hostRegs[2] & 7) << 3) | (hostRegs[4] & 7), 0);
+      emitBytes(as, 3, 0x45, 0x86, 0xc0 | ((hostRegs[3] & 7) << 3) | (hostRegs[5] & 7), 0);
+      return 1;
+  }
+  return 0;
+}
+
+/* Function to compile the start of a block into native code
+  Input: state8080 struct, block to compile
+  Output: 1 if at least one op was compiled, 0 otherwise
+  The generated function takes the state and CY, and returns the host
+  flags at the end of the compiled ops
+*/
+int jitCompileBlock(state8080* state, codeBlock* block) {
+  blockCache *cache = state->blockCache;
+  jitAssembler as;
+  uint16_t pc = block->start;
+  int setsFlags = 0;
+  int i, j;
+
+  if(cache->jitBuffer == NULL || JIT_BUFFER_SIZE - cache->jitUsed < JIT_MAX_BLOCK_BYTES) {
+    return 0;
+  }
+  as.code = cache->jitBuffer + cache->jitUsed;
+  as.used = 0;
+  as.numExits = 0;
+
+  // Prologue, keep the callee saved registers and align the stack
+  emitBytes(&as, 4, 0x41, 0x54, 0x41, 0x55); // push r12, r13
+  emitBytes(&as, 4, 0x41, 0x56, 0x41, 0x57); // push r14, r15
+  emitBytes(&as, 4, 0x48, 0x83, 0xec, 0x08); // sub rsp, 8
+  emitBytes(&as, 3, 0x49, 0x89, 0xff, 0); // mov r15, rdi
+  emitLoadRegisters(&as);
+  // Put CY into the host carry flag, mov eax, esi then add al, 0xff
+  emitBytes(&as, 4, 0x89, 0xf0, 0x04, 0xff);
+
+  block->jitUsesPorts = 0;
+  block->jitFlagsOp = -1;
+  for(i = 0; i < block->numOps; i++) {
+    if(!compileOp(&as, &block->ops[i], pc, &setsFlags)) {
+      break;
+    }
+    if(setsFlags && block->jitFlagsOp < 0) {
+      block->jitFlagsOp = i;
+    }
+    if(block->ops[i].opCode == 0xd3 || block->ops[i].opCode == 0xdb) {
+      block->jitUsesPorts = 1;
+    }
+    pc += block->ops[i].length;
+  }
+  if(i == 0) {
+    return 0;
+  }
+
+  // Flush exit, drops the flags a store pushed, then the epilogue
+  emitBytes(&as, 2, 0xeb, 0x01, 0, 0); // jmp over it
+  for(j = 0; j < as.numExits; j++) {
+    int32_t offset = as.used - (as.exits[j] + 4);
+    memcpy(&as.code[as.exits[j]], &offset, sizeof(offset));
+  }
+  emitByte(&as, 0x9d); // popfq
+
+  // Epilogue, return the host flags in eax
+  emitBytes(&as, 2, 0x9c, 0x58, 0, 0); // pushfq, pop rax
+  emitStoreRegisters(&as);
+  emitBytes(&as, 4, 0x48, 0x83, 0xc4, 0x08); // add rsp, 8
+  emitBytes(&as, 4, 0x41, 0x5f, 0x41, 0x5e); // pop r15, r14
+  emitBytes(&as, 4, 0x41, 0x5d, 0x41, 0x5c); // pop r13, r12
+  emitByte(&as, 0xc3); // ret
+
+  block->jitCode = (int (*)(state8080*, int)) (void*) as.code;
+  block->jitOps = i;
+  block->jitEnd = pc;
+  cache->jitUsed += as.used;
+  return 1;
+}
+
+/* Function to run the compiled part of a block
+  Input: state8080 struct, compiled block
+  Output: number of ops run
+  Leaves the program counter on the first op left for the interpreter.
+  That is the op after a store that flushed the blocks, if one did.
+*/
+int runCompiledBlock(state8080* state, codeBlock* block) {
+  int flags = block->jitCode(state, getCarry(state));
+  int ops = block->jitOps;
+  if(state->blockCache->numBlocks == 0) {
+    // The code left through the flush exit, pc is on the store
+    ops = opsBefore(block, state->pc) + 1;
+    state->pc += block->ops[ops - 1].length;
+  } else {
+    state->pc = block->jitEnd;
+  }
+  if(block->jitFlagsOp >= 0 && block->jitFlagsOp < ops) {
+    state->cc.z = (flags & HOST_ZF) != 0;
+    state->cc.s = (flags & HOST_SF) != 0;
+    // The interpreter's parity flag is set for odd parity
+    state->cc.p = (flags & HOST_PF) == 0;
+    state->lazyFlags &= ~LAZY_SZP;
+  }
+  setCarry(state, flags & HOST_CF);
+  return ops;
+}
+
+/* Function to allocate the executable buffer for compiled blocks
+  Input: number of JIT_BUFFER_SIZE buffers to map together
+  Output: pointer to the first buffer, NULL if the host refuses
+*/
+uint8_t* createJitBuffer(int buffers) {
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_JIT
+  flags |= MAP_JIT;
+#endif
+  void *buffer = mmap(NULL, (size_t) buffers * JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, flags, -1, 0);
+  if(buffer == MAP_FAILED) {
+    printf("JIT buffer unavailable, interpreting only.\n");
+    return NULL;
+  }
+  return buffer;
+}
@@ -0,0 +1,586 @@
+/* Lockstep engine for running many 8080 machines at once
+  Jack R. McCluskey
+
+  Keeps the registers of up to LOCKSTEP_LANES machines as vectors, one
+  lane per machine, and runs each op once for every lane that has the
+  same program counter. Copies of the same ROM mostly do, so register
+  and ALU ops cost one vector op for all of them. Memory ops read and
+  write each lane's own memory, and ops without a vector version run on
+  the scalar engine for one lane at a time. Code is only run in
+  lockstep from pages every lane reads from the same place, like a
+  shared mapRomFile, since RAM may hold different code in each lane.
+  Uses the GCC/Clang vector extensions, so the compiler picks SSE, AVX2
+  or AVX-512 for the lane width. Included by emulatorShell.c when built
+  with LOCKSTEP.
+*/
+
+#ifndef __GNUC__
+#error "LOCKSTEP needs the GCC/Clang vector extensions"
+#endif
+#ifdef BLOCK_CACHE
+#error "LOCKSTEP can't be used with BLOCK_CACHE, blocks overrun the lanes' budgets"
+#endif
+
+#ifndef LOCKSTEP_LANES
+#define LOCKSTEP_LANES 16 // A multiple of 8
+#endif
+
+typedef uint8_t laneBytes __attribute__((vector_size(LOCKSTEP_LANES)));
+typedef uint16_t laneWords __attribute__((vector_size(LOCKSTEP_LANES * 2)));
+typedef int32_t laneInts __attribute__((vector_size(LOCKSTEP_LANES * 4)));
+
+// Register indexes, in the order ops encode them
+#define LANE_B 0
+#define LANE_C 1
+#define LANE_D 2
+#define LANE_E 3
+#define LANE_H 4
+#define LANE_L 5
+#define LANE_M 6 // Memory at HL, has no register
+#define LANE_A 7
+
+// Lane masks are 0xff for the lanes an op runs on and 0 for the rest
+#define LANE_MASK(compare) ((laneBytes) (compare))
+#define WORD_MASK(mask) (__builtin_convertvector((mask), laneWords) * 0x0101)
+#define INT_MASK(mask) ((laneInts) (__builtin_convertvector((mask), laneInts) * 0x01010101))
+#define BLEND(mask, value, old) (((value) & (mask)) | ((old) & ~(mask)))
+#define WIDEN(bytes) __builtin_convertvector((bytes), laneWords)
+#define NARROW(words) __builtin_convertvector((words), laneBytes)
+#define PAIR(high, low) ((WIDEN(high) << 8) | WIDEN(low))
+
+/* Struct holding the registers of a group of machines, one per lane
+  Flags are kept as a byte per lane, 0 or 1. The state8080 structs keep
+  each machine's memory, ports and interrupts, and its registers while
+  the scalar engine runs it.
+*/
+typedef struct lockstepGroup {
+  laneBytes regs[8]; // B, C, D, E, H, L, unused, A
+  laneBytes z, s, p, cy, ac;
+  laneWords sp, pc;
+  laneInts cyclesRun; // Cycles each lane ran in the last runLockstep
+  laneBytes present; // 0xff for lanes that hold a machine
+  state8080 *states[LOCKSTEP_LANES];
+  int numLanes;
+  uint8_t codeShared[MEMORY_PAGES + 1]; // Pages every lane reads from the same place
+  unsigned long vectorSteps; // Ops run for a whole mask of lanes
+  unsigned long laneOps; // Lane ops run by those steps
+  unsigned long scalarOps; // Ops run by the scalar engine for one lane
+} lockstepGroup;
+
+/* Function to make an empty lockstep group
+  Input: void
+  Output: lockstepGroup, to fill with lockstepAdd
+*/
+lockstepGroup* createLockstepGroup() {
+  lockstepGroup *group = aligned_alloc(64, (sizeof(lockstepGroup) + 63) & ~(size_t) 63);
+  if(group == NULL) {
+    printf("ERROR: Couldn't allocate a lockstep group\n");
+    exit(1);
+  }
+  memset(group, 0, sizeof(lockstepGroup));
+  return group;
+}
+
+/* Helper function to copy a lane's registers out to its state
+  Input: lockstepGroup, lane
+  Output: void
+*/
+void lockstepExport(lockstepGroup* group, int lane) {
+  state8080 *state = group->states[lane];
+  state->b = group->regs[LANE_B][lane];
+  state->c = group->regs[LANE_C][lane];
+  state->d = group->regs[LANE_D][lane];
+  state->e = group->regs[LANE_E][lane];
+  state->h = group->regs[LANE_H][lane];
+  state->l = group->regs[LANE_L][lane];
+  state->a = group->regs[LANE_A][lane];
+  state->cc.z = group->z[lane];
+  state->cc.s = group->s[lane];
+  state->cc.p = group->p[lane];
+  state->cc.cy = group->cy[lane];
+  state->cc.ac = group->ac[lane];
+  state->lazyFlags = 0;
+  state->sp = group->sp[lane];
+  state->pc = group->pc[lane];
+}
+
+/* Helper function to copy a lane's registers in from its state
+  Input: lockstepGroup, lane
+  Output: void
+*/
+void lockstepImport(lockstepGroup* group, int lane) {
+  state8080 *state = group->states[lane];
+  syncFlags(state);
+  group->regs[LANE_B][lane] = state->b;
+  group->regs[LANE_C][lane] = state->c;
+  group->regs[LANE_D][lane] = state->d;
+  group->regs[LANE_E][lane] = state->e;
+  group->regs[LANE_H][lane] = state->h;
+  group->regs[LANE_L][lane] = state->l;
+  group->regs[LANE_A][lane] = state->a;
+  group->z[lane] = state->cc.z;
+  group->s[lane] = state->cc.s;
+  group->p[lane] = state->cc.p;
+  group->cy[lane] = state->cc.cy;
+  group->ac[lane] = state->cc.ac;
+  group->sp[lane] = state->sp;
+  group->pc[lane] = state->pc;
+}
+
+/* Function to copy every lane's registers out to its state
+  Input: lockstepGroup
+  Output: void
+  States hold the registers of their last runLockstep already, this is
+  for states changed by hand before the next one
+*/
+void lockstepSyncStates(lockstepGroup* group) {
+  int lane;
+  for(lane = 0; lane < group->numLanes; lane++) {
+    lockstepExport(group, lane);
+  }
+}
+
+/* Helper function to find the pages all lanes run the same code from
+  Input: lockstepGroup
+  Output: void
+  Called again by runLockstep, since mapRomFile and mapMemory can
+  change where pages are read from
+*/
+void findSharedCode(lockstepGroup* group) {
+  int page, lane;
+  for(page = 0; page <= MEMORY_PAGES; page++) {
+    group->codeShared[page] = 1;
+    for(lane = 1; lane < group->numLanes; lane++) {
+      if(group->states[lane]->readPages[page] != group->states[0]->readPages[page]) {
+        group->codeShared[page] = 0;
+        break;
+      }
+    }
+  }
+}
+
+/* Function to add a machine to a lockstep group
+  Input: lockstepGroup, state8080 struct
+  Output: lane of the machine, -1 if the group is full
+  The group takes the state's registers, which runLockstep copies back
+  after every run
+*/
+int lockstepAdd(lockstepGroup* group, state8080* state) {
+  int lane = group->numLanes;
+  if(lane == LOCKSTEP_LANES) {
+    return -1;
+  }
+  group->states[lane] = state;
+  group->present[lane] = 0xff;
+  group->numLanes++;
+  lockstepImport(group, lane);
+  return lane;
+}
+
+/* Helper function to count the lanes of a mask
+  Input: lane mask
+  Output: number of lanes set
+*/
+int countLanes(laneBytes mask) {
+  uint64_t words[LOCKSTEP_LANES / 8];
+  int i, count = 0;
+  memcpy(words, &mask, sizeof(words));
+  for(i = 0; i < LOCKSTEP_LANES / 8; i++) {
+    count += __builtin_popcountll(words[i]);
+  }
+  return count / 8;
+}
+
+/* Helper function to set the zero, sign and parity flags of results
+  Input: lockstepGroup, results, lane mask
+  Output: void
+*/
+void lockstepZSP(lockstepGroup* group, laneBytes result, laneBytes mask) {
+  laneBytes parity = result ^ (result >> 4);
+  parity ^= parity >> 2;
+  parity ^= parity >> 1;
+  group->z = BLEND(mask, LANE_MASK(result == 0) & 1, group->z);
+  group->s = BLEND(mask, result >> 7, group->s);
+  group->p = BLEND(mask, parity & 1, group->p);
+}
+
+/* Helper function to run an 8080 ALU op on every lane of a mask
+  Input: lockstepGroup, ALU op (ADD ADC SUB SBB ANA XRA ORA CMP),
+    operands, lane mask
+  Output: void
+  Works on 16 bits like the scalar handlers, carry is anything over 0xff
+*/
+void lockstepAlu(lockstepGroup* group, int aluOp, laneBytes operand, laneBytes mask) {
+  laneWords a = WIDEN(group->regs[LANE_A]);
+  laneWords value = WIDEN(operand);
+  laneWords carry = WIDEN(group->cy);
+  laneWords val;
+  switch(aluOp) {
+    case 0: val = a + value; break; // ADD
+    case 1: val = a + value + carry; break; // ADC
+    case 2: val = a - value; break; // SUB
+    case 3: val = a - value - carry; break; // SBB
+    case 4: val = a & value; break; // ANA
+    case 5: val = a ^ value; break; // XRA
+    case 6: val = a | value; break; // ORA
+    default: val = a - value; break; // CMP
+  }
+  lockstepZSP(group, NARROW(val), mask);
+  group->cy = BLEND(mask, NARROW((laneWords) (val > 0xff) & 1), group->cy);
+  if(aluOp != 7) {
+    group->regs[LANE_A] = BLEND(mask, NARROW(val), group->regs[LANE_A]);
+  }
+}
+
+/* Helper function to read a byte from each lane's memory
+  Input: lockstepGroup, addresses, lane mask
+  Output: bytes read, 0 for lanes outside the mask
+*/
+laneBytes lockstepGather(lockstepGroup* group, laneWords address, laneBytes mask) {
+  laneBytes value = { 0 };
+  int lane;
+  for(lane = 0; lane < LOCKSTEP_LANES; lane++) {
+    if(mask[lane]) {
+      state8080 *state = group->states[lane];
+      value[lane] = READ_BYTE(address[lane]);
+    }
+  }
+  return value;
+}
+
+/* Helper function to write a byte to each lane's memory
+  Input: lockstepGroup, addresses, bytes, lane mask, whether the write
+    goes through writeToMemory as it does in the scalar handler
+  Output: void
+*/
+void lockstepScatter(lockstepGroup* group, laneWords address, laneBytes value, laneBytes mask, int checked) {
+  int lane;
+  for(lane = 0; lane < LOCKSTEP_LANES; lane++) {
+    if(mask[lane]) {
+      state8080 *state = group->states[lane];
+      if(checked) {
+        writeToMemory(state, value[lane], address[lane] >> 8, address[lane] & 0xff);
+      } else {
+        WRITE_BYTE(address[lane], value[lane]);
+      }
+    }
+  }
+}
+
+/* Helper function for the condition of a Jcc, Ccc or Rcc
+  Input: lockstepGroup, condition bits of the op, 1 for Rcc
+  Output: mask of the lanes the condition holds for
+  Matches the flags the scalar handlers test, RP tests carry
+*/
+laneBytes lockstepCondition(lockstepGroup* group, int condition, int isReturn) {
+  switch(condition) {
+    case 0: return LANE_MASK(group->z == 0); // NZ
+    case 1: return LANE_MASK(group->z == 1); // Z
+    case 2: return LANE_MASK(group->cy == 0); // NC
+    case 3: return LANE_MASK(group->cy == 1); // C
+    case 4: return LANE_MASK(group->p == 1); // PO
+    case 5: return LANE_MASK(group->p == 0); // PE
+    case 6: return isReturn ? LANE_MASK(group->cy == 0) : LANE_MASK(group->p == 0); // P
+    default: return LANE_MASK(group->s == 1); // M
+  }
+}
+
+/* Function to run one op for every lane of a mask
+  Input: lockstepGroup, lane mask, op bytes at the shared pc
+  Output: 1 if the op was run, 0 if it has no vector version
+  Moves pc on like FINISH_OP does, including the quirks of the scalar
+  branch handlers
+*/
+int lockstepOp(lockstepGroup* group, laneBytes mask, unsigned char* opCode) {
+  uint8_t op = opCode[0];
+  uint16_t data16 = (opCode[2] << 8) | opCode[1];
+  int dst = (op >> 3) & 7;
+  int src = op & 7;
+  laneWords wordMask = WORD_MASK(mask);
+  laneWords nextPc = group->pc + opLengths[op];
+  laneWords pair;
+
+  if(op >= 0x40 && op < 0x80 && op != 0x76) { // MOV
+    laneBytes value;
+    if(src == LANE_M) {
+      value = lockstepGather(group, PAIR(group->regs[LANE_H], group->regs[LANE_L]), mask);
+    } else {
+      value = group->regs[src];
+    }
+    if(dst == LANE_M) {
+      lockstepScatter(group, PAIR(group->regs[LANE_H], group->regs[LANE_L]), value, mask, 1);
+    } else {
+      group->regs[dst] = BLEND(mask, value, group->regs[dst]);
+    }
+  } else if(op >= 0x80 && op < 0xc0) { // ALU r
+    laneBytes value;
+    if(src == LANE_M) {
+      value = lockstepGather(group, PAIR(group->regs[LANE_H], group->regs[LANE_L]), mask);
+    } else {
+      value = group->regs[src];
+    }
+    lockstepAlu(group, dst, value, mask);
+  } else if((op & 0xc7) == 0xc6) { // ALU D8
+    laneBytes value = { 0 };
+    lockstepAlu(group, dst, value + opCode[1], mask);
+  } else if(op < 0x40 && (src == 4 || src == 5) && dst != LANE_M) { // INR, DCR
+    laneBytes value = group->regs[dst] + (uint8_t) (src == 4 ? 1 : 0xff);
+    lockstepZSP(group, value, mask);
+    group->regs[dst] = BLEND(mask, value, group->regs[dst]);
+  } else if(op < 0x40 && src == 6 && dst != LANE_M) { // MVI
+    laneBytes value = { 0 };
+    group->regs[dst] = BLEND(mask, value + opCode[1], group->regs[dst]);
+  } else if(op < 0x40 && (op & 0x0f) == 0x01) { // LXI
+    laneWords value = { 0 };
+    value += data16;
+    if(op == 0x31) {
+      group->sp = BLEND(wordMask, value, group->sp);
+    } else {
+      group->regs[dst] = BLEND(mask, NARROW(value >> 8), group->regs[dst]);
+      group->regs[dst + 1] = BLEND(mask, NARROW(value), group->regs[dst + 1]);
+    }
+  } else if(op < 0x40 && (op & 0x07) == 0x03) { // INX, DCX
+    uint16_t step = (op & 0x08) ? 0xffff : 1;
+    if((op & 0x30) == 0x30) {
+      group->sp = BLEND(wordMask, group->sp + step, group->sp);
+    } else {
+      int high = (op >> 3) & 6;
+      pair = PAIR(group->regs[high], group->regs[high + 1]) + step;
+      group->regs[high] = BLEND(mask, NARROW(pair >> 8), group->regs[high]);
+      group->regs[high + 1] = BLEND(mask, NARROW(pair), group->regs[high + 1]);
+    }
+  } else if(op < 0x40 && (op & 0x0f) == 0x09) { // DAD
+    laneWords hl = PAIR(group->regs[LANE_H], group->regs[LANE_L]);
+    laneWords value;
+    laneBytes carry;
+    if(op == 0x39) {
+      value = group->sp;
+    } else {
+      value = PAIR(group->regs[(op >> 3) & 6], group->regs[((op >> 3) & 6) + 1]);
+    }
+    pair = hl + value;
+    carry = NARROW((laneWords) (pair < hl) & 1);
+    if(op == 0x39) {
+      carry |= group->cy; // DAD SP leaves the carry set when there's none
+    }
+    group->cy = BLEND(mask, carry, group->cy);
+    group->regs[LANE_H] = BLEND(mask, NARROW(pair >> 8), group->regs[LANE_H]);
+    group->regs[LANE_L] = BLEND(mask, NARROW(pair), group->regs[LANE_L]);
+  } else if((op & 0xc7) == 0xc2 || op == 0xc3) { // Jcc, JMP
+    laneWords target = { 0 };
+    laneBytes taken = op == 0xc3 ? mask : lockstepCondition(group, dst, 0) & mask;
+    target += (uint16_t) (op == 0xc3 ? data16 + 3 : data16 + 1);
+    nextPc = BLEND(WORD_MASK(taken), target, nextPc);
+  } else if((op & 0xc7) == 0xc4 || op == 0xcd) { // Ccc, CALL
+    laneWords target = { 0 };
+    laneBytes taken = op == 0xcd ? mask : lockstepCondition(group, dst, 0) & mask;
+    laneWords takenWords = WORD_MASK(taken);
+    target += (uint16_t) (data16 + 1);
+    lockstepScatter(group, group->pc - 1, NARROW(group->pc >> 8), taken, 0);
+    lockstepScatter(group, group->pc - 2, NARROW(group->pc), taken, 0);
+    group->sp = BLEND(takenWords, group->sp + 2, group->sp);
+    nextPc = BLEND(takenWords, target, nextPc);
+  } else if((op & 0xc7) == 0xc0 || op == 0xc9) { // Rcc, RET
+    laneBytes taken = op == 0xc9 ? mask : lockstepCondition(group, dst, 1) & mask;
+    laneWords takenWords = WORD_MASK(taken);
+    laneWords target = PAIR(lockstepGather(group, group->sp + 1, taken),
+      lockstepGather(group, group->sp, taken)) + 1;
+    group->sp = BLEND(takenWords, group->sp + 2, group->sp);
+    nextPc = BLEND(takenWords, target, nextPc);
+  } else if((op & 0xcf) == 0xc5 && op != 0xf5) { // PUSH
+    int high = (op >> 3) & 6;
+    lockstepScatter(group, group->sp - 1, group->regs[high], mask, 0);
+    lockstepScatter(group, group->sp - 2, group->regs[high + 1], mask, 0);
+    group->sp = BLEND(wordMask, group->sp - 2, group->sp);
+  } else if((op & 0xcf) == 0xc1 && op != 0xf1) { // POP
+    int high = (op >> 3) & 6;
+    group->regs[high + 1] = BLEND(mask, lockstepGather(group, group->sp, mask), group->regs[high + 1]);
+    group->regs[high] = BLEND(mask, lockstepGather(group, group->sp + 1, mask), group->regs[high]);
+    group->sp = BLEND(wordMask, group->sp + 2, group->sp);
+  } else {
+    laneWords address = { 0 };
+    laneBytes a = group->regs[LANE_A];
+    switch(op) {
+      case 0x00: case 0x08: case 0x10: case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+      case 0xcb: case 0xd9: case 0xdd: case 0xed: case 0xfd:
+        break; // NOP
+      case 0x02: case 0x12: // STAX
+        lockstepScatter(group, PAIR(group->regs[dst & 6], group->regs[(dst & 6) + 1]), a, mask, 1);
+        break;
+      case 0x0a: case 0x1a: // LDAX
+        pair = PAIR(group->regs[dst & 6], group->regs[(dst & 6) + 1]);
+        group->regs[LANE_A] = BLEND(mask, lockstepGather(group, pair, mask), a);
+        break;
+      case 0x22: // SHLD
+        lockstepScatter(group, address + data16, group->regs[LANE_L], mask, 0);
+        lockstepScatter(group, address + (uint16_t) (data16 + 1), group->regs[LANE_H], mask, 0);
+        break;
+      case 0x2a: // LHLD
+        group->regs[LANE_L] = BLEND(mask, lockstepGather(group, address + data16, mask), group->regs[LANE_L]);
+        group->regs[LANE_H] = BLEND(mask,
+          lockstepGather(group, address + (uint16_t) (data16 + 1), mask), group->regs[LANE_H]);
+        break;
+      case 0x32: // STA
+        lockstepScatter(group, address + data16, a, mask, 1);
+        break;
+      case 0x3a: // LDA
+        group->regs[LANE_A] = BLEND(mask, lockstepGather(group, address + data16, mask), a);
+        break;
+      case 0x07: // RLC
+        group->regs[LANE_A] = BLEND(mask, (a << 1) | (a >> 7), a);
+        group->cy = BLEND(mask, a >> 7, group->cy);
+        break;
+      case 0x0f: // RRC
+        group->regs[LANE_A] = BLEND(mask, (a >> 1) | (a << 7), a);
+        group->cy = BLEND(mask, a & 1, group->cy);
+        break;
+      case 0x17: // RAL
+        group->regs[LANE_A] = BLEND(mask, (a << 1) | group->cy, a);
+        group->cy = BLEND(mask, a >> 7, group->cy);
+        break;
+      case 0x1f: // RAR, keeps bit 7 like the scalar handler
+        group->regs[LANE_A] = BLEND(mask, (a >> 1) | (a & 0x80), a);
+        group->cy = BLEND(mask, a & 1, group->cy);
+        break;
+      case 0x2f: // CMA
+        group->regs[LANE_A] = BLEND(mask, ~a, a);
+        break;
+      case 0x37: // STC
+        group->cy |= mask & 1;
+        break;
+      case 0x3f: // CMC
+        group->cy ^= mask & 1;
+        break;
+      case 0xe9: // PCHL
+        nextPc = BLEND(wordMask, PAIR(group->regs[LANE_H], group->regs[LANE_L]) + 1, nextPc);
+        break;
+      case 0xeb: { // XCHG
+        laneBytes h = group->regs[LANE_H], l = group->regs[LANE_L];
+        group->regs[LANE_H] = BLEND(mask, group->regs[LANE_D], h);
+        group->regs[LANE_L] = BLEND(mask, group->regs[LANE_E], l);
+        group->regs[LANE_D] = BLEND(mask, h, group->regs[LANE_D]);
+        group->regs[LANE_E] = BLEND(mask, l, group->regs[LANE_E]);
+        break;
+      }
+      case 0xf9: // SPHL
+        group->sp = BLEND(wordMask, PAIR(group->regs[LANE_H], group->regs[LANE_L]), group->sp);
+        break;
+      default:
+        return 0;
+    }
+  }
+  group->pc = BLEND(wordMask, nextPc, group->pc);
+  group->cyclesRun += INT_MASK(mask) & cycles[op];
+  return 1;
+}
+
+/* Helper function to run one op of a lane on the scalar engine
+  Input: lockstepGroup, lane, cycle budget of the run
+  Output: void
+  Takes a pending interrupt after IN, OUT and EI, where runCycles would
+*/
+void lockstepScalarOp(lockstepGroup* group, int lane, int budget) {
+  state8080 *state = group->states[lane];
+  uint8_t op;
+  lockstepExport(group, lane);
+  op = FETCH_BYTE(state->pc);
+  group->cyclesRun[lane] += emulateOps(state, 1);
+  if((op == 0xd3 || op == 0xdb || op == 0xfb) && group->cyclesRun[lane] < budget &&
+      state->interruptPending && state->intEnable) {
+    state->interruptPending = 0;
+    state->intEnable = 0;
+    generateInterrupt(state, state->interruptNumber);
+  }
+  lockstepImport(group, lane);
+  group->scalarOps++;
+}
+
+/* Function to run every machine of a group for a number of cycles
+  Input: lockstepGroup, number of cycles to run each machine for
+  Output: void
+  Each lane runs as runCycles would run it on its own, group->cyclesRun
+  holds the cycles each one ran. Lanes at the lowest pc run together,
+  so lanes that branched apart wait for each other to come back.
+*/
+void runLockstep(lockstepGroup* group, int budget) {
+  laneBytes running, mask;
+  laneInts zero = { 0 };
+  int lane, leader;
+  unsigned char opCode[3];
+  findSharedCode(group);
+  group->cyclesRun = zero;
+  for(lane = 0; lane < group->numLanes; lane++) {
+    state8080 *state = group->states[lane];
+    if(state->interruptPending && state->intEnable) {
+      state->interruptPending = 0;
+      state->intEnable = 0;
+      lockstepExport(group, lane);
+      generateInterrupt(state, state->interruptNumber);
+      lockstepImport(group, lane);
+    }
+  }
+
+  for(;;) {
+    running = group->present & __builtin_convertvector(group->cyclesRun < budget, laneBytes);
+    for(lane = 0; lane < group->numLanes; lane++) {
+      if(running[lane] && group->states[lane]->stopRequested) {
+        running[lane] = 0;
+      }
+    }
+    leader = -1;
+    for(lane = 0; lane < group->numLanes; lane++) {
+      if(running[lane] && (leader < 0 || group->pc[lane] < group->pc[leader])) {
+        leader = lane;
+      }
+    }
+    if(leader < 0) {
+      break;
+    }
+    // Run the lanes at the leader's pc until one branches apart or runs out
+    mask = running & NARROW((laneWords) (group->pc == group->pc[leader]));
+    for(;;) {
+      state8080 *state = group->states[leader];
+      uint16_t pc = group->pc[leader];
+      uint8_t op;
+      if(!group->codeShared[pc >> 8] || !group->codeShared[(uint16_t) (pc + 2) >> 8]) {
+        lockstepScalarOp(group, leader, budget);
+        break;
+      }
+      opCode[0] = FETCH_BYTE(pc);
+      opCode[1] = FETCH_BYTE(pc + 1);
+      opCode[2] = FETCH_BYTE(pc + 2);
+      op = opCode[0];
+      if(!lockstepOp(group, mask, opCode)) {
+        for(lane = 0; lane < LOCKSTEP_LANES; lane++) {
+          if(mask[lane]) {
+            lockstepScalarOp(group, lane, budget);
+          }
+        }
+        break;
+      }
+      group->vectorSteps++;
+      group->laneOps += countLanes(mask);
+      // Branches can split the lanes or bring them together, and lanes stop at their budget
+      if((op & 0xc7) == 0xc0 || (op & 0xc7) == 0xc2 || (op & 0xc7) == 0xc4 ||
+          op == 0xc3 || op == 0xc9 || op == 0xcd || op == 0xe9 ||
+          countLanes(mask & __builtin_convertvector(group->cyclesRun >= budget, laneBytes))) {
+        break;
+      }
+    }
+  }
+
+  for(lane = 0; lane < group->numLanes; lane++) {
+    lockstepExport(group, lane);
+    group->states[lane]->stopRequested = 0;
+  }
+}
+
+/* Function to print how well a group kept its lanes together
+  Input: lockstepGroup
+  Output: void
+*/
+void printLockstepStats(lockstepGroup* group) {
+  printf("Lockstep: %lu vector steps, %.2f lanes per step, %lu scalar ops\n",
+    group->vectorSteps, group->vectorSteps ? (double) group->laneOps / group->vectorSteps : 0.0,
+    group->scalarOps);
+}
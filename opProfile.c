@@ -0,0 +1,123 @@
+/* Op code sequence profiler for the 8080 emulator
+  Jack R. McCluskey
+
+  Counts how often each pair and triple of op codes runs back to back,
+  and prints the most common ones when the program exits. Used to pick
+  the sequences for fusedOps.c.
+  Included by emulatorShell.c when built with PROFILE_OPCODES.
+*/
+
+#define PROFILE_TRIPLE_SLOTS 0x10000 // Power of two
+#define PROFILE_REPORT_SIZE 20
+
+/* Struct for one counted op code triple
+  key is (first << 16) | (second << 8) | third, plus 1 << 24 when used
+*/
+typedef struct profileTriple {
+  uint32_t key;
+  unsigned long count;
+} profileTriple;
+
+unsigned long profilePairs[256][256];
+profileTriple profileTriples[PROFILE_TRIPLE_SLOTS];
+uint32_t profileHistory; // Last two op codes, plus 1 << 16 per valid op
+unsigned long profileDropped; // Triples that didn't fit in the table
+
+/* Function to count one op code
+  Input: op code that just ran
+  Output: void
+  Triples go in an open addressed hash table
+*/
+void profileOp(uint8_t opCode) {
+  uint8_t first = (profileHistory >> 8) & 0xff;
+  uint8_t second = profileHistory & 0xff;
+  int valid = profileHistory >> 16;
+
+  if(valid >= 1) {
+    profilePairs[second][opCode]++;
+  }
+  if(valid >= 2) {
+    uint32_t key = (1 << 24) | (first << 16) | (second << 8) | opCode;
+    uint32_t slot = (key * 2654435761u) & (PROFILE_TRIPLE_SLOTS - 1);
+    int probes;
+    for(probes = 0; probes < PROFILE_TRIPLE_SLOTS; probes++) {
+      profileTriple *triple = &profileTriples[slot];
+      if(triple->key == key || triple->key == 0) {
+        triple->key = key;
+        triple->count++;
+        break;
+      }
+      slot = (slot + 1) & (PROFILE_TRIPLE_SLOTS - 1);
+    }
+    if(probes == PROFILE_TRIPLE_SLOTS) {
+      profileDropped++;
+    }
+  }
+  profileHistory = ((valid < 2 ? valid + 1 : 2) << 16) | (second << 8) | opCode;
+}
+
+/* Struct holding the most common sequences, most common first
+*/
+typedef struct profileReport {
+  uint32_t keys[PROFILE_REPORT_SIZE];
+  unsigned long counts[PROFILE_REPORT_SIZE];
+  int size;
+} profileReport;
+
+/* Helper function to add a sequence to a report if it is common enough
+  Input: report, key of the sequence, times it ran
+  Output: void
+*/
+void addToReport(profileReport* report, uint32_t key, unsigned long count) {
+  int i;
+  if(count == 0) {
+    return;
+  }
+  if(report->size == PROFILE_REPORT_SIZE) {
+    if(count <= report->counts[PROFILE_REPORT_SIZE - 1]) {
+      return;
+    }
+    report->size--;
+  }
+  for(i = report->size; i > 0 && report->counts[i - 1] < count; i--) {
+    report->keys[i] = report->keys[i - 1];
+    report->counts[i] = report->counts[i - 1];
+  }
+  report->keys[i] = key;
+  report->counts[i] = count;
+  report->size++;
+}
+
+/* Function to print the most common pairs and triples
+  Input: void
+  Output: void
+  Registered with atexit by main
+*/
+void printOpProfile() {
+  profileReport pairs = { .size = 0 };
+  profileReport triples = { .size = 0 };
+  int i, j;
+
+  for(i = 0; i < 256; i++) {
+    for(j = 0; j < 256; j++) {
+      addToReport(&pairs, (i << 8) | j, profilePairs[i][j]);
+    }
+  }
+  for(i = 0; i < PROFILE_TRIPLE_SLOTS; i++) {
+    addToReport(&triples, profileTriples[i].key, profileTriples[i].count);
+  }
+
+  printf("\nMost common op code pairs:\n");
+  for(i = 0; i < pairs.size; i++) {
+    printf("  %02x %02x       %lu\n", (pairs.keys[i] >> 8) & 0xff,
+      pairs.keys[i] & 0xff, pairs.counts[i]);
+  }
+  printf("Most common op code triples:\n");
+  for(i = 0; i < triples.size; i++) {
+    printf("  %02x %02x %02x    %lu\n", (triples.keys[i] >> 16) & 0xff,
+      (triples.keys[i] >> 8) & 0xff, triples.keys[i] & 0xff, triples.counts[i]);
+  }
+  if(profileDropped > 0) {
+    printf("%lu triples not counted, table full\n", profileDropped);
+  }
+}
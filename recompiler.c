@@ -0,0 +1,429 @@
+/* Ahead of time recompiler for 8080 ROM images
+  Jack R. McCluskey
+
+  Follows control flow through ROM images from the reset and interrupt
+  vectors, splits the code into the same basic blocks as blockCache.c
+  and writes one C function per block, doing what emulateOps does for
+  each op. Build the emulator with BLOCK_CACHE and AOT_BLOCKS to
+  compile the output in. Blocks that aren't found here, like the ones
+  RET and PCHL jump to, run in the interpreter as before.
+  Usage: recompiler file address [file address ...] > aotBlocks.c
+  Load the files at the addresses main in emulatorShell.c uses.
+*/
+
+#define NO_DISASSEMBLER_MAIN
+#include"disassembler.c"
+#include <stdint.h>
+#include <string.h>
+
+#define BLOCK_MAX_OPS 32 // Same as blockCache.c
+
+unsigned char memory[0x10000 + 2]; // Room for the operands of an op at 0xffff
+uint8_t loaded[0x10000]; // Bytes that came from a ROM image
+uint8_t queued[0x10000]; // Block start addresses already followed
+uint16_t blockEnds[0x10000]; // End of the block at each start address
+uint8_t compiled[0x10000]; // Start addresses of blocks to write out
+
+const char *regNames[8] = {
+  "state->b", "state->c", "state->d", "state->e",
+  "state->h", "state->l", "readFromMemory(state, state->h, state->l)", "state->a"
+};
+const char *pairNames[4] = { "state->bc", "state->de", "state->hl", "state->sp" };
+
+// Conditions of Rcc, Jcc and Ccc, as emulateOps tests them
+const char *retConditions[8] = {
+  "getZero(state) == 0", "getZero(state) == 1", "getCarry(state) == 0", "getCarry(state) == 1",
+  "getParity(state) == 1", "getParity(state) == 0", "getCarry(state) == 0", "getSign(state) == 1"
+};
+const char *jumpConditions[8] = {
+  "getZero(state) == 0", "getZero(state) == 1", "getCarry(state) == 0", "getCarry(state) == 1",
+  "getParity(state) == 1", "getParity(state) == 0", "getParity(state) == 0", "getSign(state) == 1"
+};
+
+#define PUSH_PC "WRITE_BYTE(state->pc - 1, (state->pc >> 8) & 0xff); " \
+  "WRITE_BYTE(state->pc - 2, state->pc & 0xff); state->sp += 2;"
+#define POP_PC "state->pc = (READ_BYTE(state->sp + 1) << 8) | READ_BYTE(state->sp); " \
+  "state->sp += 2;"
+
+/* Helper function for finding the ops that end a basic block
+  Input: op code
+  Output: 1 if the op can change the program counter, 0 otherwise
+  Same list as endsBlock in blockCache.c
+*/
+int endsBlock(uint8_t opCode) {
+  return (opCode & 0xc0) == 0xc0 &&
+    ((opCode & 0x07) == 0x00 || (opCode & 0x07) == 0x02 || (opCode & 0x07) == 0x04 ||
+    (opCode & 0x07) == 0x07 || opCode == 0xc3 || opCode == 0xcd ||
+    opCode == 0xc9 || opCode == 0xe9);
+}
+
+/* Helper function to check if an op changes the program counter itself
+  Input: op code
+  Output: 1 if the generated code needs state->pc set before the op
+*/
+int usesPc(uint8_t opCode) {
+  return endsBlock(opCode) || opCode == 0xd3 || opCode == 0xdb;
+}
+
+/* Helper function to check if an op writes guest memory
+  Input: op code
+  Output: 1 if the op may write over the ops after it in its block
+  Ops that end a block aren't listed, nothing of the block is left
+*/
+int writesMemory(uint8_t opCode) {
+  return (opCode >= 0x70 && opCode < 0x78 && opCode != 0x76) || // MOV M
+    opCode == 0x34 || opCode == 0x35 || opCode == 0x36 || // INR M, DCR M, MVI M
+    opCode == 0x02 || opCode == 0x12 || opCode == 0x22 || opCode == 0x32 || // STAX, SHLD, STA
+    (opCode & 0xcf) == 0xc5 || opCode == 0xe3; // PUSH, XTHL
+}
+
+/* Helper function to hash guest code
+  Input: first address, address after the last byte
+  Output: FNV-1a hash of the bytes, matching hashGuestCode in
+    emulatorShell.c
+*/
+uint32_t hashCode(uint16_t start, uint16_t end) {
+  uint32_t hash = 2166136261u;
+  uint16_t address;
+  for(address = start; address != end; address++) {
+    hash = (hash ^ memory[address]) * 16777619u;
+  }
+  return hash;
+}
+
+/* Function to load a ROM image
+  Input: file name, address to load it at
+  Output: 1 if the file was loaded, 0 otherwise
+*/
+int loadImage(const char *fileName, int address) {
+  FILE *f = fopen(fileName, "rb");
+  int value;
+  if(f == NULL) {
+    fprintf(stderr, "ERROR: Cannot open %s\n", fileName);
+    return 0;
+  }
+  while(address < 0x10000 && (value = fgetc(f)) != EOF) {
+    memory[address] = value;
+    loaded[address] = 1;
+    address++;
+  }
+  fclose(f);
+  return 1;
+}
+
+/* Function to write the C code for one op
+  Input: output file, guest address of the op
+  Output: void
+  Mirrors the handler for the op in emulateOps, with the immediate data
+  filled in. Ops that don't use the program counter leave it alone.
+*/
+void emitOp(FILE *out, uint16_t address) {
+  uint8_t opCode = memory[address];
+  unsigned data8 = memory[(uint16_t) (address + 1)];
+  unsigned data16 = data8 | (memory[(uint16_t) (address + 2)] << 8);
+  int dst = (opCode >> 3) & 0x07;
+  int src = opCode & 0x07;
+  const char *pair = pairNames[(opCode >> 4) & 0x03];
+
+  if(opCode >= 0x40 && opCode < 0x80 && opCode != 0x76) { // MOV
+    if(dst == 6) {
+      fprintf(out, "  writeToMemory(state, %s, state->h, state->l);\n", regNames[src]);
+    } else {
+      fprintf(out, "  %s = %s;\n", regNames[dst], regNames[src]);
+    }
+    return;
+  }
+  if(opCode >= 0x80 && opCode < 0xc0) { // ADD to CMP
+    const char *operators[8] = { "+", "+", "-", "-", "&", "^", "|", "-" };
+    fprintf(out, "  { uint16_t val = state->a %s %s%s; setFlags(state, val);%s }\n",
+      operators[dst], regNames[src], (dst == 1) ? " + getCarry(state)" : (dst == 3) ? " - getCarry(state)" : "",
+      (dst == 7) ? "" : " state->a = val & 0xff;");
+    return;
+  }
+  if((opCode & 0xc7) == 0xc6) { // ADI to CPI
+    const char *operators[8] = { "+", "+", "-", "-", "&", "^", "|", "-" };
+    fprintf(out, "  { uint16_t val = state->a %s 0x%02x%s; setFlags(state, val);%s }\n",
+      operators[dst], data8, (dst == 1) ? " + getCarry(state)" : (dst == 3) ? " - getCarry(state)" : "",
+      (dst == 7) ? "" : " state->a = val & 0xff;");
+    return;
+  }
+  if((opCode & 0xc6) == 0x04 && opCode < 0x40) { // INR, DCR
+    const char *sign = (opCode & 0x01) ? "-" : "+";
+    if(dst == 6) {
+      fprintf(out, "  { uint16_t val = READ_BYTE(state->hl) %s 1; setZSP(state, val); WRITE_BYTE(state->hl, val & 0xff); }\n",
+        sign);
+    } else {
+      fprintf(out, "  { uint16_t val = (uint16_t) %s %s 1; setZSP(state, val); %s = val & 0xff; }\n",
+        regNames[dst], sign, regNames[dst]);
+    }
+    return;
+  }
+  if((opCode & 0xc7) == 0x06 && opCode < 0x40) { // MVI
+    if(dst == 6) {
+      fprintf(out, "  writeToMemory(state, 0x%02x, state->h, state->l);\n", data8);
+    } else {
+      fprintf(out, "  %s = 0x%02x;\n", regNames[dst], data8);
+    }
+    return;
+  }
+  if((opCode & 0xcf) == 0x01) { // LXI
+    fprintf(out, "  %s = 0x%04x;\n", pair, data16);
+    return;
+  }
+  if((opCode & 0xcf) == 0x03) { // INX
+    fprintf(out, "  %s += 1;\n", pair);
+    return;
+  }
+  if((opCode & 0xcf) == 0x0b) { // DCX
+    fprintf(out, "  %s -= 1;\n", pair);
+    return;
+  }
+  if((opCode & 0xcf) == 0x09 && opCode != 0x39) { // DAD
+    fprintf(out, "  { uint32_t total = state->hl + %s; setCarry(state, total > 0xffff); state->hl = total & 0xffff; }\n",
+      pair);
+    return;
+  }
+  if((opCode & 0xc7) == 0xc0) { // Rcc
+    fprintf(out, "  if(%s) { %s }\n", retConditions[dst], POP_PC);
+    return;
+  }
+  if((opCode & 0xc7) == 0xc2) { // Jcc
+    fprintf(out, "  if(%s) { state->pc = 0x%04x; } else { state->pc += 2; }\n", jumpConditions[dst], data16);
+    return;
+  }
+  if((opCode & 0xc7) == 0xc4) { // Ccc
+    fprintf(out, "  if(%s) { %s state->pc = 0x%04x; } else { state->pc += 2; }\n",
+      jumpConditions[dst], PUSH_PC, data16);
+    return;
+  }
+  if((opCode & 0xc7) == 0xc7) { // RST
+    fprintf(out, "  %s state->pc = 0x%02x;\n", PUSH_PC, opCode & 0x38);
+    return;
+  }
+
+  switch(opCode) {
+    case 0x02: fprintf(out, "  writeToMemory(state, state->a, state->b, state->c);\n"); break;
+    case 0x12: fprintf(out, "  writeToMemory(state, state->a, state->d, state->e);\n"); break;
+    case 0x0a: fprintf(out, "  state->a = readFromMemory(state, state->b, state->c);\n"); break;
+    case 0x1a: fprintf(out, "  state->a = readFromMemory(state, state->d, state->e);\n"); break;
+    case 0x07:
+      fprintf(out, "  { uint8_t leftMost = (state->a >> 7) & 0x01; state->a = (state->a << 1) | leftMost; "
+        "setCarry(state, leftMost); }\n");
+      break;
+    case 0x0f:
+      fprintf(out, "  { uint8_t rightMost = state->a & 0x01; state->a = (state->a >> 1) | (rightMost << 7); "
+        "setCarry(state, rightMost); }\n");
+      break;
+    case 0x17:
+      fprintf(out, "  { uint8_t leftMost = (state->a >> 7) & 0x01; state->a = (state->a << 1) | getCarry(state); "
+        "setCarry(state, leftMost); }\n");
+      break;
+    case 0x1f:
+      fprintf(out, "  { uint8_t rightMost = state->a & 0x01; uint8_t leftMost = state->a & 0x80; "
+        "state->a = (state->a >> 1) | leftMost; setCarry(state, rightMost); }\n");
+      break;
+    case 0x22:
+      fprintf(out, "  WRITE_BYTE(0x%04x, state->l); WRITE_BYTE(0x%04x + 1, state->h);\n", data16, data16);
+      break;
+    case 0x2a:
+      fprintf(out, "  state->l = READ_BYTE(0x%04x); state->h = READ_BYTE(0x%04x + 1);\n", data16, data16);
+      break;
+    case 0x27: fprintf(out, "  unimplementedInstruction(state);\n"); break;
+    case 0x2f: fprintf(out, "  state->a = ~(state->a);\n"); break;
+    case 0x32: fprintf(out, "  writeToMemory(state, state->a, 0x%02x, 0x%02x);\n", data16 >> 8, data8); break;
+    case 0x3a: fprintf(out, "  state->a = readFromMemory(state, 0x%02x, 0x%02x);\n", data16 >> 8, data8); break;
+    case 0x37: fprintf(out, "  setCarry(state, 1);\n"); break;
+    case 0x39:
+      fprintf(out, "  { uint32_t val = state->hl + state->sp; if(val > 0xffff) { setCarry(state, 1); } "
+        "state->hl = val & 0xffff; }\n");
+      break;
+    case 0x3f: fprintf(out, "  setCarry(state, getCarry(state) ^ 1);\n"); break;
+    case 0x76: fprintf(out, "  exit(0);\n"); break;
+    case 0xc1: case 0xd1: case 0xe1: { // POP
+      const char *high = regNames[(opCode >> 3) & 0x06];
+      const char *low = regNames[((opCode >> 3) & 0x06) + 1];
+      fprintf(out, "  %s = READ_BYTE(state->sp); %s = READ_BYTE(state->sp+1); state->sp += 2;\n", low, high);
+      break;
+    }
+    case 0xc5: case 0xd5: case 0xe5: { // PUSH
+      const char *high = regNames[(opCode >> 3) & 0x06];
+      const char *low = regNames[((opCode >> 3) & 0x06) + 1];
+      fprintf(out, "  WRITE_BYTE(state->sp-1, %s); WRITE_BYTE(state->sp-2, %s); state->sp -= 2;\n", high, low);
+      break;
+    }
+    case 0xf1:
+      fprintf(out, "  { uint8_t psw = READ_BYTE(state->sp); state->a = READ_BYTE(state->sp + 1); "
+        "state->cc.z = psw & 0x01; state->cc.s = (psw >> 1) & 0x01; state->cc.p = (psw >> 2) & 0x01; "
+        "state->cc.cy = (psw >> 3) & 0x01; state->cc.ac = (psw >> 4) & 0x01; state->cc.pad = (psw >> 5) & 0x01; "
+        "state->lazyFlags = 0; state->sp += 2; }\n");
+      break;
+    case 0xf5:
+      fprintf(out, "  WRITE_BYTE(state->sp - 1, state->a); syncFlags(state); "
+        "WRITE_BYTE(state->sp - 2, (state->cc.z | (state->cc.s << 1) | (state->cc.p << 2) | "
+        "(state->cc.cy << 3) | (state->cc.ac << 4) | (state->cc.pad << 5))); state->sp -= 2;\n");
+      break;
+    case 0xc3: fprintf(out, "  state->pc = 0x%04x; state->pc += 2;\n", data16); break;
+    case 0xc9: fprintf(out, "  %s\n", POP_PC); break;
+    case 0xcd: fprintf(out, "  %s state->pc = 0x%04x;\n", PUSH_PC, data16); break;
+    case 0xd3: fprintf(out, "  writeToPort(state, 0x%02x, state->a); state->pc += 1; endRun = AOT_END_RUN;\n", data8); break;
+    case 0xdb: fprintf(out, "  state->a = readFromPort(state, 0x%02x); state->pc += 1; endRun = AOT_END_RUN;\n", data8); break;
+    case 0xe3:
+      fprintf(out, "  { uint8_t storage = READ_BYTE(state->sp); WRITE_BYTE(state->sp, state->l); "
+        "state->l = storage; storage = READ_BYTE(state->sp+1); WRITE_BYTE(state->sp+1, state->h); }\n");
+      break;
+    case 0xe9: fprintf(out, "  state->pc = state->hl;\n"); break;
+    case 0xeb: fprintf(out, "  { uint16_t storage = state->hl; state->hl = state->de; state->de = storage; }\n"); break;
+    case 0xf3: fprintf(out, "  state->intEnable = 0;\n"); break;
+    case 0xf9: fprintf(out, "  state->sp = state->hl;\n"); break;
+    case 0xfb: fprintf(out, "  state->intEnable = 1; endRun = AOT_END_RUN;\n"); break;
+    default: break; // NOP and the unused op codes
+  }
+}
+
+/* Function to find the block starting at an address
+  Input: guest address
+  Output: void
+  Marks the block for output and follows its exits. The targets match
+  the program counter emulateOps leaves after the last op, including
+  the one FINISH_OP adds.
+*/
+void followBlocks(uint16_t start) {
+  static uint16_t work[0x20000]; // Each block adds at most two
+  int numWork = 0;
+  work[numWork++] = start;
+
+  while(numWork > 0) {
+    uint16_t address = work[--numWork];
+    uint16_t pc = address;
+    uint8_t opCode = 0;
+    unsigned data16;
+    int numOps = 0;
+    int complete = 1;
+    char text[32];
+
+    if(queued[address] || !loaded[address]) {
+      continue;
+    }
+    queued[address] = 1;
+
+    for(;;) {
+      int length = decodeAsm(&memory[pc], text, sizeof(text));
+      int i;
+      opCode = memory[pc];
+      for(i = 0; i < length; i++) {
+        if(!loaded[(uint16_t) (pc + i)]) {
+          complete = 0;
+        }
+      }
+      numOps++;
+      pc += length;
+      if(!complete || endsBlock(opCode) || numOps == BLOCK_MAX_OPS) {
+        break;
+      }
+    }
+    if(!complete) {
+      continue;
+    }
+    compiled[address] = 1;
+    blockEnds[address] = pc;
+
+    data16 = memory[(uint16_t) (pc - 2)] | (memory[(uint16_t) (pc - 1)] << 8);
+    if(!endsBlock(opCode) || (opCode & 0xc7) == 0xc0 || (opCode & 0xc7) == 0xc2 ||
+        (opCode & 0xc7) == 0xc4 || opCode == 0xcd) {
+      work[numWork++] = pc; // Falls through, or returns here
+    }
+    if((opCode & 0xc7) == 0xc2 || (opCode & 0xc7) == 0xc4 || opCode == 0xcd) {
+      work[numWork++] = data16 + 1;
+    } else if(opCode == 0xc3) {
+      work[numWork++] = data16 + 3;
+    } else if((opCode & 0xc7) == 0xc7) {
+      work[numWork++] = (opCode & 0x38) + 1;
+    }
+  }
+}
+
+/* Function to write the C function for one block
+  Input: output file, start address of the block
+  Output: void
+*/
+void emitBlock(FILE *out, uint16_t start) {
+  uint16_t pc = start;
+  uint8_t opCode = 0;
+  char text[32];
+
+  fprintf(out, "int aotCode%04x(state8080* state) {\n  int endRun = 0;\n", start);
+  while(pc != blockEnds[start]) {
+    int length = decodeAsm(&memory[pc], text, sizeof(text));
+    opCode = memory[pc];
+    fprintf(out, "  // %04x %s\n", pc, text);
+    if(usesPc(opCode)) {
+      fprintf(out, "  state->pc = 0x%04x;\n", pc);
+    }
+    emitOp(out, pc);
+    pc += length;
+    if(writesMemory(opCode) && pc != blockEnds[start]) {
+      // A store into the rest of the block flushes it, the interpreter
+      // goes on from the next op
+      fprintf(out, "  if(state->blockCache->numBlocks == 0) { state->pc = 0x%04x; return endRun | AOT_STOPPED; }\n",
+        pc);
+    }
+  }
+  if(endsBlock(opCode)) {
+    fprintf(out, "  state->pc += 1;\n");
+  } else {
+    fprintf(out, "  state->pc = 0x%04x;\n", pc);
+  }
+  fprintf(out, "  return endRun;\n}\n\n");
+}
+
+/* Main function for the recompiler
+  Input: pairs of file name and load address
+  Output: 0 if the C code was written, 1 otherwise
+*/
+int main(int argc, char const *argv[]) {
+  int numBlocks = 0;
+  int address;
+  int i;
+
+  if(argc < 3 || argc % 2 == 0) {
+    fprintf(stderr, "Usage: %s file address [file address ...]\n", argv[0]);
+    return 1;
+  }
+  for(i = 1; i < argc; i += 2) {
+    if(!loadImage(argv[i], (int) strtol(argv[i + 1], NULL, 0))) {
+      return 1;
+    }
+  }
+
+  // Reset and the RST vectors interrupts jump to
+  for(address = 0; address < 0x40; address += 8) {
+    followBlocks(address);
+  }
+
+  printf("/* Generated by recompiler.c from");
+  for(i = 1; i < argc; i += 2) {
+    printf(" %s at %s", argv[i], argv[i + 1]);
+  }
+  printf("\n  Included by emulatorShell.c when built with AOT_BLOCKS\n*/\n\n");
+  for(address = 0; address < 0x10000; address++) {
+    if(compiled[address]) {
+      emitBlock(stdout, address);
+      numBlocks++;
+    }
+  }
+  if(numBlocks == 0) {
+    fprintf(stderr, "ERROR: No code found at the reset or RST vectors\n");
+    return 1;
+  }
+
+  printf("#define NUM_AOT_BLOCKS %d\n", numBlocks);
+  printf("const aotBlock aotBlocks[NUM_AOT_BLOCKS] = {\n");
+  for(address = 0; address < 0x10000; address++) {
+    if(compiled[address]) {
+      printf("  { 0x%04x, 0x%04x, 0x%08xu, aotCode%04x },\n", address, blockEnds[address],
+        hashCode(address, blockEnds[address]), address);
+    }
+  }
+  printf("};\n");
+  return 0;
+}
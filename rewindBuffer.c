@@ -0,0 +1,250 @@
+/* Rewind buffer for the Space Invaders machine
+  Jack R. McCluskey
+
+  Keeps the last frames of a machine in a fixed amount of memory, so it
+  can be stepped back a frame at a time or jumped back seconds. Each
+  frame is stored as the registers and ports of an invadersSave plus
+  the RAM XORed with the frame before, run length encoded. Most frames
+  change little of the 8k of RAM, so a frame costs a few hundred bytes.
+  Only the newest frame is kept whole, older ones are rebuilt by
+  undoing the deltas newest first. Record a frame after every
+  runInvadersFrame and rewind between frames, the machine runs on
+  from wherever it was rewound to.
+  Included by invadersMachine.c.
+*/
+
+#define REWIND_HEADER_SIZE offsetof(invadersSave, ram) // Everything but the RAM
+#define REWIND_MIN_ZEROS 4 // Shorter runs of unchanged bytes are kept in the literals
+#define REWIND_MAX_DELTA (2 * INVADERS_RAM_SIZE) // Longest a delta can encode to
+
+/* Struct for one frame in the buffer
+  Its delta turns the RAM of the frame into that of the one before
+*/
+typedef struct rewindFrame {
+  size_t offset; // Where the delta starts in data
+  uint32_t length; // Bytes of delta
+  uint8_t header[REWIND_HEADER_SIZE];
+} rewindFrame;
+
+/* Struct for the rewind buffer of one machine
+  frames is a ring of the frames held, oldest at first. Their deltas
+  are laid out in data one after another in the same order, wrapping
+  to the start when the next one doesn't fit before the end.
+*/
+typedef struct rewindBuffer {
+  rewindFrame *frames;
+  int maxFrames;
+  int first;
+  int numFrames;
+  uint8_t *data;
+  size_t dataSize;
+  size_t head; // Where the next delta goes
+  size_t used; // Bytes of delta held, frames with no changes hold none
+  invadersSave *latest; // The newest frame, whole
+  invadersSave *next; // The frame being recorded
+  uint8_t encoded[REWIND_MAX_DELTA]; // Its delta
+} rewindBuffer;
+
+/* Function to make a rewind buffer
+  Input: most frames to hold, bytes to hold their deltas in
+  Output: new rewindBuffer struct, empty
+  60 frames are a second. Frames are dropped oldest first when either
+  limit is reached.
+*/
+rewindBuffer* createRewindBuffer(int maxFrames, size_t dataSize) {
+  rewindBuffer *rewind = calloc(1, sizeof(rewindBuffer));
+  if(dataSize < REWIND_MAX_DELTA) {
+    dataSize = REWIND_MAX_DELTA;
+  }
+  rewind->maxFrames = maxFrames < 1 ? 1 : maxFrames;
+  rewind->frames = calloc(rewind->maxFrames, sizeof(rewindFrame));
+  rewind->data = malloc(dataSize);
+  rewind->dataSize = dataSize;
+  rewind->latest = calloc(1, sizeof(invadersSave));
+  rewind->next = calloc(1, sizeof(invadersSave));
+  if(rewind->frames == NULL || rewind->data == NULL || rewind->latest == NULL || rewind->next == NULL) {
+    printf("ERROR: Cannot allocate a rewind buffer\n");
+    exit(1);
+  }
+  return rewind;
+}
+
+/* Helper function to encode the changes between two copies of RAM
+  Input: new RAM, old RAM, where to write the delta
+  Output: bytes written
+  The delta is a list of runs, each a 16 bit count of unchanged bytes
+  to skip, a 16 bit count of bytes that follow, then those bytes XORed
+  with the old ones. Unchanged bytes at the end aren't encoded.
+*/
+uint32_t encodeRewindDelta(const uint8_t* ram, const uint8_t* old, uint8_t* out) {
+  uint32_t length = 0;
+  int pos = 0, zeros, start, i;
+  while(pos < INVADERS_RAM_SIZE) {
+    uint16_t skip, count;
+    start = pos;
+    while(pos < INVADERS_RAM_SIZE && ram[pos] == old[pos]) {
+      pos++;
+    }
+    if(pos == INVADERS_RAM_SIZE) {
+      break;
+    }
+    skip = pos - start;
+    start = pos;
+    for(zeros = 0; pos < INVADERS_RAM_SIZE && zeros < REWIND_MIN_ZEROS; pos++) {
+      zeros = ram[pos] == old[pos] ? zeros + 1 : 0;
+    }
+    pos -= zeros;
+    count = pos - start;
+    memcpy(&out[length], &skip, sizeof(skip));
+    memcpy(&out[length + 2], &count, sizeof(count));
+    length += 4;
+    for(i = start; i < pos; i++) {
+      out[length++] = ram[i] ^ old[i];
+    }
+  }
+  return length;
+}
+
+/* Helper function to undo a delta
+  Input: RAM to change, delta, its length
+  Output: void
+  XOR undoes itself, so this turns either copy of RAM into the other
+*/
+void applyRewindDelta(uint8_t* ram, const uint8_t* delta, uint32_t length) {
+  uint32_t in = 0;
+  int pos = 0, i;
+  while(in < length) {
+    uint16_t skip, count;
+    memcpy(&skip, &delta[in], sizeof(skip));
+    memcpy(&count, &delta[in + 2], sizeof(count));
+    in += 4;
+    pos += skip;
+    for(i = 0; i < count; i++) {
+      ram[pos++] ^= delta[in++];
+    }
+  }
+}
+
+/* Helper function to drop the oldest frame
+  Input: rewindBuffer struct
+  Output: void
+*/
+void dropOldestFrame(rewindBuffer* rewind) {
+  rewind->used -= rewind->frames[rewind->first].length;
+  rewind->first = (rewind->first + 1) % rewind->maxFrames;
+  rewind->numFrames--;
+}
+
+/* Helper function to find room for a delta
+  Input: rewindBuffer struct, bytes needed
+  Output: offset in data to write it at
+  Drops the oldest frames until there is room after head, or at the
+  start of data if there isn't before the end. Frames with an empty
+  delta take no room, so they don't bound the free space.
+*/
+size_t findRewindSpace(rewindBuffer* rewind, uint32_t length) {
+  for(;;) {
+    size_t oldest;
+    int i;
+    if(rewind->used == 0) {
+      return 0;
+    }
+    // The oldest delta with bytes in it, there is one while any are held
+    i = rewind->first;
+    while(rewind->frames[i].length == 0) {
+      i = (i + 1) % rewind->maxFrames;
+    }
+    oldest = rewind->frames[i].offset;
+    if(oldest >= rewind->head) {
+      // Free from head up to the oldest delta, none if head caught up with it
+      if(oldest - rewind->head >= length) {
+        return rewind->head;
+      }
+    } else {
+      // Free from head to the end, and from the start up to the oldest delta
+      if(rewind->dataSize - rewind->head >= length) {
+        return rewind->head;
+      }
+      if(oldest >= length) {
+        return 0;
+      }
+    }
+    dropOldestFrame(rewind);
+  }
+}
+
+/* Function to record the frame a machine is on
+  Input: rewindBuffer struct, machine
+  Output: void
+  Call once a frame, after runInvadersFrame
+*/
+void recordRewindFrame(rewindBuffer* rewind, invadersMachine* machine) {
+  invadersSave *recorded = rewind->next;
+  rewindFrame *frame;
+  uint32_t length;
+  size_t offset;
+  storeInvadersSave(machine, recorded);
+  length = encodeRewindDelta(recorded->ram, rewind->latest->ram, rewind->encoded);
+
+  if(rewind->numFrames == rewind->maxFrames) {
+    dropOldestFrame(rewind);
+  }
+  offset = findRewindSpace(rewind, length);
+  memcpy(&rewind->data[offset], rewind->encoded, length);
+  rewind->head = offset + length;
+  rewind->used += length;
+
+  frame = &rewind->frames[(rewind->first + rewind->numFrames) % rewind->maxFrames];
+  frame->offset = offset;
+  frame->length = length;
+  memcpy(frame->header, recorded, REWIND_HEADER_SIZE);
+  rewind->numFrames++;
+  rewind->next = rewind->latest;
+  rewind->latest = recorded;
+}
+
+/* Function to put a machine back a number of frames
+  Input: rewindBuffer struct, machine, frames to go back
+  Output: frames gone back, fewer if the buffer doesn't hold that many
+  The frames gone back are dropped, so the next record carries on from
+  the frame the machine is now on. 0 frames puts the machine back on
+  the newest frame.
+*/
+int rewindInvaders(rewindBuffer* rewind, invadersMachine* machine, int frames) {
+  int goneBack;
+  rewindFrame *frame;
+  if(rewind->numFrames == 0) {
+    return 0;
+  }
+  for(goneBack = 0; goneBack < frames && rewind->numFrames > 1; goneBack++) {
+    frame = &rewind->frames[(rewind->first + rewind->numFrames - 1) % rewind->maxFrames];
+    applyRewindDelta(rewind->latest->ram, &rewind->data[frame->offset], frame->length);
+    rewind->used -= frame->length;
+    rewind->numFrames--;
+  }
+  frame = &rewind->frames[(rewind->first + rewind->numFrames - 1) % rewind->maxFrames];
+  rewind->head = frame->offset + frame->length;
+  memcpy(rewind->latest, frame->header, REWIND_HEADER_SIZE);
+  restoreInvadersSave(machine, rewind->latest);
+  return goneBack;
+}
+
+/* Function to see how far back a buffer goes
+  Input: rewindBuffer struct
+  Output: frames that can be gone back
+*/
+int rewindFramesHeld(rewindBuffer* rewind) {
+  return rewind->numFrames > 0 ? rewind->numFrames - 1 : 0;
+}
+
+/* Function to free a rewind buffer
+  Input: rewindBuffer struct
+  Output: void
+*/
+void freeRewindBuffer(rewindBuffer* rewind) {
+  free(rewind->frames);
+  free(rewind->data);
+  free(rewind->latest);
+  free(rewind->next);
+  free(rewind);
+}
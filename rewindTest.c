@@ -0,0 +1,110 @@
+/* Tests for the rewind buffer
+  Jack R. McCluskey
+
+  Records frames of a Space Invaders machine with RAM changed by hand
+  instead of by running the game, so no ROM files are needed, and
+  checks every rewind puts the machine back as it was saved.
+  Usage: rewindTest   (prints each failure, exits with 1 if any)
+*/
+
+#define NO_EMULATOR_MAIN
+#include"emulatorShell.c"
+#include"invadersMachine.c"
+
+int failures;
+
+/* Helper function to report a failed check
+  Input: whether the check passed, what was checked
+  Output: void
+*/
+void check(int passed, const char* what) {
+  if(!passed) {
+    printf("FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+/* Helper function to make a machine without ROM files
+  Input: machine to fill in, arena to make its state in
+  Output: void
+*/
+void makeTestMachine(invadersMachine* machine, stateArena* arena) {
+  memset(machine, 0, sizeof(invadersMachine));
+  machine->state = arenaState(arena);
+  machine->state->userData = machine;
+  mapMemory(machine->state, spaceInvadersMap, SPACE_INVADERS_REGIONS);
+}
+
+/* Helper function to check a machine is where a save left it
+  Input: machine, save
+  Output: 1 if the saves match, 0 otherwise
+*/
+int sameAsSave(invadersMachine* machine, const invadersSave* save) {
+  static invadersSave now;
+  storeInvadersSave(machine, &now);
+  return memcmp(&now, save, sizeof(invadersSave)) == 0;
+}
+
+/* Test that frames with no RAM changes don't make the buffer look full
+  Input: machine
+  Output: void
+*/
+void testIdleFrames(invadersMachine* machine) {
+  rewindBuffer *rewind = createRewindBuffer(60, 1 << 20);
+  static invadersSave before;
+  int i;
+  for(i = 0; i < 100; i++) {
+    recordRewindFrame(rewind, machine);
+  }
+  check(rewindFramesHeld(rewind) == 59, "idle frames are all held");
+  storeInvadersSave(machine, &before);
+  machine->state->writePages[0x20][0x10] ^= 0xff;
+  recordRewindFrame(rewind, machine);
+  check(rewindFramesHeld(rewind) == 59, "a change after idle frames keeps them");
+  check(rewindInvaders(rewind, machine, 1) == 1, "idle frames can be gone back to");
+  check(sameAsSave(machine, &before), "going back undoes the change");
+  freeRewindBuffer(rewind);
+}
+
+/* Test rewinds of a buffer that wraps, with idle frames mixed in
+  Input: machine
+  Output: void
+*/
+void testWrapping(invadersMachine* machine) {
+  rewindBuffer *rewind = createRewindBuffer(1000, REWIND_MAX_DELTA * 2);
+  invadersSave *saves = malloc(300 * sizeof(invadersSave));
+  int steps[] = { 1, 5, 0, 30, 1000 };
+  int frame, current, i;
+  srand(1);
+  for(frame = 0; frame < 300; frame++) {
+    int writes = frame % 3 == 0 ? 0 : rand() % 2000;
+    for(i = 0; i < writes; i++) {
+      uint16_t address = INVADERS_RAM + rand() % INVADERS_RAM_SIZE;
+      machine->state->writePages[address >> 8][address & 0xff] = rand();
+    }
+    machine->state->b = frame;
+    machine->state->cc.pad = frame & 1;
+    storeInvadersSave(machine, &saves[frame]);
+    recordRewindFrame(rewind, machine);
+  }
+  check(rewindFramesHeld(rewind) > 0, "a full buffer still holds frames");
+  current = 299;
+  for(i = 0; i < (int) (sizeof(steps) / sizeof(steps[0])); i++) {
+    current -= rewindInvaders(rewind, machine, steps[i]);
+    check(current >= 0 && sameAsSave(machine, &saves[current]), "rewinds land on saved frames");
+    check(machine->state->cc.pad == (current & 1), "rewinds keep bit 5 of the PSW");
+  }
+  free(saves);
+  freeRewindBuffer(rewind);
+}
+
+int main(int argc, char const *argv[]) {
+  stateArena *arena = createStateArena(2, 0);
+  invadersMachine machine;
+  makeTestMachine(&machine, arena);
+  testIdleFrames(&machine);
+  testWrapping(&machine);
+  freeStateArena(arena);
+  printf("%d failures\n", failures);
+  return failures > 0;
+}
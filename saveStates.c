@@ -0,0 +1,239 @@
+/* Save states for the Space Invaders machine
+  Jack R. McCluskey
+
+  A save is one fixed layout invadersSave struct, written to a file as
+  it is in memory. Loading maps the file and copies the struct into a
+  machine, with no parsing, so one mapped save can be restored as
+  often as needed. The header holds a version, which changes whenever
+  the layout does, and the host's byte order, since the fields are
+  stored as the host keeps them. Saves with a different version, byte
+  order or size are refused.
+  Included by invadersMachine.c.
+*/
+
+#include <stddef.h>
+
+#define INVADERS_SAVE_MAGIC "INV8080"
+#define INVADERS_SAVE_VERSION 2
+#define INVADERS_SAVE_BYTE_ORDER 0x0102 // Reads back as 0x0201 on the other byte order
+#define INVADERS_RAM 0x2000
+#define INVADERS_RAM_SIZE 0x2000 // Work RAM and video RAM, the mirrors above hold no more
+
+/* Struct for a saved machine
+  Every field has a fixed size and the fields are in size order, so
+  the layout has no padding. Flags are kept a byte each.
+*/
+typedef struct invadersSave {
+  char magic[8]; // INVADERS_SAVE_MAGIC
+  uint16_t version; // INVADERS_SAVE_VERSION
+  uint16_t byteOrder; // INVADERS_SAVE_BYTE_ORDER
+  uint32_t size; // sizeof(invadersSave)
+  uint64_t nextInterrupt;
+  uint64_t cyclesRun;
+  uint64_t frames;
+  uint16_t sp;
+  uint16_t pc;
+  uint8_t a, b, c, d, e, h, l;
+  uint8_t z, s, p, cy, ac;
+  uint8_t flag5; // Bit 5 of the PSW, kept by POP PSW and pushed by PUSH PSW
+  uint8_t intEnable;
+  uint8_t interruptPending;
+  uint8_t interruptNumber;
+  uint8_t numInterrupt;
+  uint8_t shift0;
+  uint8_t shift1;
+  uint8_t shiftOffset;
+  uint8_t port1;
+  uint8_t port2;
+  uint8_t pad[6]; // Makes ram start on a multiple of 8
+  uint8_t ram[INVADERS_RAM_SIZE];
+} invadersSave;
+
+/* Function to save a machine into memory
+  Input: machine, save to fill in
+  Output: void
+  RAM is read through the memory map, so video RAM moved elsewhere by
+  invadersEnv.c is saved too
+*/
+void storeInvadersSave(invadersMachine* machine, invadersSave* save) {
+  state8080 *state = machine->state;
+  int page;
+  syncFlags(state);
+  memset(save, 0, offsetof(invadersSave, ram));
+  memcpy(save->magic, INVADERS_SAVE_MAGIC, sizeof(INVADERS_SAVE_MAGIC));
+  save->version = INVADERS_SAVE_VERSION;
+  save->byteOrder = INVADERS_SAVE_BYTE_ORDER;
+  save->size = sizeof(invadersSave);
+  save->nextInterrupt = machine->nextInterrupt;
+  save->cyclesRun = machine->cyclesRun;
+  save->frames = machine->frames;
+  save->sp = state->sp;
+  save->pc = state->pc;
+  save->a = state->a;
+  save->b = state->b;
+  save->c = state->c;
+  save->d = state->d;
+  save->e = state->e;
+  save->h = state->h;
+  save->l = state->l;
+  save->z = state->cc.z;
+  save->s = state->cc.s;
+  save->p = state->cc.p;
+  save->cy = state->cc.cy;
+  save->ac = state->cc.ac;
+  save->flag5 = state->cc.pad;
+  save->intEnable = state->intEnable;
+  save->interruptPending = state->interruptPending;
+  save->interruptNumber = state->interruptNumber;
+  save->numInterrupt = machine->numInterrupt;
+  save->shift0 = machine->shift0;
+  save->shift1 = machine->shift1;
+  save->shiftOffset = machine->shiftOffset;
+  save->port1 = machine->port1;
+  save->port2 = machine->port2;
+  for(page = 0; page < INVADERS_RAM_SIZE / MEMORY_PAGE_SIZE; page++) {
+    memcpy(&save->ram[page * MEMORY_PAGE_SIZE],
+      state->readPages[INVADERS_RAM / MEMORY_PAGE_SIZE + page], MEMORY_PAGE_SIZE);
+  }
+}
+
+/* Function to check a save was written by this build
+  Input: save
+  Output: 1 if it can be restored, 0 otherwise
+*/
+int invadersSaveValid(const invadersSave* save) {
+  return memcmp(save->magic, INVADERS_SAVE_MAGIC, sizeof(INVADERS_SAVE_MAGIC)) == 0 &&
+    save->version == INVADERS_SAVE_VERSION && save->byteOrder == INVADERS_SAVE_BYTE_ORDER &&
+    save->size == sizeof(invadersSave);
+}
+
+/* Function to put a machine back the way it was saved
+  Input: machine, save checked with invadersSaveValid
+  Output: void
+  The machine keeps its memory map, ROM and port hooks. Ops decoded
+  from RAM or its mirrors are dropped, and with DIRTY_PAGES every RAM
+  page is marked.
+*/
+void restoreInvadersSave(invadersMachine* machine, const invadersSave* save) {
+  state8080 *state = machine->state;
+  int page;
+  machine->nextInterrupt = save->nextInterrupt;
+  machine->cyclesRun = save->cyclesRun;
+  machine->frames = save->frames;
+  state->sp = save->sp;
+  state->pc = save->pc;
+  state->a = save->a;
+  state->b = save->b;
+  state->c = save->c;
+  state->d = save->d;
+  state->e = save->e;
+  state->h = save->h;
+  state->l = save->l;
+  state->cc.z = save->z;
+  state->cc.s = save->s;
+  state->cc.p = save->p;
+  state->cc.cy = save->cy;
+  state->cc.ac = save->ac;
+  state->cc.pad = save->flag5;
+  state->lazyFlags = 0;
+  state->intEnable = save->intEnable;
+  state->interruptPending = save->interruptPending;
+  state->interruptNumber = save->interruptNumber;
+  machine->numInterrupt = save->numInterrupt;
+  machine->shift0 = save->shift0;
+  machine->shift1 = save->shift1;
+  machine->shiftOffset = save->shiftOffset;
+  machine->port1 = save->port1;
+  machine->port2 = save->port2;
+  for(page = 0; page < INVADERS_RAM_SIZE / MEMORY_PAGE_SIZE; page++) {
+    memcpy(state->writePages[INVADERS_RAM / MEMORY_PAGE_SIZE + page],
+      &save->ram[page * MEMORY_PAGE_SIZE], MEMORY_PAGE_SIZE);
+#ifdef DIRTY_PAGES
+    MARK_DIRTY(INVADERS_RAM / MEMORY_PAGE_SIZE + page);
+#endif
+  }
+#if defined(PREDECODE_CACHE) || defined(BLOCK_CACHE)
+  // Code decoded from RAM is dropped at every address the RAM shows up at
+  for(page = INVADERS_RAM / MEMORY_PAGE_SIZE; page < (INVADERS_RAM + INVADERS_RAM_SIZE) / MEMORY_PAGE_SIZE; page++) {
+    int alias = page;
+    do {
+#ifdef PREDECODE_CACHE
+      int address;
+      for(address = alias * MEMORY_PAGE_SIZE; address < (alias + 1) * MEMORY_PAGE_SIZE; address++) {
+        state->decodeCache[address].length = 0;
+      }
+#endif
+#ifdef BLOCK_CACHE
+      if(memchr(&state->blockCache->codeMap[alias * MEMORY_PAGE_SIZE], 1, MEMORY_PAGE_SIZE) != NULL) {
+        flushBlocks(state);
+      }
+#endif
+      alias = state->pageAliases[alias];
+    } while(alias != page);
+  }
+#endif
+}
+
+/* Function to save a machine to a file
+  Input: machine, filename
+  Output: 0 if it was saved, -1 if the file couldn't be written
+*/
+int writeInvadersSave(invadersMachine* machine, const char* fileName) {
+  invadersSave *save = malloc(sizeof(invadersSave));
+  FILE *f = fopen(fileName, "wb");
+  int written;
+  if(f == NULL) {
+    printf("ERROR: Cannot open %s\n", fileName);
+    free(save);
+    return -1;
+  }
+  storeInvadersSave(machine, save);
+  written = fwrite(save, sizeof(invadersSave), 1, f) == 1;
+  written = fclose(f) == 0 && written;
+  free(save);
+  if(!written) {
+    printf("ERROR: Cannot write %s\n", fileName);
+    return -1;
+  }
+  return 0;
+}
+
+/* Function to map a save file for restoring
+  Input: filename
+  Output: the save, read only, NULL if the file can't be mapped or
+    wasn't written by this build
+  Restore it with restoreInvadersSave as often as needed, then unmap it
+  with unmapInvadersSave
+*/
+const invadersSave* mapInvadersSave(const char* fileName) {
+  struct stat info;
+  invadersSave *save;
+  int fd = open(fileName, O_RDONLY);
+  if(fd < 0 || fstat(fd, &info) != 0 || info.st_size != sizeof(invadersSave)) {
+    printf("ERROR: %s isn't a save of this version\n", fileName);
+    if(fd >= 0) {
+      close(fd);
+    }
+    return NULL;
+  }
+  save = mmap(NULL, sizeof(invadersSave), PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(save == MAP_FAILED) {
+    printf("ERROR: Cannot map %s\n", fileName);
+    return NULL;
+  }
+  if(!invadersSaveValid(save)) {
+    printf("ERROR: %s isn't a save of this version\n", fileName);
+    munmap(save, sizeof(invadersSave));
+    return NULL;
+  }
+  return save;
+}
+
+/* Function to unmap a save from mapInvadersSave
+  Input: save
+  Output: void
+*/
+void unmapInvadersSave(const invadersSave* save) {
+  munmap((void*) save, sizeof(invadersSave));
+}
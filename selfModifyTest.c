@@ -0,0 +1,110 @@
+/* Tests for code that writes over itself
+  Jack R. McCluskey
+
+  Runs short programs that store into ops of the block they are
+  running, and checks they end as the plain interpreter leaves them.
+  Build it with the same engine flags as the emulator to test that
+  engine, like -DBLOCK_CACHE -DJIT_RECOMPILER.
+  Usage: selfModifyTest   (prints each failure, exits with 1 if any)
+*/
+
+#define NO_EMULATOR_MAIN
+#include"emulatorShell.c"
+
+int failures;
+
+/* Helper function to report a failed check
+  Input: whether the check passed, what was checked
+  Output: void
+*/
+void check(int passed, const char* what) {
+  if(!passed) {
+    printf("FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+/* Helper function to make a state running a program from 0
+  Input: program, its length
+  Output: new state8080 struct
+*/
+state8080* loadProgram(const uint8_t* program, size_t length) {
+  state8080 *state = initializeState();
+  memcpy(state->memory, program, length);
+  return state;
+}
+
+/* Test a store that turns a later op of the block into another op
+  Input: void
+  Output: void
+*/
+void testStoreOverOp() {
+  static const uint8_t program[] = {
+    0x3e, 0x90, // MVI A,90h
+    0x06, 0x10, // MVI B,10h
+    0x32, 0x08, 0x00, // STA 0008h, turns the RST 3 into SUB B
+    0x00, // NOP
+    0xdf, // RST 3
+    0xc3, 0xfd, 0xff // JMP 0000h, jumps land 3 bytes on
+  };
+  state8080 *state = loadProgram(program, sizeof(program));
+  check(runCycles(state, 45) == 45, "store over an op runs the cycles asked for");
+  check(state->a == 0x80 && state->pc == 0x0000, "store over an op runs the new op");
+  freeState(state);
+}
+
+/* Test a store into the operand of a later op of a block run often
+  enough to be compiled
+  Input: void
+  Output: void
+*/
+void testStoreIntoHotBlock() {
+  static const uint8_t program[] = {
+    0x77, // MOV M,A
+    0x06, 0x11, // MVI B,11h
+    0xc3, 0xfd, 0xff // JMP 0000h
+  };
+  state8080 *state = loadProgram(program, sizeof(program));
+  state->a = 0x22;
+  state->hl = 0x3000;
+  runCycles(state, 24 * 20);
+  state->b = 0;
+  state->hl = 0x0002;
+  check(runCycles(state, 24) == 24, "store into a hot block runs the cycles asked for");
+  check(state->b == 0x22 && state->pc == 0x0000, "store into a hot block runs the new operand");
+  freeState(state);
+}
+
+/* Test a store through a mirror of the page the code runs from
+  Input: void
+  Output: void
+*/
+void testStoreThroughMirror() {
+  static const uint8_t program[] = {
+    0x3e, 0x90, // MVI A,90h
+    0x06, 0x10, // MVI B,10h
+    0x12, // STAX D, at 6008h turns the ADD B into SUB B
+    0x00, 0x00, 0x00, // NOP
+    0x80, // ADD B
+    0xc3, 0xfd, 0x1f // JMP 2000h
+  };
+  state8080 *state = initializeState();
+  mapMemory(state, spaceInvadersMap, SPACE_INVADERS_REGIONS);
+  memcpy(&state->memory[0x2000], program, sizeof(program));
+  state->pc = 0x2000;
+  state->de = 0x3000;
+  runCycles(state, 47 * 20);
+  check(state->a == 0xa0, "code in RAM runs");
+  state->de = 0x6008;
+  check(runCycles(state, 47) == 47, "store through a mirror runs the cycles asked for");
+  check(state->a == 0x80 && state->pc == 0x2000, "store through a mirror runs the new op");
+  freeState(state);
+}
+
+int main(int argc, char const *argv[]) {
+  testStoreOverOp();
+  testStoreIntoHotBlock();
+  testStoreThroughMirror();
+  printf("%d failures\n", failures);
+  return failures > 0;
+}
@@ -0,0 +1,133 @@
+/* Snapshots and clones of 8080 states
+  Jack R. McCluskey
+
+  snapshotState copies a state's registers and memory once, into a
+  shared memory file. cloneSnapshot then makes a new state from it by
+  copying the registers and mapping the file copy on write over the
+  new state's memory, so a clone costs one mmap and its host pages are
+  only copied when it first writes them. Pages read from ROM files
+  stay shared with the source. Snapshot once and clone from it as often
+  as needed, cloneState does both for a single clone.
+  Included by emulatorShell.c.
+*/
+
+/* Struct for the frozen copy of a state
+  state keeps the source's pointers, which clones rebase onto their
+  own memory and romSink
+*/
+typedef struct stateSnapshot {
+  state8080 state;
+  uint8_t *sourceRomSink; // Where the source's romSink was
+  uint8_t *memory; // The memory file, mapped read only
+  int fd;
+} stateSnapshot;
+
+unsigned long numSnapshotFiles; // Makes the name of each memory file unique
+
+/* Function to freeze a state so it can be cloned
+  Input: state8080 struct
+  Output: new stateSnapshot struct
+  The state can go on running or be freed, the snapshot doesn't change
+  Exits if the memory file can't be made
+*/
+stateSnapshot* snapshotState(state8080* state) {
+  stateSnapshot *snapshot = malloc(sizeof(stateSnapshot));
+  uint8_t *memory;
+  char name[64];
+  snprintf(name, sizeof(name), "/state8080-%d-%lu", (int) getpid(),
+    __atomic_add_fetch(&numSnapshotFiles, 1, __ATOMIC_RELAXED));
+  snapshot->fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if(snapshot->fd < 0 || ftruncate(snapshot->fd, 0x10000) != 0) {
+    printf("ERROR: Cannot create a snapshot\n");
+    exit(1);
+  }
+  shm_unlink(name); // The file lives on while it is open or mapped
+  memory = mmap(NULL, 0x10000, PROT_READ | PROT_WRITE, MAP_SHARED, snapshot->fd, 0);
+  if(memory == MAP_FAILED) {
+    printf("ERROR: Cannot create a snapshot\n");
+    exit(1);
+  }
+  memcpy(memory, state->memory, 0x10000);
+  mprotect(memory, 0x10000, PROT_READ);
+  snapshot->memory = memory;
+  snapshot->state = *state;
+  snapshot->sourceRomSink = state->romSink;
+  return snapshot;
+}
+
+/* Helper function to move a page pointer of the source onto a clone
+  Input: stateSnapshot struct, clone, page pointer of the source
+  Output: page pointer for the clone
+*/
+uint8_t* rebasePage(stateSnapshot* snapshot, state8080* clone, uint8_t* page) {
+  if(page >= snapshot->state.memory && page < snapshot->state.memory + 0x10000) {
+    return clone->memory + (page - snapshot->state.memory);
+  }
+  if(page == snapshot->sourceRomSink) {
+    return clone->romSink;
+  }
+  return page; // Mapped from a ROM file
+}
+
+/* Function to make a new state from a snapshot
+  Input: stateSnapshot struct, arena to make the state in, NULL to
+    make it with initializeState
+  Output: new state8080 struct, free it with freeState
+  The clone has the registers, flags, interrupt state, memory map and
+  port hooks of the source, but empty caches and no watchpoints. Set
+  userData if the hooks use it, it still points at the source's.
+  Memory in a huge page from the host's pool is copied instead.
+*/
+state8080* cloneSnapshot(stateSnapshot* snapshot, stateArena* arena) {
+  state8080 *clone = arena != NULL ? arenaState(arena) : initializeState();
+  state8080 own = *clone;
+  int page;
+  if((arena != NULL && !arenaCanRemap(arena, clone)) ||
+      mmap(own.memory, 0x10000, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+        snapshot->fd, 0) == MAP_FAILED) {
+    memcpy(own.memory, snapshot->memory, 0x10000);
+  }
+
+  *clone = snapshot->state;
+  clone->memory = own.memory;
+  clone->arena = own.arena;
+#ifdef WATCHPOINTS
+  clone->watchMap = NULL;
+#endif
+#ifdef PREDECODE_CACHE
+  clone->decodeCache = own.decodeCache;
+#endif
+#ifdef BLOCK_CACHE
+  clone->blockCache = own.blockCache;
+#endif
+  for(page = 0; page <= MEMORY_PAGES; page++) {
+    clone->readPages[page] = rebasePage(snapshot, clone, snapshot->state.readPages[page]);
+  }
+  for(page = 0; page < MEMORY_PAGES; page++) {
+    clone->writePages[page] = rebasePage(snapshot, clone, snapshot->state.writePages[page]);
+  }
+  return clone;
+}
+
+/* Function to free a snapshot
+  Input: stateSnapshot struct
+  Output: void
+  Clones made from it keep their memory
+*/
+void freeSnapshot(stateSnapshot* snapshot) {
+  munmap(snapshot->memory, 0x10000);
+  close(snapshot->fd);
+  free(snapshot);
+}
+
+/* Function to clone a state once
+  Input: state8080 struct, arena to make the clone in or NULL
+  Output: new state8080 struct, see cloneSnapshot
+  Copies the source's memory, use snapshotState to make many clones
+*/
+state8080* cloneState(state8080* state, stateArena* arena) {
+  stateSnapshot *snapshot = snapshotState(state);
+  state8080 *clone = cloneSnapshot(snapshot, arena);
+  freeSnapshot(snapshot);
+  return clone;
+}
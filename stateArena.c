@@ -0,0 +1,275 @@
+/* Arena allocator for 8080 states
+  Jack R. McCluskey
+
+  Carves states out of large regions mapped in one go, so making and
+  freeing them costs no malloc calls. Each state gets one slot,
+  its 64k of memory followed by the state8080 struct, so the registers
+  start on their own cache line right after the machine's RAM. With
+  PREDECODE_CACHE or BLOCK_CACHE the caches are in the slot as well,
+  and with JIT_RECOMPILER each region maps one executable buffer split
+  between its slots, kept by a slot while it is freed and taken again.
+  On Linux an arena can be bound to a NUMA node with bindStateArena, so
+  every state in it lives on the node of the thread that runs them.
+  freeState hands a slot back to its arena, and the next arenaState
+  takes it again. Arenas aren't locked, use one per thread or make all
+  the states before starting threads.
+  Included by emulatorShell.c.
+*/
+
+#define ARENA_REGIONS 64
+#define ARENA_HUGE_PAGES 0x01 // Back regions with huge pages if the host has them
+#define ARENA_HUGE_PAGE_SIZE 0x200000
+#define ARENA_LINE 64
+#define ARENA_MPOL_PREFERRED 1 // MPOL_PREFERRED from numaif.h, which may not be installed
+
+#define ARENA_ROUND(size, to) (((size) + (to) - 1) / (to) * (to))
+
+/* Struct for an arena of states
+  Slots are handed out in order from the regions, and slots of freed
+  states are kept on a list linked through their userData
+*/
+typedef struct stateArena {
+  uint8_t *regions[ARENA_REGIONS];
+  uint8_t hugeTlb[ARENA_REGIONS]; // Region came from the host's huge page pool
+#ifdef JIT_RECOMPILER
+  uint8_t *jitBuffers[ARENA_REGIONS]; // JIT buffers of each region's slots, NULL if the host refused
+#endif
+  int numRegions;
+  int statesPerRegion;
+  size_t regionSize;
+  size_t slotSize;
+  size_t stateOffset; // Where the state8080 struct starts in a slot
+#ifdef PREDECODE_CACHE
+  size_t decodeOffset;
+#endif
+#ifdef BLOCK_CACHE
+  size_t blockOffset;
+#endif
+  int flags;
+  int node; // NUMA node new regions are bound to, -1 for the host's default
+  int slotsCarved; // Slots handed out at least once, in region order
+  int liveStates; // States made by arenaState and not freed yet
+  state8080 *freeStates; // Freed states, to be handed out again
+} stateArena;
+
+/* Function to make an empty arena
+  Input: number of states each region holds, ARENA_HUGE_PAGES or 0
+  Output: new stateArena struct
+  Nothing is mapped until the first arenaState. The arena grows by
+  a region at a time, up to ARENA_REGIONS of them.
+*/
+stateArena* createStateArena(int statesPerRegion, int flags) {
+  stateArena *arena = calloc(1, sizeof(stateArena));
+  size_t pageSize = sysconf(_SC_PAGESIZE);
+  size_t offset = ARENA_ROUND(0x10000 + sizeof(state8080), ARENA_LINE);
+  if(arena == NULL || statesPerRegion < 1) {
+    printf("ERROR: Cannot create a state arena\n");
+    exit(1);
+  }
+  arena->stateOffset = 0x10000;
+#ifdef PREDECODE_CACHE
+  arena->decodeOffset = offset;
+  offset = ARENA_ROUND(offset + 0x10000 * sizeof(decodedOp), ARENA_LINE);
+#endif
+#ifdef BLOCK_CACHE
+  arena->blockOffset = offset;
+  offset = ARENA_ROUND(offset + sizeof(blockCache), ARENA_LINE);
+#endif
+  // Whole host pages, so every slot's memory starts on a page for the watchpoints
+  arena->slotSize = ARENA_ROUND(offset, pageSize);
+  arena->statesPerRegion = statesPerRegion;
+  arena->regionSize = arena->slotSize * statesPerRegion;
+  arena->flags = flags;
+  arena->node = -1;
+  if(flags & ARENA_HUGE_PAGES) {
+    arena->regionSize = ARENA_ROUND(arena->regionSize, ARENA_HUGE_PAGE_SIZE);
+  }
+  return arena;
+}
+
+/* Helper function to map one more region
+  Input: stateArena struct
+  Output: 0 if the region was mapped, -1 if the arena is full
+  Tries huge pages from the host's pool first, then asks for them to be
+  made on the fly. Huge pages from the pool can't be protected a host
+  page at a time, so they aren't used with WATCHPOINTS.
+*/
+int growStateArena(stateArena* arena) {
+  uint8_t *region = MAP_FAILED;
+  if(arena->numRegions == ARENA_REGIONS) {
+    return -1;
+  }
+#if defined(MAP_HUGETLB) && !defined(WATCHPOINTS)
+  if(arena->flags & ARENA_HUGE_PAGES) {
+    region = mmap(NULL, arena->regionSize, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    arena->hugeTlb[arena->numRegions] = region != MAP_FAILED;
+  }
+#endif
+  if(region == MAP_FAILED) {
+    region = mmap(NULL, arena->regionSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(region == MAP_FAILED) {
+      return -1;
+    }
+#ifdef MADV_HUGEPAGE
+    if(arena->flags & ARENA_HUGE_PAGES) {
+      madvise(region, arena->regionSize, MADV_HUGEPAGE);
+    }
+#endif
+  }
+#if defined(__linux__) && defined(SYS_mbind)
+  // Pages are placed when first written, so binding before then moves nothing
+  if(arena->node >= 0) {
+    unsigned long nodeMask = 1UL << arena->node;
+    syscall(SYS_mbind, region, arena->regionSize, ARENA_MPOL_PREFERRED, &nodeMask,
+      8 * sizeof(nodeMask) + 1, 0);
+  }
+#endif
+#ifdef JIT_RECOMPILER
+  arena->jitBuffers[arena->numRegions] = createJitBuffer(arena->statesPerRegion);
+#endif
+  arena->regions[arena->numRegions++] = region;
+  return 0;
+}
+
+/* Function to place an arena's states on a NUMA node
+  Input: stateArena struct, node number below 64
+  Output: void
+  Only regions mapped after the call are bound, so call it before the
+  first arenaState. The node is preferred, the host falls back to
+  other nodes when it is full. Does nothing on other hosts.
+*/
+void bindStateArena(stateArena* arena, int node) {
+  if(node >= 0 && node < 64) {
+    arena->node = node;
+  }
+}
+
+/* Helper function to find the start of a slot
+  Input: stateArena struct, slot number
+  Output: first byte of the slot
+*/
+uint8_t* arenaSlot(stateArena* arena, int slot) {
+  return arena->regions[slot / arena->statesPerRegion] +
+    (size_t) (slot % arena->statesPerRegion) * arena->slotSize;
+}
+
+/* Helper function to check if a state's memory can be mapped over
+  Input: stateArena struct, state8080 struct made by it
+  Output: 1 if host pages of the slot can be replaced, 0 if they are
+    part of a huge page from the pool
+*/
+int arenaCanRemap(stateArena* arena, state8080* state) {
+  int region;
+  for(region = 0; region < arena->numRegions; region++) {
+    if(state->memory >= arena->regions[region] &&
+        state->memory < arena->regions[region] + arena->regionSize) {
+      return !arena->hugeTlb[region];
+    }
+  }
+  return 0;
+}
+
+/* Function to make a state in an arena
+  Input: stateArena struct
+  Output: new state8080 struct, like one from initializeState
+  Free it with freeState. Exits if the arena can't grow.
+*/
+state8080* arenaState(stateArena* arena) {
+  state8080 *state = arena->freeStates;
+  uint8_t *slot;
+#ifdef JIT_RECOMPILER
+  uint8_t *jitBuffer;
+#endif
+  if(state != NULL) {
+    // A slot used before, zeroed as a freshly mapped one would be
+    arena->freeStates = state->userData;
+    slot = state->memory;
+#ifdef JIT_RECOMPILER
+    jitBuffer = state->blockCache->jitBuffer; // Old code in it is never run, jitUsed starts at 0
+#endif
+    memset(slot, 0, arena->slotSize);
+  } else {
+    if(arena->slotsCarved == arena->numRegions * arena->statesPerRegion &&
+        growStateArena(arena) != 0) {
+      printf("ERROR: Cannot allocate memory\n");
+      exit(1);
+    }
+#ifdef JIT_RECOMPILER
+    jitBuffer = arena->jitBuffers[arena->slotsCarved / arena->statesPerRegion];
+    if(jitBuffer != NULL) {
+      jitBuffer += (size_t) (arena->slotsCarved % arena->statesPerRegion) * JIT_BUFFER_SIZE;
+    }
+#endif
+    slot = arenaSlot(arena, arena->slotsCarved++);
+  }
+  state = (state8080*) (slot + arena->stateOffset);
+  state->memory = slot;
+  state->arena = arena;
+  mapMemory(state, &flatMap, 1);
+#ifdef PREDECODE_CACHE
+  state->decodeCache = (decodedOp*) (slot + arena->decodeOffset);
+#endif
+#ifdef BLOCK_CACHE
+  state->blockCache = (blockCache*) (slot + arena->blockOffset);
+#endif
+#ifdef JIT_RECOMPILER
+  state->blockCache->jitBuffer = jitBuffer;
+#endif
+  arena->liveStates++;
+  return state;
+}
+
+/* Helper function to give a state's slot back to its arena
+  Input: state8080 struct made by arenaState
+  Output: void
+  Called by freeState
+*/
+void releaseArenaState(state8080* state) {
+  stateArena *arena = state->arena;
+#ifdef WATCHPOINTS
+  if(state->watchMap != NULL) {
+    mprotect(state->memory, 0x10000, PROT_READ | PROT_WRITE);
+  }
+  forgetWatchpoints(state);
+#endif
+  state->arena = NULL;
+  state->userData = arena->freeStates;
+  arena->freeStates = state;
+  arena->liveStates--;
+}
+
+/* Function to free every state of an arena at once
+  Input: stateArena struct
+  Output: void
+  The regions stay mapped for the next states. Any state made by the
+  arena before the reset can't be used any more.
+*/
+void resetStateArena(stateArena* arena) {
+  int slot;
+  for(slot = 0; slot < arena->slotsCarved && arena->liveStates > 0; slot++) {
+    state8080 *state = (state8080*) (arenaSlot(arena, slot) + arena->stateOffset);
+    if(state->arena == arena) {
+      releaseArenaState(state);
+    }
+  }
+}
+
+/* Function to free an arena and unmap its regions
+  Input: stateArena struct
+  Output: void
+  Frees the states still in it first
+*/
+void freeStateArena(stateArena* arena) {
+  int i;
+  resetStateArena(arena);
+  for(i = 0; i < arena->numRegions; i++) {
+    munmap(arena->regions[i], arena->regionSize);
+#ifdef JIT_RECOMPILER
+    if(arena->jitBuffers[i] != NULL) {
+      munmap(arena->jitBuffers[i], (size_t) arena->statesPerRegion * JIT_BUFFER_SIZE);
+    }
+#endif
+  }
+  free(arena);
+}
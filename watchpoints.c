@@ -0,0 +1,216 @@
+/* Memory watchpoints for the 8080 emulator
+  Jack R. McCluskey
+
+  Traps guest writes to chosen addresses without a compare in any of
+  the handlers. The host pages of memory holding a watched address are
+  made read only, so a write to them faults. The SIGSEGV handler makes
+  the page writable again and sets the x86 trap flag, so the write runs
+  and stops right after in the SIGTRAP handler, which reports it and
+  protects the page again. Runs with no watchpoints set cost nothing.
+  Included by emulatorShell.c when built with WATCHPOINTS.
+*/
+
+#include <signal.h>
+#include <stdint.h>
+
+#if !defined(__x86_64__)
+#error "WATCHPOINTS only supports x86-64 hosts"
+#endif
+
+#ifdef __APPLE__
+#define TRAP_FLAGS(context) (((ucontext_t*) (context))->uc_mcontext->__ss.__rflags)
+#else
+#include <ucontext.h>
+#define TRAP_FLAGS(context) (((ucontext_t*) (context))->uc_mcontext.gregs[REG_EFL])
+#endif
+#define HOST_TF 0x100 // Trap flag, stops after the next host instruction
+
+#define WATCH_STATE_SLOTS 64
+
+state8080 *watchedStates[WATCH_STATE_SLOTS]; // States with a watchMap
+int numWatchedStates;
+long watchPageSize; // Host page size, 0 until the handlers are installed
+
+// Write being stepped on this thread, between the two signal handlers
+__thread state8080 *watchStepState;
+__thread uint8_t *watchStepByte;
+
+/* Helper function to find the host page holding a byte
+  Input: pointer into memory
+  Output: start of its host page
+*/
+uint8_t* watchHostPage(uint8_t* byte) {
+  return (uint8_t*) ((uintptr_t) byte & ~(uintptr_t) (watchPageSize - 1));
+}
+
+/* Helper function to find the state a faulting write belongs to
+  Input: address the host faulted on
+  Output: state whose memory holds the address, NULL if none does
+*/
+state8080* findWatchedState(uint8_t* fault) {
+  int i;
+  for(i = 0; i < numWatchedStates; i++) {
+    uintptr_t start = (uintptr_t) watchedStates[i]->memory;
+    if((uintptr_t) fault >= start && (uintptr_t) fault < start + 0x10000) {
+      return watchedStates[i];
+    }
+  }
+  return NULL;
+}
+
+/* Helper function to check the watch bit of a memory offset
+  Input: state8080 struct, offset into memory
+  Output: 1 if a watchpoint is set there, 0 otherwise
+*/
+int isWatched(state8080* state, uint16_t offset) {
+  return (state->watchMap[offset / 8] >> (offset % 8)) & 1;
+}
+
+/* Function to report a watched write
+  Input: state8080 struct, offset into memory, value written
+  Output: void
+  Calls watchHook if set, and prints the write otherwise. Runs inside
+  the SIGTRAP handler, so the hook mustn't call back into the emulator.
+*/
+void reportWatchpoint(state8080* state, uint16_t offset, uint8_t value) {
+  if(state->watchHook != NULL) {
+    state->watchHook(state, offset, value);
+  } else {
+    fprintf(stderr, "Watchpoint at %04x written with %02x, pc %04x\n", offset, value, state->pc);
+  }
+}
+
+/* Signal handler for writes to protected pages
+  Input: signal number, fault info, host registers
+  Output: void
+  Lets the faulting write through with the trap flag set. Faults that
+  aren't in watched memory crash as they would without watchpoints.
+*/
+void watchFaultHandler(int signalNumber, siginfo_t* info, void* context) {
+  uint8_t *fault = info->si_addr;
+  state8080 *state = findWatchedState(fault);
+  if(state == NULL) {
+    signal(signalNumber, SIG_DFL);
+    return;
+  }
+  mprotect(watchHostPage(fault), watchPageSize, PROT_READ | PROT_WRITE);
+  watchStepState = state;
+  watchStepByte = fault;
+  TRAP_FLAGS(context) |= HOST_TF;
+}
+
+/* Signal handler for the step after a write to a protected page
+  Input: signal number, fault info, host registers
+  Output: void
+  Protects the page again and reports the write if it hit a watched
+  address rather than another byte of the same host page
+*/
+void watchTrapHandler(int signalNumber, siginfo_t* info, void* context) {
+  state8080 *state = watchStepState;
+  uint16_t offset;
+  if(state == NULL) {
+    signal(signalNumber, SIG_DFL);
+    raise(signalNumber);
+    return;
+  }
+  TRAP_FLAGS(context) &= ~HOST_TF;
+  offset = watchStepByte - state->memory;
+  watchStepState = NULL;
+  mprotect(watchHostPage(watchStepByte), watchPageSize, PROT_READ);
+  if(isWatched(state, offset)) {
+    reportWatchpoint(state, offset, state->memory[offset]);
+  }
+}
+
+/* Function to install the signal handlers, once per process
+  Input: void
+  Output: void
+*/
+void installWatchHandlers() {
+  struct sigaction action;
+  if(watchPageSize != 0) {
+    return;
+  }
+  watchPageSize = sysconf(_SC_PAGESIZE);
+  memset(&action, 0, sizeof(action));
+  action.sa_flags = SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  action.sa_sigaction = watchFaultHandler;
+  sigaction(SIGSEGV, &action, NULL);
+  sigaction(SIGBUS, &action, NULL); // macOS reports protected pages as SIGBUS
+  action.sa_sigaction = watchTrapHandler;
+  sigaction(SIGTRAP, &action, NULL);
+}
+
+/* Function to trap writes to a guest address
+  Input: state8080 struct, guest address
+  Output: 0 if the watchpoint was set, -1 if the address is ROM or
+    too many states have watchpoints
+  Writes through a mirror of the address are trapped too, and are
+  reported with the address they land on. Set watchpoints after the
+  ROM and RAM have been loaded, since the loaders write to memory.
+*/
+int addWatchpoint(state8080* state, uint16_t address) {
+  uint8_t *byte = &state->writePages[address >> 8][address & 0xff];
+  uint16_t offset;
+  if(state->writePages[address >> 8] == state->romSink) {
+    return -1;
+  }
+  if(state->watchMap == NULL) {
+    if(numWatchedStates == WATCH_STATE_SLOTS) {
+      return -1;
+    }
+    installWatchHandlers();
+    state->watchMap = calloc(0x10000 / 8, 1);
+    watchedStates[numWatchedStates++] = state;
+  }
+  offset = byte - state->memory;
+  state->watchMap[offset / 8] |= 1 << (offset % 8);
+  mprotect(watchHostPage(byte), watchPageSize, PROT_READ);
+  return 0;
+}
+
+/* Function to stop trapping writes to a guest address
+  Input: state8080 struct, guest address
+  Output: void
+  The host page becomes writable again once it has no watchpoints left
+*/
+void removeWatchpoint(state8080* state, uint16_t address) {
+  uint8_t *byte = &state->writePages[address >> 8][address & 0xff];
+  uint8_t *page = watchHostPage(byte);
+  uint32_t offset, first, last;
+  if(state->watchMap == NULL || state->writePages[address >> 8] == state->romSink) {
+    return;
+  }
+  offset = byte - state->memory;
+  state->watchMap[offset / 8] &= ~(1 << (offset % 8));
+
+  first = page < state->memory ? 0 : page - state->memory;
+  last = first + watchPageSize > 0x10000 ? 0x10000 : first + watchPageSize;
+  for(offset = first; offset < last; offset++) {
+    if(isWatched(state, offset)) {
+      return;
+    }
+  }
+  mprotect(page, watchPageSize, PROT_READ | PROT_WRITE);
+}
+
+/* Function to drop every watchpoint of a state
+  Input: state8080 struct
+  Output: void
+  Called by freeState before its memory is unmapped
+*/
+void forgetWatchpoints(state8080* state) {
+  int i;
+  if(state->watchMap == NULL) {
+    return;
+  }
+  for(i = 0; i < numWatchedStates; i++) {
+    if(watchedStates[i] == state) {
+      watchedStates[i] = watchedStates[--numWatchedStates];
+      break;
+    }
+  }
+  free(state->watchMap);
+  state->watchMap = NULL;
+}